@@ -318,6 +318,7 @@ these bits, just add new ones on the end, in order to remain compatible. */
 #define PCRE_EXTRA_MATCH_LIMIT_RECURSION  0x0010
 #define PCRE_EXTRA_MARK                   0x0020
 #define PCRE_EXTRA_EXECUTABLE_JIT         0x0040
+#define PCRE_EXTRA_MATCH_CONTEXT          0x0080
 
 /* Types */
 
@@ -339,6 +340,15 @@ typedef struct real_pcre16_jit_stack pcre16_jit_stack;
 struct real_pcre32_jit_stack;     /* declaration; the definition is private  */
 typedef struct real_pcre32_jit_stack pcre32_jit_stack;
 
+struct real_pcre_match_context;   /* declaration; the definition is private  */
+typedef struct real_pcre_match_context pcre_match_context;
+
+struct real_pcre16_match_context; /* declaration; the definition is private  */
+typedef struct real_pcre16_match_context pcre16_match_context;
+
+struct real_pcre32_match_context; /* declaration; the definition is private  */
+typedef struct real_pcre32_match_context pcre32_match_context;
+
 /* If PCRE is compiled with 16 bit character support, PCRE_UCHAR16 must contain
 a 16 bit wide signed data type. Otherwise it can be a dummy data type since
 pcre16 functions are not implemented. There is a check for this in pcre_internal.h. */
@@ -382,6 +392,7 @@ typedef struct pcre_extra {
   unsigned long int match_limit_recursion; /* Max recursive calls to match() */
   unsigned char **mark;           /* For passing back a mark pointer */
   void *executable_jit;           /* Contains a pointer to a compiled jit code */
+  pcre_match_context *match_context; /* Memory reused across matches */
 } pcre_extra;
 
 /* Same structure as above, but with 16 bit char pointers. */
@@ -395,6 +406,7 @@ typedef struct pcre16_extra {
   unsigned long int match_limit_recursion; /* Max recursive calls to match() */
   PCRE_UCHAR16 **mark;            /* For passing back a mark pointer */
   void *executable_jit;           /* Contains a pointer to a compiled jit code */
+  pcre16_match_context *match_context; /* Memory reused across matches */
 } pcre16_extra;
 
 /* Same structure as above, but with 32 bit char pointers. */
@@ -408,6 +420,7 @@ typedef struct pcre32_extra {
   unsigned long int match_limit_recursion; /* Max recursive calls to match() */
   PCRE_UCHAR32 **mark;            /* For passing back a mark pointer */
   void *executable_jit;           /* Contains a pointer to a compiled jit code */
+  pcre32_match_context *match_context; /* Memory reused across matches */
 } pcre32_extra;
 
 /* The structure for passing out data via the pcre_callout_function. We use a
@@ -670,6 +683,33 @@ PCRE_EXP_DECL void pcre_jit_free_unused_memory(void);
 PCRE_EXP_DECL void pcre16_jit_free_unused_memory(void);
 PCRE_EXP_DECL void pcre32_jit_free_unused_memory(void);
 
+/* Match context related functions. */
+
+PCRE_EXP_DECL pcre_match_context *pcre_match_context_alloc(void);
+PCRE_EXP_DECL pcre16_match_context *pcre16_match_context_alloc(void);
+PCRE_EXP_DECL pcre32_match_context *pcre32_match_context_alloc(void);
+PCRE_EXP_DECL void pcre_match_context_free(pcre_match_context *);
+PCRE_EXP_DECL void pcre16_match_context_free(pcre16_match_context *);
+PCRE_EXP_DECL void pcre32_match_context_free(pcre32_match_context *);
+PCRE_EXP_DECL unsigned long int pcre_match_context_peak_depth(
+                  const pcre_match_context *);
+PCRE_EXP_DECL unsigned long int pcre16_match_context_peak_depth(
+                  const pcre16_match_context *);
+PCRE_EXP_DECL unsigned long int pcre32_match_context_peak_depth(
+                  const pcre32_match_context *);
+PCRE_EXP_DECL int  pcre_match_context_bind(pcre_match_context *,
+                  const pcre *, const pcre_extra *);
+PCRE_EXP_DECL int  pcre16_match_context_bind(pcre16_match_context *,
+                  const pcre16 *, const pcre16_extra *);
+PCRE_EXP_DECL int  pcre32_match_context_bind(pcre32_match_context *,
+                  const pcre32 *, const pcre32_extra *);
+PCRE_EXP_DECL int  pcre_exec_ctx(pcre_match_context *, PCRE_SPTR,
+                   int, int, int, int *, int);
+PCRE_EXP_DECL int  pcre16_exec_ctx(pcre16_match_context *, PCRE_SPTR16,
+                   int, int, int, int *, int);
+PCRE_EXP_DECL int  pcre32_exec_ctx(pcre32_match_context *, PCRE_SPTR32,
+                   int, int, int, int *, int);
+
 #ifdef __cplusplus
 }  /* extern "C" */
 #endif
@@ -158,6 +158,16 @@ if (extra_data != NULL && (extra_data->flags & PCRE_EXTRA_STUDY_DATA) != 0)
   study->size = swap_uint32(study->size);
   study->flags = swap_uint32(study->flags);
   study->minlength = swap_uint32(study->minlength);
+
+  /* Study data saved by an earlier release is shorter and never has the
+  required string flag set. The string itself is only set in 8-bit mode. */
+
+  if ((study->flags & PCRE_STUDY_REQSTR) != 0)
+    {
+    study->req_min_offset = swap_uint32(study->req_min_offset);
+    study->req_max_offset = swap_uint32(study->req_max_offset);
+    study->req_length = swap_uint32(study->req_length);
+    }
   }
 
 #ifndef COMPILE_PCRE8
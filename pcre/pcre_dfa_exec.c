@@ -3197,6 +3197,9 @@ const pcre_uchar *current_subject, *end_subject;
 const pcre_study_data *study = NULL;
 
 const pcre_uchar *req_char_ptr;
+#if defined COMPILE_PCRE8
+const pcre_uchar *req_string_ptr;
+#endif
 const pcre_uint8 *start_bits = NULL;
 BOOL has_first_char = FALSE;
 BOOL has_req_char = FALSE;
@@ -3260,6 +3263,9 @@ if (extra_data != NULL)
 current_subject = (const pcre_uchar *)subject + start_offset;
 end_subject = (const pcre_uchar *)subject + length;
 req_char_ptr = current_subject - 1;
+#if defined COMPILE_PCRE8
+req_string_ptr = current_subject - 1;
+#endif
 
 #ifdef SUPPORT_UTF
 /* PCRE_UTF(16|32) have the same value as PCRE_UTF8. */
@@ -3605,6 +3611,26 @@ for (;;)
           req_char_ptr = p;
           }
         }
+
+#if defined COMPILE_PCRE8
+      /* If study found a string that every match contains, it must be
+      present at or after its least offset from the start of the match. As for
+      pcre_exec(), this search is not limited by REQ_BYTE_MAX. */
+
+      if (study != NULL && (study->flags & PCRE_STUDY_REQSTR) != 0)
+        {
+        if ((pcre_uint32)(end_subject - current_subject) <
+            study->req_min_offset + study->req_length)
+          break;
+        if (current_subject + study->req_min_offset > req_string_ptr)
+          {
+          req_string_ptr = PRIV(find_string)(current_subject +
+            study->req_min_offset, end_subject, study->req_string,
+            study->req_length);
+          if (req_string_ptr == NULL) break;
+          }
+        }
+#endif
       }
     }   /* End of optimizations that are done when not restarting */
 
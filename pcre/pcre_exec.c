@@ -351,7 +351,7 @@ argument of match(), which never changes. */
   heapframe *newframe = frame->Xnextframe;\
   if (newframe == NULL)\
     {\
-    newframe = (heapframe *)(PUBL(stack_malloc))(sizeof(heapframe));\
+    newframe = get_heapframe((frame_pool *)md->match_frame_pool);\
     if (newframe == NULL) RRETURN(PCRE_ERROR_NOMEMORY);\
     newframe->Xnextframe = NULL;\
     frame->Xnextframe = newframe;\
@@ -447,7 +447,161 @@ typedef struct heapframe {
 
 } heapframe;
 
-#endif
+/* Frames are not obtained one at a time. They are carved in order from blocks
+that are obtained from pcre_stack_malloc(), each block holding twice as many
+frames as the one before, up to a limit. Once carved, a frame stays on the
+Xnextframe chain that starts at the top-level frame, so that frames are reused
+by later calls of RMATCH() at the same depth. When pcre_exec() is given a match
+context, the pool lives there and the chain is kept for the next match. */
+
+#define FRAME_BLOCK_MIN     16
+#define FRAME_BLOCK_MAX   4096
+
+typedef struct frame_block {
+  struct frame_block *next;       /* The previously obtained block */
+  unsigned int size;              /* Number of frames in this block */
+  unsigned int used;              /* Number of frames carved so far */
+  heapframe frames[1];            /* The frames themselves */
+} frame_block;
+
+typedef struct frame_pool {
+  frame_block *blocks;            /* Most recently obtained block first */
+  heapframe *first;               /* First carved frame, which heads the chain */
+} frame_pool;
+
+
+/*************************************************
+*          Add a block to the frame pool         *
+*************************************************/
+
+/* Arguments:
+  pool      the frame pool
+
+Returns:    TRUE if the block was obtained
+*/
+
+static BOOL
+add_frame_block(frame_pool *pool)
+{
+frame_block *block = pool->blocks;
+unsigned int size = (block == NULL)? FRAME_BLOCK_MIN :
+  (block->size >= FRAME_BLOCK_MAX / 2)? FRAME_BLOCK_MAX : block->size * 2;
+
+block = (frame_block *)(PUBL(stack_malloc))(sizeof(frame_block) +
+  (size - 1) * sizeof(heapframe));
+if (block == NULL) return FALSE;
+block->next = pool->blocks;
+block->size = size;
+block->used = 0;
+pool->blocks = block;
+return TRUE;
+}
+
+
+/*************************************************
+*          Get a frame from the frame pool       *
+*************************************************/
+
+/* Arguments:
+  pool      the frame pool
+
+Returns:    a new frame, or NULL if memory could not be obtained
+*/
+
+static heapframe *
+get_heapframe(frame_pool *pool)
+{
+heapframe *frame;
+
+if ((pool->blocks == NULL || pool->blocks->used >= pool->blocks->size) &&
+    !add_frame_block(pool))
+  return NULL;
+
+frame = pool->blocks->frames + pool->blocks->used++;
+if (pool->first == NULL) pool->first = frame;
+return frame;
+}
+
+
+/*************************************************
+*          Free the blocks of a frame pool       *
+*************************************************/
+
+/* Blocks are freed in the reverse order to that in which they were obtained.
+
+Argument: the frame pool
+Returns:  nothing
+*/
+
+static void
+free_frame_pool(frame_pool *pool)
+{
+frame_block *block = pool->blocks;
+while (block != NULL)
+  {
+  frame_block *oldblock = block;
+  block = block->next;
+  (PUBL(stack_free))(oldblock);
+  }
+pool->blocks = NULL;
+pool->first = NULL;
+}
+
+#endif  /* NO_RECURSE */
+
+
+/*************************************************
+*      Get and release space to save offsets     *
+*************************************************/
+
+/* When a recursion has more offsets to save than fit in the space in the
+frame, they go in the save area that a match context provides, which is used as
+a stack because recursions are always finished in the reverse order to that in
+which they are started. If there is no save area, or it is not big enough,
+malloc() is used. The most that was wanted is remembered, so that the area can
+be made big enough before the next match.
+
+Arguments:
+  md        pointer to "static" info for the match
+  size      number of ints wanted
+
+Returns:    pointer to the space, or NULL if there is no memory
+*/
+
+static int *
+get_offset_save(match_data *md, int size)
+{
+md->save_area_wanted += size;
+if (md->save_area_wanted > md->save_area_peak)
+  md->save_area_peak = md->save_area_wanted;
+if (md->save_area_used + size <= md->save_area_size)
+  {
+  int *save = md->save_area + md->save_area_used;
+  md->save_area_used += size;
+  return save;
+  }
+return (int *)(PUBL(malloc))(size * sizeof(int));
+}
+
+
+/* Arguments:
+  md        pointer to "static" info for the match
+  save      the space that get_offset_save() returned
+  size      its size in ints
+
+Returns:    nothing
+*/
+
+static void
+release_offset_save(match_data *md, int *save, int size)
+{
+md->save_area_wanted -= size;
+if (md->save_area_used >= size &&
+    save == md->save_area + md->save_area_used - size)
+  md->save_area_used -= size;
+else
+  (PUBL(free))(save);
+}
 
 
 /***************************************************************************
@@ -723,6 +877,7 @@ haven't exceeded the recursive call limit. */
 
 if (md->match_call_count++ >= md->match_limit) RRETURN(PCRE_ERROR_MATCHLIMIT);
 if (rdepth >= md->match_limit_recursion) RRETURN(PCRE_ERROR_RECURSIONLIMIT);
+if (rdepth > md->peak_depth) md->peak_depth = rdepth;
 
 /* At the start of a group with an unlimited repeat that may match an empty
 string, the variable md->match_function_type is set to MATCH_CBEGROUP. It is
@@ -1743,7 +1898,8 @@ for (;;)
     all the potential data. There may be up to 65535 such values, which is too
     large to put on the stack, but using malloc for small numbers seems
     expensive. As a compromise, the stack is used when there are no more than
-    REC_STACK_SAVE_MAX values to store; otherwise malloc is used.
+    REC_STACK_SAVE_MAX values to store; otherwise a match context's save area
+    or malloc is used.
 
     There are also other values that have to be saved. We use a chained
     sequence of blocks that actually live on the stack. Thanks to Robin Houston
@@ -1787,7 +1943,7 @@ for (;;)
       else
         {
         new_recursive.offset_save =
-          (int *)(PUBL(malloc))(new_recursive.saved_max * sizeof(int));
+          get_offset_save(md, new_recursive.saved_max);
         if (new_recursive.offset_save == NULL) RRETURN(PCRE_ERROR_NOMEMORY);
         }
       memcpy(new_recursive.offset_save, md->offset_vector,
@@ -1813,7 +1969,8 @@ for (;;)
           {
           DPRINTF(("Recursion matched\n"));
           if (new_recursive.offset_save != stacksave)
-            (PUBL(free))(new_recursive.offset_save);
+            release_offset_save(md, new_recursive.offset_save,
+              new_recursive.saved_max);
 
           /* Set where we got to in the subject, and reset the start in case
           it was changed by \K. This *is* propagated back out of a recursion,
@@ -1831,7 +1988,8 @@ for (;;)
         if (rrc >= MATCH_BACKTRACK_MIN && rrc <= MATCH_BACKTRACK_MAX)
           {
           if (new_recursive.offset_save != stacksave)
-            (PUBL(free))(new_recursive.offset_save);
+            release_offset_save(md, new_recursive.offset_save,
+              new_recursive.saved_max);
           RRETURN(MATCH_NOMATCH);
           }
 
@@ -1841,7 +1999,8 @@ for (;;)
           {
           DPRINTF(("Recursion gave error %d\n", rrc));
           if (new_recursive.offset_save != stacksave)
-            (PUBL(free))(new_recursive.offset_save);
+            release_offset_save(md, new_recursive.offset_save,
+              new_recursive.saved_max);
           RRETURN(rrc);
           }
 
@@ -1853,7 +2012,8 @@ for (;;)
       DPRINTF(("Recursion didn't match\n"));
       md->recursive = new_recursive.prevrec;
       if (new_recursive.offset_save != stacksave)
-        (PUBL(free))(new_recursive.offset_save);
+        release_offset_save(md, new_recursive.offset_save,
+          new_recursive.saved_max);
       RRETURN(MATCH_NOMATCH);
       }
 
@@ -6292,210 +6452,778 @@ Undefine all the macros that were defined above to handle this. */
 ***************************************************************************/
 
 
-#ifdef NO_RECURSE
+#if defined COMPILE_PCRE8
 /*************************************************
-*          Release allocated heap frames         *
+*       Search for a possible match start        *
 *************************************************/
 
-/* This function releases all the allocated frames. The base frame is on the
-machine stack, and so must not be freed.
+/* These functions advance over the subject to the next place where a match
+can start, for the start-of-match optimizations in pcre_exec(). A single
+character is found with memchr(), which the C library already vectorizes. On
+x86 processors a pair of characters (as for a caseless first or required
+character) and a set of bytes from study are searched 16 or 32 bytes at a time,
+using SSE2 and SSSE3 or AVX2 as the processor allows. Which of these is used is
+decided at run time, so a library built for generic x86-64 still uses AVX2
+where it is present. Elsewhere the searches are simple byte loops, as before.
+
+The searches are done in code units. In UTF-8 mode this is still correct: the
+first and required characters are code units, a study bitmap is indexed by the
+first code unit of a character, and newline characters are all ASCII, so they
+can never be found in the middle of a character. */
+
+#if (defined __GNUC__ && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) || \
+     defined __clang__) && defined __SSE2__ && \
+    (defined __x86_64__ || defined __i386__)
+#define SUPPORT_SIMD_X86
+#include <immintrin.h>
+#endif
+
+/* A set of bytes from study, arranged for a search with a table shuffle. The
+table for the low nibble of a byte holds the bits for each possible high nibble
+from 0 to 7 in its first half, and from 8 to 15 in its second half. */
 
-Argument: the address of the base frame
-Returns:  nothing
-*/
+typedef struct byte_set {
+  const pcre_uint8 *start_bits;     /* The 256-bit map from study */
+  BOOL nibbles_set;                 /* TRUE once the table has been built */
+  pcre_uint8 nibbles[32];           /* The shuffle table for the low nibble */
+} byte_set;
 
-static void
-release_match_heapframes (heapframe *frame_base)
+#ifdef SUPPORT_SIMD_X86
+
+#define SIMD_SSE2   0
+#define SIMD_SSSE3  1
+#define SIMD_AVX2   2
+
+/* Find out what the processor supports. This is done only once; if two
+threads happen to do it at the same time they store the same value. The
+variable is accessed atomically (relaxed ordering is enough, as nothing else
+depends on it) so that this is not a data race. */
+
+static int simd_level = -1;
+
+static int
+get_simd_level(void)
 {
-heapframe *nextframe = frame_base->Xnextframe;
-while (nextframe != NULL)
+int level = __atomic_load_n(&simd_level, __ATOMIC_RELAXED);
+if (level < 0)
   {
-  heapframe *oldframe = nextframe;
-  nextframe = nextframe->Xnextframe;
-  (PUBL(stack_free))(oldframe);
+  __builtin_cpu_init();
+  level = __builtin_cpu_supports("avx2")? SIMD_AVX2 :
+          __builtin_cpu_supports("ssse3")? SIMD_SSSE3 : SIMD_SSE2;
+  __atomic_store_n(&simd_level, level, __ATOMIC_RELAXED);
   }
+return level;
 }
-#endif
 
+static PCRE_PUCHAR
+find_char2_sse2(PCRE_PUCHAR p, PCRE_PUCHAR end, pcre_uchar c1, pcre_uchar c2)
+{
+__m128i v1 = _mm_set1_epi8((char)c1);
+__m128i v2 = _mm_set1_epi8((char)c2);
+for (; end - p >= 16; p += 16)
+  {
+  __m128i d = _mm_loadu_si128((const __m128i *)p);
+  int m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(d, v1),
+    _mm_cmpeq_epi8(d, v2)));
+  if (m != 0) return p + __builtin_ctz(m);
+  }
+while (p < end && *p != c1 && *p != c2) p++;
+return p;
+}
 
-/*************************************************
-*         Execute a Regular Expression           *
-*************************************************/
-
-/* This function applies a compiled re to a subject string and picks out
-portions of the string if it matches. Two elements in the vector are set for
-each substring: the offsets to the start and end of the substring.
+__attribute__((target("avx2"))) static PCRE_PUCHAR
+find_char2_avx2(PCRE_PUCHAR p, PCRE_PUCHAR end, pcre_uchar c1, pcre_uchar c2)
+{
+__m256i v1 = _mm256_set1_epi8((char)c1);
+__m256i v2 = _mm256_set1_epi8((char)c2);
+for (; end - p >= 32; p += 32)
+  {
+  __m256i d = _mm256_loadu_si256((const __m256i *)p);
+  unsigned int m = (unsigned int)_mm256_movemask_epi8(
+    _mm256_or_si256(_mm256_cmpeq_epi8(d, v1), _mm256_cmpeq_epi8(d, v2)));
+  if (m != 0) return p + __builtin_ctz(m);
+  }
+return find_char2_sse2(p, end, c1, c2);
+}
 
-Arguments:
-  argument_re     points to the compiled expression
-  extra_data      points to extra data or is NULL
-  subject         points to the subject string
-  length          length of subject string (may contain binary zeros)
-  start_offset    where to start in the subject string
-  options         option bits
-  offsets         points to a vector of ints to be filled in with offsets
-  offsetcount     the number of elements in the vector
+/* For each byte, the table is indexed by its low nibble, with the top bit of
+the byte kept so that bytes from 0x80 up find zero in the first table (pshufb
+yields zero for an index with its top bit set) and their bits in the second.
+Bits 4-6 of the byte then choose one bit from the row. */
 
-Returns:          > 0 => success; value is the number of elements filled in
-                  = 0 => success, but offsets is not big enough
-                   -1 => failed to match
-                 < -1 => some kind of unexpected problem
-*/
+__attribute__((target("ssse3"))) static PCRE_PUCHAR
+find_byte_set_ssse3(PCRE_PUCHAR p, PCRE_PUCHAR end, const byte_set *set)
+{
+__m128i low = _mm_loadu_si128((const __m128i *)set->nibbles);
+__m128i high = _mm_loadu_si128((const __m128i *)(set->nibbles + 16));
+__m128i bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+  1, 2, 4, 8, 16, 32, 64, -128);
+__m128i index_mask = _mm_set1_epi8((char)0x8f);
+__m128i top = _mm_set1_epi8((char)0x80);
+__m128i seven = _mm_set1_epi8(7);
+__m128i zero = _mm_setzero_si128();
+for (; end - p >= 16; p += 16)
+  {
+  __m128i d = _mm_loadu_si128((const __m128i *)p);
+  __m128i index = _mm_and_si128(d, index_mask);
+  __m128i row = _mm_or_si128(_mm_shuffle_epi8(low, index),
+    _mm_shuffle_epi8(high, _mm_xor_si128(index, top)));
+  __m128i bit = _mm_shuffle_epi8(bits,
+    _mm_and_si128(_mm_srli_epi16(d, 4), seven));
+  int m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(row, bit), zero))
+    ^ 0xffff;
+  if (m != 0) return p + __builtin_ctz(m);
+  }
+return p;
+}
 
-#if defined COMPILE_PCRE8
-PCRE_EXP_DEFN int PCRE_CALL_CONVENTION
-pcre_exec(const pcre *argument_re, const pcre_extra *extra_data,
-  PCRE_SPTR subject, int length, int start_offset, int options, int *offsets,
-  int offsetcount)
-#elif defined COMPILE_PCRE16
-PCRE_EXP_DEFN int PCRE_CALL_CONVENTION
-pcre16_exec(const pcre16 *argument_re, const pcre16_extra *extra_data,
-  PCRE_SPTR16 subject, int length, int start_offset, int options, int *offsets,
-  int offsetcount)
-#elif defined COMPILE_PCRE32
-PCRE_EXP_DEFN int PCRE_CALL_CONVENTION
-pcre32_exec(const pcre32 *argument_re, const pcre32_extra *extra_data,
-  PCRE_SPTR32 subject, int length, int start_offset, int options, int *offsets,
-  int offsetcount)
-#endif
+__attribute__((target("avx2"))) static PCRE_PUCHAR
+find_byte_set_avx2(PCRE_PUCHAR p, PCRE_PUCHAR end, const byte_set *set)
 {
-int rc, ocount, arg_offset_max;
-int newline;
-BOOL using_temporary_offsets = FALSE;
-BOOL anchored;
-BOOL startline;
-BOOL firstline;
-BOOL utf;
-BOOL has_first_char = FALSE;
-BOOL has_req_char = FALSE;
-pcre_uchar first_char = 0;
-pcre_uchar first_char2 = 0;
-pcre_uchar req_char = 0;
-pcre_uchar req_char2 = 0;
-match_data match_block;
-match_data *md = &match_block;
-const pcre_uint8 *tables;
-const pcre_uint8 *start_bits = NULL;
-PCRE_PUCHAR start_match = (PCRE_PUCHAR)subject + start_offset;
-PCRE_PUCHAR end_subject;
-PCRE_PUCHAR start_partial = NULL;
-PCRE_PUCHAR match_partial = NULL;
-PCRE_PUCHAR req_char_ptr = start_match - 1;
+__m256i low = _mm256_broadcastsi128_si256(
+  _mm_loadu_si128((const __m128i *)set->nibbles));
+__m256i high = _mm256_broadcastsi128_si256(
+  _mm_loadu_si128((const __m128i *)(set->nibbles + 16)));
+__m256i bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+  1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+  1, 2, 4, 8, 16, 32, 64, -128);
+__m256i index_mask = _mm256_set1_epi8((char)0x8f);
+__m256i top = _mm256_set1_epi8((char)0x80);
+__m256i seven = _mm256_set1_epi8(7);
+__m256i zero = _mm256_setzero_si256();
+for (; end - p >= 32; p += 32)
+  {
+  __m256i d = _mm256_loadu_si256((const __m256i *)p);
+  __m256i index = _mm256_and_si256(d, index_mask);
+  __m256i row = _mm256_or_si256(_mm256_shuffle_epi8(low, index),
+    _mm256_shuffle_epi8(high, _mm256_xor_si256(index, top)));
+  __m256i bit = _mm256_shuffle_epi8(bits,
+    _mm256_and_si256(_mm256_srli_epi16(d, 4), seven));
+  unsigned int m = ~(unsigned int)_mm256_movemask_epi8(
+    _mm256_cmpeq_epi8(_mm256_and_si256(row, bit), zero));
+  if (m != 0) return p + __builtin_ctz(m);
+  }
+return find_byte_set_ssse3(p, end, set);
+}
 
-const pcre_study_data *study;
-const REAL_PCRE *re = (const REAL_PCRE *)argument_re;
+#endif  /* SUPPORT_SIMD_X86 */
 
-#ifdef NO_RECURSE
-heapframe frame_zero;
-frame_zero.Xprevframe = NULL;            /* Marks the top level */
-frame_zero.Xnextframe = NULL;            /* None are allocated yet */
-md->match_frames_base = &frame_zero;
-#endif
 
-/* Check for the special magic call that measures the size of the stack used
-per recursive call of match(). Without the funny casting for sizeof, a Windows
-compiler gave this error: "unary minus operator applied to unsigned type,
-result still unsigned". Hopefully the cast fixes that. */
+/* Find the first occurrence of either of two code units, or return "end" if
+there is none. A pointer that is already at or past the end is returned
+unchanged. */
 
-if (re == NULL && extra_data == NULL && subject == NULL && length == -999 &&
-    start_offset == -999)
-#ifdef NO_RECURSE
-  return -((int)sizeof(heapframe));
+static PCRE_PUCHAR
+find_char2(PCRE_PUCHAR p, PCRE_PUCHAR end, pcre_uchar c1, pcre_uchar c2)
+{
+if (p >= end) return p;
+if (c1 == c2)
+  {
+  p = (PCRE_PUCHAR)memchr(p, c1, end - p);
+  return (p == NULL)? end : p;
+  }
+#ifdef SUPPORT_SIMD_X86
+if (end - p >= 32 && get_simd_level() == SIMD_AVX2)
+  return find_char2_avx2(p, end, c1, c2);
+return find_char2_sse2(p, end, c1, c2);
 #else
-  return match(NULL, NULL, NULL, 0, NULL, NULL, 0);
+while (p < end && *p != c1 && *p != c2) p++;
+return p;
 #endif
+}
 
-/* Plausibility checks */
-
-if ((options & ~PUBLIC_EXEC_OPTIONS) != 0) return PCRE_ERROR_BADOPTION;
-if (re == NULL || subject == NULL || (offsets == NULL && offsetcount > 0))
-  return PCRE_ERROR_NULL;
-if (offsetcount < 0) return PCRE_ERROR_BADCOUNT;
-if (length < 0) return PCRE_ERROR_BADLENGTH;
-if (start_offset < 0 || start_offset > length) return PCRE_ERROR_BADOFFSET;
-
-/* Check that the first field in the block is the magic number. If it is not,
-return with PCRE_ERROR_BADMAGIC. However, if the magic number is equal to
-REVERSED_MAGIC_NUMBER we return with PCRE_ERROR_BADENDIANNESS, which
-means that the pattern is likely compiled with different endianness. */
-
-if (re->magic_number != MAGIC_NUMBER)
-  return re->magic_number == REVERSED_MAGIC_NUMBER?
-    PCRE_ERROR_BADENDIANNESS:PCRE_ERROR_BADMAGIC;
-if ((re->flags & PCRE_MODE) == 0) return PCRE_ERROR_BADMODE;
-
-/* These two settings are used in the code for checking a UTF-8 string that
-follows immediately afterwards. Other values in the md block are used only
-during "normal" pcre_exec() processing, not when the JIT support is in use,
-so they are set up later. */
 
-/* PCRE_UTF16 has the same value as PCRE_UTF8. */
-utf = md->utf = (re->options & PCRE_UTF8) != 0;
-md->partial = ((options & PCRE_PARTIAL_HARD) != 0)? 2 :
-              ((options & PCRE_PARTIAL_SOFT) != 0)? 1 : 0;
+/* Find the first code unit that is in a set from study, or return "end". The
+shuffle table is built the first time a long enough stretch of subject has to
+be searched, and is kept for the rest of the pcre_exec() call. Building it
+looks only at the bits that are set, because for short subjects it can cost
+more than the search. */
 
-/* Check a UTF-8 string if required. Pass back the character offset and error
-code for an invalid string if a results vector is available. */
+static PCRE_PUCHAR
+find_byte_set(PCRE_PUCHAR p, PCRE_PUCHAR end, byte_set *set)
+{
+const pcre_uint8 *start_bits = set->start_bits;
 
-#ifdef SUPPORT_UTF
-if (utf && (options & PCRE_NO_UTF8_CHECK) == 0)
+#ifdef SUPPORT_SIMD_X86
+int level;
+if (end - p >= 16 && (level = get_simd_level()) != SIMD_SSE2)
   {
-  int erroroffset;
-  int errorcode = PRIV(valid_utf)((PCRE_PUCHAR)subject, length, &erroroffset);
-  if (errorcode != 0)
+  if (!set->nibbles_set)
     {
-    if (offsetcount >= 2)
+    int i;
+    memset(set->nibbles, 0, sizeof(set->nibbles));
+    for (i = 0; i < 32; i++)
       {
-      offsets[0] = erroroffset;
-      offsets[1] = errorcode;
+      unsigned int bits = start_bits[i];
+      while (bits != 0)
+        {
+        int c = i*8 + __builtin_ctz(bits);
+        set->nibbles[(c & 0x0f) + (c & 0x80)/8] |= 1 << ((c >> 4) & 7);
+        bits &= bits - 1;
+        }
       }
-#if defined COMPILE_PCRE8
-    return (errorcode <= PCRE_UTF8_ERR5 && md->partial > 1)?
-      PCRE_ERROR_SHORTUTF8 : PCRE_ERROR_BADUTF8;
-#elif defined COMPILE_PCRE16
-    return (errorcode <= PCRE_UTF16_ERR1 && md->partial > 1)?
-      PCRE_ERROR_SHORTUTF16 : PCRE_ERROR_BADUTF16;
-#elif defined COMPILE_PCRE32
-    return PCRE_ERROR_BADUTF32;
-#endif
+    set->nibbles_set = TRUE;
     }
-#if defined COMPILE_PCRE8 || defined COMPILE_PCRE16
-  /* Check that a start_offset points to the start of a UTF character. */
-  if (start_offset > 0 && start_offset < length &&
-      NOT_FIRSTCHAR(((PCRE_PUCHAR)subject)[start_offset]))
-    return PCRE_ERROR_BADUTF8_OFFSET;
-#endif
+  p = (level == SIMD_AVX2 && end - p >= 32)?
+    find_byte_set_avx2(p, end, set) : find_byte_set_ssse3(p, end, set);
   }
 #endif
 
-/* If the pattern was successfully studied with JIT support, run the JIT
-executable instead of the rest of this function. Most options must be set at
-compile time for the JIT code to be usable. Fallback to the normal code path if
-an unsupported flag is set. */
+while (p < end && (start_bits[*p/8] & (1 << (*p&7))) == 0) p++;
+return p;
+}
 
-#ifdef SUPPORT_JIT
-if (extra_data != NULL
-    && (extra_data->flags & (PCRE_EXTRA_EXECUTABLE_JIT |
-                             PCRE_EXTRA_TABLES)) == PCRE_EXTRA_EXECUTABLE_JIT
-    && extra_data->executable_jit != NULL
-    && (options & ~PUBLIC_JIT_EXEC_OPTIONS) == 0)
-  {
-  rc = PRIV(jit_exec)(extra_data, (const pcre_uchar *)subject, length,
-       start_offset, options, offsets, offsetcount);
 
-  /* PCRE_ERROR_NULL means that the selected normal or partial matching
-  mode is not compiled. In this case we simply fallback to interpreter. */
+/* Find the point just after the next fixed newline, for a multiline match.
+The start is after the start of the subject, and the code unit before it is
+checked as well, as WAS_NEWLINE() does. For CRLF, each LF that is found is
+checked for a preceding CR. */
 
-  if (rc != PCRE_ERROR_JIT_BADOPTION) return rc;
+static PCRE_PUCHAR
+find_after_newline(PCRE_PUCHAR p, PCRE_PUCHAR end, const match_data *md)
+{
+pcre_uchar last = md->nl[md->nllen - 1];
+PCRE_PUCHAR q = p - 1;
+
+if (p >= end) return p;
+for (;;)
+  {
+  q = (PCRE_PUCHAR)memchr(q, last, (end - 1) - q);
+  if (q == NULL) return end;
+  if (md->nllen == 1 || (q > md->start_subject && q[-1] == md->nl[0]))
+    return q + 1;
+  q++;
   }
-#endif
+}
 
-/* Carry on with non-JIT matching. This information is for finding all the
-numbers associated with a given name, for condition testing. */
 
-md->name_table = (pcre_uchar *)re + re->name_table_offset;
-md->name_count = re->name_count;
-md->name_entry_size = re->name_entry_size;
+/* Find the first occurrence of a string of at least two code units that lies
+wholly between p and end, or return NULL. Candidates are found by
+looking for the first and last characters of the string at the right distance
+apart, a block at a time where SIMD is available, and are then compared in
+full. This is also used by pcre_dfa_exec(). */
+
+#ifdef SUPPORT_SIMD_X86
+
+/* These search whole blocks only. If the string is not found they return NULL,
+with *pp set to the part of the subject that is left. */
+
+static PCRE_PUCHAR
+find_string_sse2(PCRE_PUCHAR *pp, PCRE_PUCHAR limit, const pcre_uchar *s,
+  int length)
+{
+PCRE_PUCHAR p = *pp;
+__m128i first = _mm_set1_epi8((char)s[0]);
+__m128i last = _mm_set1_epi8((char)s[length - 1]);
+for (; limit - p >= 16; p += 16)
+  {
+  __m128i a = _mm_loadu_si128((const __m128i *)p);
+  __m128i b = _mm_loadu_si128((const __m128i *)(p + length - 1));
+  unsigned int m = (unsigned int)_mm_movemask_epi8(
+    _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+  while (m != 0)
+    {
+    int i = __builtin_ctz(m);
+    if (memcmp(p + i + 1, s + 1, length - 2) == 0) return p + i;
+    m &= m - 1;
+    }
+  }
+*pp = p;
+return NULL;
+}
+
+__attribute__((target("avx2"))) static PCRE_PUCHAR
+find_string_avx2(PCRE_PUCHAR *pp, PCRE_PUCHAR limit, const pcre_uchar *s,
+  int length)
+{
+PCRE_PUCHAR p = *pp;
+__m256i first = _mm256_set1_epi8((char)s[0]);
+__m256i last = _mm256_set1_epi8((char)s[length - 1]);
+for (; limit - p >= 32; p += 32)
+  {
+  __m256i a = _mm256_loadu_si256((const __m256i *)p);
+  __m256i b = _mm256_loadu_si256((const __m256i *)(p + length - 1));
+  unsigned int m = (unsigned int)_mm256_movemask_epi8(
+    _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+  while (m != 0)
+    {
+    int i = __builtin_ctz(m);
+    if (memcmp(p + i + 1, s + 1, length - 2) == 0) return p + i;
+    m &= m - 1;
+    }
+  }
+*pp = p;
+return find_string_sse2(pp, limit, s, length);
+}
+#endif  /* SUPPORT_SIMD_X86 */
+
+PCRE_PUCHAR
+PRIV(find_string)(PCRE_PUCHAR p, PCRE_PUCHAR end, const pcre_uchar *s,
+  int length)
+{
+PCRE_PUCHAR limit;
+
+if (end - p < length) return NULL;
+limit = end - length + 1;
+
+#ifdef SUPPORT_SIMD_X86
+if (limit - p >= 16)
+  {
+  PCRE_PUCHAR found = (limit - p >= 32 && get_simd_level() == SIMD_AVX2)?
+    find_string_avx2(&p, limit, s, length) :
+    find_string_sse2(&p, limit, s, length);
+  if (found != NULL) return found;
+  }
+#endif
+
+while (p < limit)
+  {
+  p = (PCRE_PUCHAR)memchr(p, s[0], limit - p);
+  if (p == NULL) return NULL;
+  if (p[length - 1] == s[length - 1] &&
+      memcmp(p + 1, s + 1, length - 2) == 0)
+    return p;
+  p++;
+  }
+return NULL;
+}
+#endif  /* COMPILE_PCRE8 */
+
+
+/*************************************************
+*      Work out the state for a pattern          *
+*************************************************/
+
+/* These are the values that pcre_exec() derives from the pattern, its study
+data, the character tables, and a few of the options before it looks for a
+match. A match context that is bound to a pattern keeps them from one match to
+the next, and they are worked out again only when something they depend on
+changes. */
+
+#define STATE_OPTIONS \
+  (PCRE_ANCHORED|PCRE_BSR_ANYCRLF|PCRE_BSR_UNICODE|PCRE_NEWLINE_BITS)
+
+typedef struct pattern_state {
+  BOOL valid;                     /* The other fields are set */
+  int options;                    /* The STATE_OPTIONS bits they are for */
+  const pcre_study_data *study;   /* The study data they are for */
+  const pcre_uint8 *tables;       /* The character tables they are for */
+  BOOL bsr_anycrlf;               /* \R is just any CRLF, not full Unicode */
+  int nltype;                     /* Newline type */
+  int nllen;                      /* Newline string length */
+  pcre_uchar nl[4];               /* Newline string when fixed */
+  BOOL has_first_char;            /* first_char and first_char2 are set */
+  BOOL has_req_char;              /* req_char and req_char2 are set */
+  pcre_uchar first_char;          /* Character a match must start with */
+  pcre_uchar first_char2;         /* Its other case, or the same */
+  pcre_uchar req_char;            /* Character a match must contain */
+  pcre_uchar req_char2;           /* Its other case, or the same */
+  const pcre_uint8 *start_bits;   /* Map of starting code units, or NULL */
+#if defined COMPILE_PCRE8
+  byte_set start_set;             /* Search tables made from start_bits */
+#endif
+} pattern_state;
+
+
+/* Arguments:
+  state       where to put the results
+  re          the compiled pattern
+  study       its study data, or NULL
+  tables      the character tables
+  options     the exec options
+
+Returns:      0, or PCRE_ERROR_BADNEWLINE
+*/
+
+static int
+set_pattern_state(pattern_state *state, const REAL_PCRE *re,
+  const pcre_study_data *study, const pcre_uint8 *tables, int options)
+{
+int newline;
+BOOL anchored = ((re->options | options) & PCRE_ANCHORED) != 0;
+BOOL startline = (re->flags & PCRE_STARTLINE) != 0;
+const pcre_uint8 *fcc = tables + fcc_offset;
+#if defined SUPPORT_UCP && !(defined COMPILE_PCRE8)
+BOOL utf = (re->options & PCRE_UTF8) != 0;
+#endif
+
+state->valid = FALSE;
+
+/* Handle different \R options. */
+
+switch (options & (PCRE_BSR_ANYCRLF|PCRE_BSR_UNICODE))
+  {
+  case 0:
+  if ((re->options & (PCRE_BSR_ANYCRLF|PCRE_BSR_UNICODE)) != 0)
+    state->bsr_anycrlf = (re->options & PCRE_BSR_ANYCRLF) != 0;
+  else
+#ifdef BSR_ANYCRLF
+  state->bsr_anycrlf = TRUE;
+#else
+  state->bsr_anycrlf = FALSE;
+#endif
+  break;
+
+  case PCRE_BSR_ANYCRLF:
+  state->bsr_anycrlf = TRUE;
+  break;
+
+  case PCRE_BSR_UNICODE:
+  state->bsr_anycrlf = FALSE;
+  break;
+
+  default: return PCRE_ERROR_BADNEWLINE;
+  }
+
+/* Handle different types of newline. The three bits give eight cases. If
+nothing is set at run time, whatever was used at compile time applies. */
+
+switch ((((options & PCRE_NEWLINE_BITS) == 0)? re->options :
+        (pcre_uint32)options) & PCRE_NEWLINE_BITS)
+  {
+  case 0: newline = NEWLINE; break;   /* Compile-time default */
+  case PCRE_NEWLINE_CR: newline = CHAR_CR; break;
+  case PCRE_NEWLINE_LF: newline = CHAR_NL; break;
+  case PCRE_NEWLINE_CR+
+       PCRE_NEWLINE_LF: newline = (CHAR_CR << 8) | CHAR_NL; break;
+  case PCRE_NEWLINE_ANY: newline = -1; break;
+  case PCRE_NEWLINE_ANYCRLF: newline = -2; break;
+  default: return PCRE_ERROR_BADNEWLINE;
+  }
+
+state->nllen = 0;
+if (newline == -2)
+  {
+  state->nltype = NLTYPE_ANYCRLF;
+  }
+else if (newline < 0)
+  {
+  state->nltype = NLTYPE_ANY;
+  }
+else
+  {
+  state->nltype = NLTYPE_FIXED;
+  if (newline > 255)
+    {
+    state->nllen = 2;
+    state->nl[0] = (newline >> 8) & 255;
+    state->nl[1] = newline & 255;
+    }
+  else
+    {
+    state->nllen = 1;
+    state->nl[0] = newline;
+    }
+  }
+
+/* Set up the first character to match, if available. The first_char value is
+never set for an anchored regular expression, but the anchoring may be forced
+at run time, so we have to test for anchoring. The first char may be unset for
+an unanchored pattern, of course. If there's no first char and the pattern was
+studied, there may be a bitmap of possible first characters. */
+
+state->has_first_char = FALSE;
+state->first_char = state->first_char2 = 0;
+state->start_bits = NULL;
+
+if (!anchored)
+  {
+  if ((re->flags & PCRE_FIRSTSET) != 0)
+    {
+    state->has_first_char = TRUE;
+    state->first_char = state->first_char2 = (pcre_uchar)(re->first_char);
+    if ((re->flags & PCRE_FCH_CASELESS) != 0)
+      {
+      state->first_char2 = TABLE_GET(state->first_char, fcc,
+        state->first_char);
+#if defined SUPPORT_UCP && !(defined COMPILE_PCRE8)
+      if (utf && state->first_char > 127)
+        state->first_char2 = UCD_OTHERCASE(state->first_char);
+#endif
+      }
+    }
+  else
+    if (!startline && study != NULL &&
+      (study->flags & PCRE_STUDY_MAPPED) != 0)
+        state->start_bits = study->start_bits;
+  }
+
+#if defined COMPILE_PCRE8
+state->start_set.start_bits = state->start_bits;
+state->start_set.nibbles_set = FALSE;
+#endif
+
+/* For anchored or unanchored matches, there may be a "last known required
+character" set. */
+
+state->has_req_char = FALSE;
+state->req_char = state->req_char2 = 0;
+
+if ((re->flags & PCRE_REQCHSET) != 0)
+  {
+  state->has_req_char = TRUE;
+  state->req_char = state->req_char2 = (pcre_uchar)(re->req_char);
+  if ((re->flags & PCRE_RCH_CASELESS) != 0)
+    {
+    state->req_char2 = TABLE_GET(state->req_char, fcc, state->req_char);
+#if defined SUPPORT_UCP && !(defined COMPILE_PCRE8)
+    if (utf && state->req_char > 127)
+      state->req_char2 = UCD_OTHERCASE(state->req_char);
+#endif
+    }
+  }
+
+state->options = options & STATE_OPTIONS;
+state->study = study;
+state->tables = tables;
+state->valid = TRUE;
+return 0;
+}
+
+
+/* This is the private structure behind pcre_match_context. It is used by one
+match at a time, and keeps what can usefully be carried over to the next. A
+context that is bound to a pattern also holds the extra data to match it with
+and the state that is derived from it. */
+
+typedef struct match_context {
+  const REAL_PCRE *re;            /* The bound pattern, or NULL */
+  PUBL(extra) extra;              /* Extra data to use with it */
+  pattern_state state;            /* State derived from it */
+  int *offset_vector;             /* Working offsets for back references */
+  int offset_size;                /* Its size in ints */
+  int *save_area;                 /* Space to save offsets over recursion */
+  int save_size;                  /* Its size in ints */
+  int save_peak;                  /* The most that any match has wanted */
+  unsigned long int peak_depth;   /* Deepest recursion of match() seen */
+#ifdef NO_RECURSE
+  frame_pool frames;              /* Frames kept for the next match */
+#endif
+} match_context;
+
+
+/*************************************************
+*          Finish with the match memory          *
+*************************************************/
+
+/* This function is called on the way out of pcre_exec() once match() may have
+been called. When there is a match context, the depth that was reached and the
+space that was wanted for saving offsets are recorded in it, and its frames are
+kept for the next match. Otherwise any heap frames that were allocated are
+released. The base frame is on the machine stack, and is never part of the
+pool.
+
+Argument: pointer to "static" info for the match
+Returns:  nothing
+*/
+
+static void
+release_match_data(match_data *md)
+{
+match_context *context = (match_context *)md->match_context;
+
+if (context == NULL)
+  {
+#ifdef NO_RECURSE
+  free_frame_pool((frame_pool *)md->match_frame_pool);
+#endif
+  return;
+  }
+
+if (md->peak_depth > context->peak_depth)
+  context->peak_depth = md->peak_depth;
+if (md->save_area_peak > context->save_peak)
+  context->save_peak = md->save_area_peak;
+}
+
+
+/*************************************************
+*         Execute a Regular Expression           *
+*************************************************/
+
+/* This function applies a compiled re to a subject string and picks out
+portions of the string if it matches. Two elements in the vector are set for
+each substring: the offsets to the start and end of the substring.
+
+Arguments:
+  argument_re     points to the compiled expression
+  extra_data      points to extra data or is NULL
+  subject         points to the subject string
+  length          length of subject string (may contain binary zeros)
+  start_offset    where to start in the subject string
+  options         option bits
+  offsets         points to a vector of ints to be filled in with offsets
+  offsetcount     the number of elements in the vector
+
+Returns:          > 0 => success; value is the number of elements filled in
+                  = 0 => success, but offsets is not big enough
+                   -1 => failed to match
+                 < -1 => some kind of unexpected problem
+*/
+
+#if defined COMPILE_PCRE8
+PCRE_EXP_DEFN int PCRE_CALL_CONVENTION
+pcre_exec(const pcre *argument_re, const pcre_extra *extra_data,
+  PCRE_SPTR subject, int length, int start_offset, int options, int *offsets,
+  int offsetcount)
+#elif defined COMPILE_PCRE16
+PCRE_EXP_DEFN int PCRE_CALL_CONVENTION
+pcre16_exec(const pcre16 *argument_re, const pcre16_extra *extra_data,
+  PCRE_SPTR16 subject, int length, int start_offset, int options, int *offsets,
+  int offsetcount)
+#elif defined COMPILE_PCRE32
+PCRE_EXP_DEFN int PCRE_CALL_CONVENTION
+pcre32_exec(const pcre32 *argument_re, const pcre32_extra *extra_data,
+  PCRE_SPTR32 subject, int length, int start_offset, int options, int *offsets,
+  int offsetcount)
+#endif
+{
+int rc, ocount, arg_offset_max;
+BOOL using_temporary_offsets = FALSE;
+BOOL anchored;
+BOOL startline;
+BOOL firstline;
+BOOL utf;
+BOOL has_first_char = FALSE;
+BOOL has_req_char = FALSE;
+pcre_uchar first_char = 0;
+pcre_uchar first_char2 = 0;
+pcre_uchar req_char = 0;
+pcre_uchar req_char2 = 0;
+match_data match_block;
+match_data *md = &match_block;
+const pcre_uint8 *tables;
+const pcre_uint8 *start_bits = NULL;
+#if defined COMPILE_PCRE8
+byte_set *start_set;
+#endif
+PCRE_PUCHAR start_match = (PCRE_PUCHAR)subject + start_offset;
+PCRE_PUCHAR end_subject;
+PCRE_PUCHAR start_partial = NULL;
+PCRE_PUCHAR match_partial = NULL;
+PCRE_PUCHAR req_char_ptr = start_match - 1;
+#if defined COMPILE_PCRE8
+PCRE_PUCHAR req_string_ptr = start_match - 1;
+#endif
+
+const pcre_study_data *study;
+const REAL_PCRE *re = (const REAL_PCRE *)argument_re;
+match_context *context;
+pattern_state private_state;
+pattern_state *state;
+
+#ifdef NO_RECURSE
+heapframe frame_zero;
+frame_pool private_frames;
+frame_zero.Xprevframe = NULL;            /* Marks the top level */
+frame_zero.Xnextframe = NULL;            /* None are allocated yet */
+md->match_frames_base = &frame_zero;
+#endif
+
+/* Check for the special magic call that measures the size of the stack used
+per recursive call of match(). Without the funny casting for sizeof, a Windows
+compiler gave this error: "unary minus operator applied to unsigned type,
+result still unsigned". Hopefully the cast fixes that. */
+
+if (re == NULL && extra_data == NULL && subject == NULL && length == -999 &&
+    start_offset == -999)
+#ifdef NO_RECURSE
+  return -((int)sizeof(heapframe));
+#else
+  return match(NULL, NULL, NULL, 0, NULL, NULL, 0);
+#endif
+
+/* Plausibility checks */
+
+if ((options & ~PUBLIC_EXEC_OPTIONS) != 0) return PCRE_ERROR_BADOPTION;
+if (re == NULL || subject == NULL || (offsets == NULL && offsetcount > 0))
+  return PCRE_ERROR_NULL;
+if (offsetcount < 0) return PCRE_ERROR_BADCOUNT;
+if (length < 0) return PCRE_ERROR_BADLENGTH;
+if (start_offset < 0 || start_offset > length) return PCRE_ERROR_BADOFFSET;
+
+/* Check that the first field in the block is the magic number. If it is not,
+return with PCRE_ERROR_BADMAGIC. However, if the magic number is equal to
+REVERSED_MAGIC_NUMBER we return with PCRE_ERROR_BADENDIANNESS, which
+means that the pattern is likely compiled with different endianness. */
+
+if (re->magic_number != MAGIC_NUMBER)
+  return re->magic_number == REVERSED_MAGIC_NUMBER?
+    PCRE_ERROR_BADENDIANNESS:PCRE_ERROR_BADMAGIC;
+if ((re->flags & PCRE_MODE) == 0) return PCRE_ERROR_BADMODE;
+
+/* These two settings are used in the code for checking a UTF-8 string that
+follows immediately afterwards. Other values in the md block are used only
+during "normal" pcre_exec() processing, not when the JIT support is in use,
+so they are set up later. */
+
+/* PCRE_UTF16 has the same value as PCRE_UTF8. */
+utf = md->utf = (re->options & PCRE_UTF8) != 0;
+md->partial = ((options & PCRE_PARTIAL_HARD) != 0)? 2 :
+              ((options & PCRE_PARTIAL_SOFT) != 0)? 1 : 0;
+
+/* Check a UTF-8 string if required. Pass back the character offset and error
+code for an invalid string if a results vector is available. */
+
+#ifdef SUPPORT_UTF
+if (utf && (options & PCRE_NO_UTF8_CHECK) == 0)
+  {
+  int erroroffset;
+  int errorcode = PRIV(valid_utf)((PCRE_PUCHAR)subject, length, &erroroffset);
+  if (errorcode != 0)
+    {
+    if (offsetcount >= 2)
+      {
+      offsets[0] = erroroffset;
+      offsets[1] = errorcode;
+      }
+#if defined COMPILE_PCRE8
+    return (errorcode <= PCRE_UTF8_ERR5 && md->partial > 1)?
+      PCRE_ERROR_SHORTUTF8 : PCRE_ERROR_BADUTF8;
+#elif defined COMPILE_PCRE16
+    return (errorcode <= PCRE_UTF16_ERR1 && md->partial > 1)?
+      PCRE_ERROR_SHORTUTF16 : PCRE_ERROR_BADUTF16;
+#elif defined COMPILE_PCRE32
+    return PCRE_ERROR_BADUTF32;
+#endif
+    }
+#if defined COMPILE_PCRE8 || defined COMPILE_PCRE16
+  /* Check that a start_offset points to the start of a UTF character. */
+  if (start_offset > 0 && start_offset < length &&
+      NOT_FIRSTCHAR(((PCRE_PUCHAR)subject)[start_offset]))
+    return PCRE_ERROR_BADUTF8_OFFSET;
+#endif
+  }
+#endif
+
+/* If the pattern was successfully studied with JIT support, run the JIT
+executable instead of the rest of this function. Most options must be set at
+compile time for the JIT code to be usable. Fallback to the normal code path if
+an unsupported flag is set. */
+
+#ifdef SUPPORT_JIT
+if (extra_data != NULL
+    && (extra_data->flags & (PCRE_EXTRA_EXECUTABLE_JIT |
+                             PCRE_EXTRA_TABLES)) == PCRE_EXTRA_EXECUTABLE_JIT
+    && extra_data->executable_jit != NULL
+    && (options & ~PUBLIC_JIT_EXEC_OPTIONS) == 0)
+  {
+  rc = PRIV(jit_exec)(extra_data, (const pcre_uchar *)subject, length,
+       start_offset, options, offsets, offsetcount);
+
+  /* PCRE_ERROR_NULL means that the selected normal or partial matching
+  mode is not compiled. In this case we simply fallback to interpreter. */
+
+  if (rc != PCRE_ERROR_JIT_BADOPTION) return rc;
+  }
+#endif
+
+/* Carry on with non-JIT matching. This information is for finding all the
+numbers associated with a given name, for condition testing. */
+
+md->name_table = (pcre_uchar *)re + re->name_table_offset;
+md->name_count = re->name_count;
+md->name_entry_size = re->name_entry_size;
 
 /* Fish out the optional data from the extra_data structure, first setting
 the default values. */
@@ -6504,6 +7232,8 @@ study = NULL;
 md->match_limit = MATCH_LIMIT;
 md->match_limit_recursion = MATCH_LIMIT_RECURSION;
 md->callout_data = NULL;
+md->match_context = NULL;
+md->peak_depth = 0;
 
 /* The table pointer is always in native byte order. */
 
@@ -6523,6 +7253,44 @@ if (extra_data != NULL)
   if ((flags & PCRE_EXTRA_CALLOUT_DATA) != 0)
     md->callout_data = extra_data->callout_data;
   if ((flags & PCRE_EXTRA_TABLES) != 0) tables = extra_data->tables;
+  if ((flags & PCRE_EXTRA_MATCH_CONTEXT) != 0)
+    md->match_context = extra_data->match_context;
+  }
+
+context = (match_context *)md->match_context;
+
+/* Heap frames come from the match context's pool if there is one, in which
+case those left by earlier matches are already chained and ready for use. */
+
+#ifdef NO_RECURSE
+if (context != NULL)
+  md->match_frame_pool = &context->frames;
+else
+  {
+  private_frames.blocks = NULL;
+  private_frames.first = NULL;
+  md->match_frame_pool = &private_frames;
+  }
+frame_zero.Xnextframe = ((frame_pool *)md->match_frame_pool)->first;
+#endif
+
+/* A match context also provides the space for saving offsets over
+recursions. It is made big enough for the most that an earlier match wanted. */
+
+md->save_area = NULL;
+md->save_area_size = md->save_area_used = 0;
+md->save_area_wanted = md->save_area_peak = 0;
+if (context != NULL)
+  {
+  if (context->save_peak > context->save_size)
+    {
+    if (context->save_area != NULL) (PUBL(free))(context->save_area);
+    context->save_area =
+      (int *)(PUBL(malloc))(context->save_peak * sizeof(int));
+    context->save_size = (context->save_area == NULL)? 0 : context->save_peak;
+    }
+  md->save_area = context->save_area;
+  md->save_area_size = context->save_size;
   }
 
 /* Limits in the regex override only if they are smaller. */
@@ -6579,71 +7347,34 @@ md->lcc = tables + lcc_offset;
 md->fcc = tables + fcc_offset;
 md->ctypes = tables + ctypes_offset;
 
-/* Handle different \R options. */
-
-switch (options & (PCRE_BSR_ANYCRLF|PCRE_BSR_UNICODE))
-  {
-  case 0:
-  if ((re->options & (PCRE_BSR_ANYCRLF|PCRE_BSR_UNICODE)) != 0)
-    md->bsr_anycrlf = (re->options & PCRE_BSR_ANYCRLF) != 0;
-  else
-#ifdef BSR_ANYCRLF
-  md->bsr_anycrlf = TRUE;
-#else
-  md->bsr_anycrlf = FALSE;
-#endif
-  break;
-
-  case PCRE_BSR_ANYCRLF:
-  md->bsr_anycrlf = TRUE;
-  break;
-
-  case PCRE_BSR_UNICODE:
-  md->bsr_anycrlf = FALSE;
-  break;
-
-  default: return PCRE_ERROR_BADNEWLINE;
-  }
+/* Work out the \R and newline conventions, and the characters and bitmap that
+can start or must be in a match, unless a match context that is bound to this
+pattern already has them for the same study data, tables, and options. */
 
-/* Handle different types of newline. The three bits give eight cases. If
-nothing is set at run time, whatever was used at compile time applies. */
-
-switch ((((options & PCRE_NEWLINE_BITS) == 0)? re->options :
-        (pcre_uint32)options) & PCRE_NEWLINE_BITS)
+state = (context != NULL && context->re == re)? &context->state :
+  &private_state;
+if (state == &private_state || !state->valid || state->study != study ||
+    state->tables != tables || state->options != (options & STATE_OPTIONS))
   {
-  case 0: newline = NEWLINE; break;   /* Compile-time default */
-  case PCRE_NEWLINE_CR: newline = CHAR_CR; break;
-  case PCRE_NEWLINE_LF: newline = CHAR_NL; break;
-  case PCRE_NEWLINE_CR+
-       PCRE_NEWLINE_LF: newline = (CHAR_CR << 8) | CHAR_NL; break;
-  case PCRE_NEWLINE_ANY: newline = -1; break;
-  case PCRE_NEWLINE_ANYCRLF: newline = -2; break;
-  default: return PCRE_ERROR_BADNEWLINE;
+  rc = set_pattern_state(state, re, study, tables, options);
+  if (rc != 0) return rc;
   }
 
-if (newline == -2)
-  {
-  md->nltype = NLTYPE_ANYCRLF;
-  }
-else if (newline < 0)
-  {
-  md->nltype = NLTYPE_ANY;
-  }
-else
-  {
-  md->nltype = NLTYPE_FIXED;
-  if (newline > 255)
-    {
-    md->nllen = 2;
-    md->nl[0] = (newline >> 8) & 255;
-    md->nl[1] = newline & 255;
-    }
-  else
-    {
-    md->nllen = 1;
-    md->nl[0] = newline;
-    }
-  }
+md->bsr_anycrlf = state->bsr_anycrlf;
+md->nltype = state->nltype;
+md->nllen = state->nllen;
+md->nl[0] = state->nl[0];
+md->nl[1] = state->nl[1];
+has_first_char = state->has_first_char;
+first_char = state->first_char;
+first_char2 = state->first_char2;
+start_bits = state->start_bits;
+has_req_char = state->has_req_char;
+req_char = state->req_char;
+req_char2 = state->req_char2;
+#if defined COMPILE_PCRE8
+start_set = &state->start_set;
+#endif
 
 /* Partial matching was originally supported only for a restricted set of
 regexes; from release 8.00 there are no restrictions, but the bits are still
@@ -6654,6 +7385,7 @@ if (md->partial && (re->flags & PCRE_NOPARTIAL) != 0)
 
 /* If the expression has got more back references than the offsets supplied can
 hold, we get a temporary chunk of working store to use during the matching.
+When there is a match context, the chunk is kept in it for later matches.
 Otherwise, we can use the vector supplied, rounding down its size to a multiple
 of 3. */
 
@@ -6663,10 +7395,22 @@ arg_offset_max = (2*ocount)/3;
 if (re->top_backref > 0 && re->top_backref >= ocount/3)
   {
   ocount = re->top_backref * 3 + 3;
-  md->offset_vector = (int *)(PUBL(malloc))(ocount * sizeof(int));
-  if (md->offset_vector == NULL) return PCRE_ERROR_NOMEMORY;
+  if (context != NULL && context->offset_size >= ocount)
+    md->offset_vector = context->offset_vector;
+  else
+    {
+    md->offset_vector = (int *)(PUBL(malloc))(ocount * sizeof(int));
+    if (md->offset_vector == NULL) return PCRE_ERROR_NOMEMORY;
+    DPRINTF(("Got memory to hold back references\n"));
+    if (context != NULL)
+      {
+      if (context->offset_vector != NULL)
+        (PUBL(free))(context->offset_vector);
+      context->offset_vector = md->offset_vector;
+      context->offset_size = ocount;
+      }
+    }
   using_temporary_offsets = TRUE;
-  DPRINTF(("Got memory to hold back references\n"));
   }
 else md->offset_vector = offsets;
 md->offset_end = ocount;
@@ -6689,50 +7433,6 @@ if (md->offset_vector != NULL)
   if (offsetcount > 1) md->offset_vector[1] = -1;
   }
 
-/* Set up the first character to match, if available. The first_char value is
-never set for an anchored regular expression, but the anchoring may be forced
-at run time, so we have to test for anchoring. The first char may be unset for
-an unanchored pattern, of course. If there's no first char and the pattern was
-studied, there may be a bitmap of possible first characters. */
-
-if (!anchored)
-  {
-  if ((re->flags & PCRE_FIRSTSET) != 0)
-    {
-    has_first_char = TRUE;
-    first_char = first_char2 = (pcre_uchar)(re->first_char);
-    if ((re->flags & PCRE_FCH_CASELESS) != 0)
-      {
-      first_char2 = TABLE_GET(first_char, md->fcc, first_char);
-#if defined SUPPORT_UCP && !(defined COMPILE_PCRE8)
-      if (utf && first_char > 127)
-        first_char2 = UCD_OTHERCASE(first_char);
-#endif
-      }
-    }
-  else
-    if (!startline && study != NULL &&
-      (study->flags & PCRE_STUDY_MAPPED) != 0)
-        start_bits = study->start_bits;
-  }
-
-/* For anchored or unanchored matches, there may be a "last known required
-character" set. */
-
-if ((re->flags & PCRE_REQCHSET) != 0)
-  {
-  has_req_char = TRUE;
-  req_char = req_char2 = (pcre_uchar)(re->req_char);
-  if ((re->flags & PCRE_RCH_CASELESS) != 0)
-    {
-    req_char2 = TABLE_GET(req_char, md->fcc, req_char);
-#if defined SUPPORT_UCP && !(defined COMPILE_PCRE8)
-    if (utf && req_char > 127)
-      req_char2 = UCD_OTHERCASE(req_char);
-#endif
-    }
-  }
-
 
 /* ==========================================================================*/
 
@@ -6780,6 +7480,10 @@ for(;;)
 
     if (has_first_char)
       {
+#if defined COMPILE_PCRE8
+      start_match = find_char2(start_match, end_subject, first_char,
+        first_char2);
+#else
       pcre_uchar smc;
 
       if (first_char != first_char2)
@@ -6789,6 +7493,7 @@ for(;;)
       else
         while (start_match < end_subject && UCHAR21TEST(start_match) != first_char)
           start_match++;
+#endif
       }
 
     /* Or to just after a linebreak for a multiline match */
@@ -6797,6 +7502,11 @@ for(;;)
       {
       if (start_match > md->start_subject + start_offset)
         {
+#if defined COMPILE_PCRE8
+        if (md->nltype == NLTYPE_FIXED)
+          start_match = find_after_newline(start_match, end_subject, md);
+        else
+#endif
 #ifdef SUPPORT_UTF
         if (utf)
           {
@@ -6828,6 +7538,9 @@ for(;;)
 
     else if (start_bits != NULL)
       {
+#if defined COMPILE_PCRE8
+      start_match = find_byte_set(start_match, end_subject, start_set);
+#else
       while (start_match < end_subject)
         {
         register pcre_uint32 c = UCHAR21TEST(start_match);
@@ -6837,6 +7550,7 @@ for(;;)
         if ((start_bits[c/8] & (1 << (c&7))) != 0) break;
         start_match++;
         }
+#endif
       }
     }   /* Starting optimizations */
 
@@ -6884,6 +7598,9 @@ for(;;)
 
       if (p > req_char_ptr)
         {
+#if defined COMPILE_PCRE8
+        p = find_char2(p, end_subject, req_char, req_char2);
+#else
         if (req_char != req_char2)
           {
           while (p < end_subject)
@@ -6899,6 +7616,7 @@ for(;;)
             if (UCHAR21INCTEST(p) == req_char) { p--; break; }
             }
           }
+#endif
 
         /* If we can't find the required character, break the matching loop,
         forcing a match failure. */
@@ -6916,6 +7634,63 @@ for(;;)
         req_char_ptr = p;
         }
       }
+
+#if defined COMPILE_PCRE8
+    /* If study found a string that every match contains, it cannot start
+    before its least offset from the start of the match. This search is not
+    limited by REQ_BYTE_MAX, because it is fast and is repeated only when the
+    start of the match passes the place where the string was last found. If the
+    string is further on than its greatest offset, no match can start before
+    that offset back from the string, so skip to there, unless the match must
+    start in the first line. */
+
+    if (study != NULL && (study->flags & PCRE_STUDY_REQSTR) != 0)
+      {
+      if ((pcre_uint32)(end_subject - start_match) <
+          study->req_min_offset + study->req_length)
+        {
+        rc = MATCH_NOMATCH;
+        break;
+        }
+
+      if (start_match + study->req_min_offset > req_string_ptr)
+        {
+        req_string_ptr = PRIV(find_string)(start_match +
+          study->req_min_offset, end_subject, study->req_string,
+          study->req_length);
+        if (req_string_ptr == NULL)
+          {
+          rc = MATCH_NOMATCH;
+          break;
+          }
+        }
+
+      if (study->req_max_offset != REQ_OFFSET_UNSET &&
+          (pcre_uint32)(req_string_ptr - start_match) > study->req_max_offset)
+        {
+        if (anchored)
+          {
+          rc = MATCH_NOMATCH;
+          break;
+          }
+        if (!firstline)
+          {
+          start_match = req_string_ptr - study->req_max_offset;
+
+          /* Do not start between CR and LF, as for an ordinary advance. */
+
+          if (start_match[-1] == CHAR_CR &&
+              *start_match == CHAR_NL &&
+              (re->flags & PCRE_HASCRORLF) == 0 &&
+                (md->nltype == NLTYPE_ANY ||
+                 md->nltype == NLTYPE_ANYCRLF ||
+                 md->nllen == 2))
+            start_match++;
+          continue;
+          }
+        }
+      }
+#endif
     }
 
 #ifdef PCRE_DEBUG  /* Sigh. Some compilers never learn. */
@@ -7065,8 +7840,11 @@ if (rc == MATCH_MATCH || rc == MATCH_ACCEPT)
       DPRINTF(("Copied offsets from temporary memory\n"));
       }
     if (md->end_offset_top > arg_offset_max) md->capture_last |= OVFLBIT;
-    DPRINTF(("Freeing temporary memory\n"));
-    (PUBL(free))(md->offset_vector);
+    if (context == NULL)
+      {
+      DPRINTF(("Freeing temporary memory\n"));
+      (PUBL(free))(md->offset_vector);
+      }
     }
 
   /* Set the return code to the number of captured strings, or 0 if there were
@@ -7110,16 +7888,14 @@ if (rc == MATCH_MATCH || rc == MATCH_ACCEPT)
   if (extra_data != NULL && (extra_data->flags & PCRE_EXTRA_MARK) != 0)
     *(extra_data->mark) = (pcre_uchar *)md->mark;
   DPRINTF((">>>> returning %d\n", rc));
-#ifdef NO_RECURSE
-  release_match_heapframes(&frame_zero);
-#endif
+  release_match_data(md);
   return rc;
   }
 
 /* Control gets here if there has been an error, or if the overall match
 attempt has failed at all permitted starting positions. */
 
-if (using_temporary_offsets)
+if (using_temporary_offsets && context == NULL)
   {
   DPRINTF(("Freeing temporary memory\n"));
   (PUBL(free))(md->offset_vector);
@@ -7130,9 +7906,7 @@ if (using_temporary_offsets)
 if (rc != MATCH_NOMATCH && rc != PCRE_ERROR_PARTIAL)
   {
   DPRINTF((">>>> error: returning %d\n", rc));
-#ifdef NO_RECURSE
-  release_match_heapframes(&frame_zero);
-#endif
+  release_match_data(md);
   return rc;
   }
 
@@ -7164,10 +7938,220 @@ else
 
 if (extra_data != NULL && (extra_data->flags & PCRE_EXTRA_MARK) != 0)
   *(extra_data->mark) = (pcre_uchar *)md->nomatch_mark;
+release_match_data(md);
+return rc;
+}
+
+
+
+/*************************************************
+*            Manage a match context              *
+*************************************************/
+
+/* A match context holds memory that pcre_exec() would otherwise obtain and
+free on every call. It is attached to a match by setting the match_context
+field of the extra data and the PCRE_EXTRA_MATCH_CONTEXT flag. A context may be
+used with any number of patterns, but by only one match at a time, so each
+thread needs its own.
+
+Arguments for pcre_match_context_alloc(): none
+Returns:  the new context, or NULL if there is no memory
+*/
+
+#if defined COMPILE_PCRE8
+PCRE_EXP_DEFN pcre_match_context * PCRE_CALL_CONVENTION
+pcre_match_context_alloc(void)
+#elif defined COMPILE_PCRE16
+PCRE_EXP_DEFN pcre16_match_context * PCRE_CALL_CONVENTION
+pcre16_match_context_alloc(void)
+#elif defined COMPILE_PCRE32
+PCRE_EXP_DEFN pcre32_match_context * PCRE_CALL_CONVENTION
+pcre32_match_context_alloc(void)
+#endif
+{
+match_context *context =
+  (match_context *)(PUBL(malloc))(sizeof(match_context));
+if (context == NULL) return NULL;
+context->re = NULL;
+context->state.valid = FALSE;
+context->offset_vector = NULL;
+context->offset_size = 0;
+context->save_area = NULL;
+context->save_size = 0;
+context->save_peak = 0;
+context->peak_depth = 0;
 #ifdef NO_RECURSE
-  release_match_heapframes(&frame_zero);
+context->frames.blocks = NULL;
+context->frames.first = NULL;
 #endif
-return rc;
+return (PUBL(match_context) *)context;
+}
+
+
+/* This frees a match context and all the memory that it is holding. A NULL
+argument is ignored.
+
+Argument: the context
+Returns:  nothing
+*/
+
+#if defined COMPILE_PCRE8
+PCRE_EXP_DEFN void PCRE_CALL_CONVENTION
+pcre_match_context_free(pcre_match_context *argument_context)
+#elif defined COMPILE_PCRE16
+PCRE_EXP_DEFN void PCRE_CALL_CONVENTION
+pcre16_match_context_free(pcre16_match_context *argument_context)
+#elif defined COMPILE_PCRE32
+PCRE_EXP_DEFN void PCRE_CALL_CONVENTION
+pcre32_match_context_free(pcre32_match_context *argument_context)
+#endif
+{
+match_context *context = (match_context *)argument_context;
+if (context == NULL) return;
+#ifdef NO_RECURSE
+free_frame_pool(&context->frames);
+#endif
+if (context->offset_vector != NULL) (PUBL(free))(context->offset_vector);
+if (context->save_area != NULL) (PUBL(free))(context->save_area);
+(PUBL(free))(context);
+}
+
+
+/* This binds a match context to a compiled pattern and the extra data to match
+it with, for use by pcre_exec_ctx(). The checks on the pattern are made here
+once, the extra data is copied, and the working offsets that the pattern's back
+references need (when the caller's vector is too small) and the first block of
+frames are obtained now rather than during a match. The pattern, and any study
+data, must not be freed while the context is bound to them. A context can be
+bound again at any time; the memory that it holds is kept.
+
+Arguments:
+  argument_context  the context
+  argument_re       the compiled pattern
+  extra_data        points to extra data or is NULL
+
+Returns:            0 if all went well, or a negative error code
+*/
+
+#if defined COMPILE_PCRE8
+PCRE_EXP_DEFN int PCRE_CALL_CONVENTION
+pcre_match_context_bind(pcre_match_context *argument_context,
+  const pcre *argument_re, const pcre_extra *extra_data)
+#elif defined COMPILE_PCRE16
+PCRE_EXP_DEFN int PCRE_CALL_CONVENTION
+pcre16_match_context_bind(pcre16_match_context *argument_context,
+  const pcre16 *argument_re, const pcre16_extra *extra_data)
+#elif defined COMPILE_PCRE32
+PCRE_EXP_DEFN int PCRE_CALL_CONVENTION
+pcre32_match_context_bind(pcre32_match_context *argument_context,
+  const pcre32 *argument_re, const pcre32_extra *extra_data)
+#endif
+{
+match_context *context = (match_context *)argument_context;
+const REAL_PCRE *re = (const REAL_PCRE *)argument_re;
+
+if (context == NULL || re == NULL) return PCRE_ERROR_NULL;
+if (re->magic_number != MAGIC_NUMBER)
+  return re->magic_number == REVERSED_MAGIC_NUMBER?
+    PCRE_ERROR_BADENDIANNESS:PCRE_ERROR_BADMAGIC;
+if ((re->flags & PCRE_MODE) == 0) return PCRE_ERROR_BADMODE;
+
+context->re = NULL;
+context->state.valid = FALSE;
+
+if (re->top_backref > 0 && context->offset_size < re->top_backref * 3 + 3)
+  {
+  int ocount = re->top_backref * 3 + 3;
+  int *offset_vector = (int *)(PUBL(malloc))(ocount * sizeof(int));
+  if (offset_vector == NULL) return PCRE_ERROR_NOMEMORY;
+  if (context->offset_vector != NULL) (PUBL(free))(context->offset_vector);
+  context->offset_vector = offset_vector;
+  context->offset_size = ocount;
+  }
+
+#ifdef NO_RECURSE
+if (context->frames.blocks == NULL && !add_frame_block(&context->frames))
+  return PCRE_ERROR_NOMEMORY;
+#endif
+
+if (extra_data != NULL) context->extra = *extra_data;
+else context->extra.flags = 0;
+context->extra.flags |= PCRE_EXTRA_MATCH_CONTEXT;
+context->extra.match_context = argument_context;
+context->re = re;
+return 0;
+}
+
+
+/* This matches the pattern that a match context is bound to, using the extra
+data that was given when it was bound. The other arguments and the results are
+as for pcre_exec().
+
+Arguments:
+  argument_context  the context
+  subject           points to the subject string
+  length            length of subject string (may contain binary zeros)
+  start_offset      where to start in the subject string
+  options           option bits
+  offsets           points to a vector of ints to be filled in with offsets
+  offsetcount       the number of elements in the vector
+
+Returns:            as for pcre_exec(), or PCRE_ERROR_NULL if the context is
+                      not bound
+*/
+
+#if defined COMPILE_PCRE8
+PCRE_EXP_DEFN int PCRE_CALL_CONVENTION
+pcre_exec_ctx(pcre_match_context *argument_context, PCRE_SPTR subject,
+  int length, int start_offset, int options, int *offsets, int offsetcount)
+#elif defined COMPILE_PCRE16
+PCRE_EXP_DEFN int PCRE_CALL_CONVENTION
+pcre16_exec_ctx(pcre16_match_context *argument_context, PCRE_SPTR16 subject,
+  int length, int start_offset, int options, int *offsets, int offsetcount)
+#elif defined COMPILE_PCRE32
+PCRE_EXP_DEFN int PCRE_CALL_CONVENTION
+pcre32_exec_ctx(pcre32_match_context *argument_context, PCRE_SPTR32 subject,
+  int length, int start_offset, int options, int *offsets, int offsetcount)
+#endif
+{
+const match_context *context = (const match_context *)argument_context;
+if (context == NULL || context->re == NULL) return PCRE_ERROR_NULL;
+#if defined COMPILE_PCRE8
+return pcre_exec((const pcre *)context->re, &context->extra, subject, length,
+  start_offset, options, offsets, offsetcount);
+#elif defined COMPILE_PCRE16
+return pcre16_exec((const pcre16 *)context->re, &context->extra, subject,
+  length, start_offset, options, offsets, offsetcount);
+#elif defined COMPILE_PCRE32
+return pcre32_exec((const pcre32 *)context->re, &context->extra, subject,
+  length, start_offset, options, offsets, offsetcount);
+#endif
+}
+
+
+/* This returns the greatest depth of recursion of the internal match()
+function reached by any match that has used the context. It is the value to
+compare with the recursion limit. When PCRE is built to use the heap instead of
+the stack for recursion, it is also the number of frames the context is
+holding.
+
+Argument: the context
+Returns:  the peak depth
+*/
+
+#if defined COMPILE_PCRE8
+PCRE_EXP_DEFN unsigned long int PCRE_CALL_CONVENTION
+pcre_match_context_peak_depth(const pcre_match_context *argument_context)
+#elif defined COMPILE_PCRE16
+PCRE_EXP_DEFN unsigned long int PCRE_CALL_CONVENTION
+pcre16_match_context_peak_depth(const pcre16_match_context *argument_context)
+#elif defined COMPILE_PCRE32
+PCRE_EXP_DEFN unsigned long int PCRE_CALL_CONVENTION
+pcre32_match_context_peak_depth(const pcre32_match_context *argument_context)
+#endif
+{
+const match_context *context = (const match_context *)argument_context;
+return (context == NULL)? 0 : context->peak_depth;
 }
 
 /* End of pcre_exec.c */
@@ -1104,6 +1104,7 @@ compatibility. */
 
 #define PCRE_STUDY_MAPPED  0x0001  /* a map of starting chars exists */
 #define PCRE_STUDY_MINLEN  0x0002  /* a minimum length field exists */
+#define PCRE_STUDY_REQSTR  0x0004  /* a required string exists */
 
 /* Masks for identifying the public options that are permitted at compile
 time, run time, or study time, respectively. */
@@ -1152,6 +1153,12 @@ req_byte match. */
 
 #define REQ_BYTE_MAX 1000
 
+/* The longest required string that study records, and the value of its
+greatest offset when that is not bounded. */
+
+#define REQ_STRING_MAX 32
+#define REQ_OFFSET_UNSET 0xffffffffu
+
 /* Miscellaneous definitions. The #ifndef is to pacify compiler warnings in
 environments where these macros are defined elsewhere. Unfortunately, there
 is no way to do the same for the typedef. */
@@ -2401,6 +2408,10 @@ typedef struct pcre_study_data {
   pcre_uint32 flags;              /* Private flags */
   pcre_uint8 start_bits[32];      /* Starting char bits */
   pcre_uint32 minlength;          /* Minimum subject length */
+  pcre_uint32 req_min_offset;     /* Least offset of req_string in a match */
+  pcre_uint32 req_max_offset;     /* Greatest offset, or REQ_OFFSET_UNSET */
+  pcre_uint32 req_length;         /* Length of req_string */
+  pcre_uchar req_string[REQ_STRING_MAX];  /* A string every match contains */
 } pcre_study_data;
 
 /* Structure for building a chain of open capturing subpatterns during
@@ -2561,8 +2572,16 @@ typedef struct match_data {
   const  pcre_uchar *mark;        /* Mark pointer to pass back on success */
   const  pcre_uchar *nomatch_mark;/* Mark pointer to pass back on failure */
   const  pcre_uchar *once_target; /* Where to back up to for atomic groups */
+  void  *match_context;           /* Caller's match context, or NULL */
+  unsigned int peak_depth;        /* Deepest recursion of match() so far */
+  int   *save_area;               /* Context's space for saving offsets */
+  int    save_area_size;          /* Its size in ints */
+  int    save_area_used;          /* Number of ints currently in use */
+  int    save_area_wanted;        /* Ints wanted, whether in the area or not */
+  int    save_area_peak;          /* Most ints wanted during this match */
 #ifdef NO_RECURSE
   void  *match_frames_base;       /* For remembering malloc'd frames */
+  void  *match_frame_pool;        /* Blocks that frames are carved from */
 #endif
 } match_data;
 
@@ -2750,6 +2769,11 @@ extern BOOL              PRIV(was_newline)(PCRE_PUCHAR, int, PCRE_PUCHAR,
                            int *, BOOL);
 extern BOOL              PRIV(xclass)(pcre_uint32, const pcre_uchar *, BOOL);
 
+#if defined COMPILE_PCRE8
+extern PCRE_PUCHAR       PRIV(find_string)(PCRE_PUCHAR, PCRE_PUCHAR,
+                           const pcre_uchar *, int);
+#endif
+
 #ifdef SUPPORT_JIT
 extern void              PRIV(jit_compile)(const REAL_PCRE *,
                            PUBL(extra) *, int);
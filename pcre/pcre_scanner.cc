@@ -33,8 +33,24 @@
 #include "config.h"
 #endif
 
+#include <algorithm>
 #include <vector>
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(HAVE_UNISTD_H) && defined(HAVE_SYS_STAT_H) && !defined(_WIN32)
+#define PCRE_SCANNER_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <io.h>
+#define read _read
+#endif
 
 #include "pcrecpp_internal.h"
 #include "pcre_scanner.h"
@@ -45,40 +61,233 @@ namespace pcrecpp {
 
 Scanner::Scanner()
   : data_(),
-    input_(data_),
+    text_(),
+    input_(),
+    mapping_(NULL),
+    mapping_size_(0),
     skip_(NULL),
+    skip_classes_(0),
     should_skip_(false),
     skip_repeat_(false),
     save_comments_(false),
     comments_(NULL),
-    comments_offset_(0) {
+    comments_offset_(0),
+    rule_set_(NULL),
+    rules_compiled_(false),
+    line_pos_(0),
+    line_count_(1),
+    line_start_(0),
+    line_index_(false) {
 }
 
 Scanner::Scanner(const string& in)
   : data_(in),
-    input_(data_),
+    text_(data_),
+    input_(text_),
+    mapping_(NULL),
+    mapping_size_(0),
+    skip_(NULL),
+    skip_classes_(0),
+    should_skip_(false),
+    skip_repeat_(false),
+    save_comments_(false),
+    comments_(NULL),
+    comments_offset_(0),
+    rule_set_(NULL),
+    rules_compiled_(false),
+    line_pos_(0),
+    line_count_(1),
+    line_start_(0),
+    line_index_(false) {
+}
+
+Scanner::Scanner(const char* in)
+  : data_(in),
+    text_(data_),
+    input_(text_),
+    mapping_(NULL),
+    mapping_size_(0),
+    skip_(NULL),
+    skip_classes_(0),
+    should_skip_(false),
+    skip_repeat_(false),
+    save_comments_(false),
+    comments_(NULL),
+    comments_offset_(0),
+    rule_set_(NULL),
+    rules_compiled_(false),
+    line_pos_(0),
+    line_count_(1),
+    line_start_(0),
+    line_index_(false) {
+}
+
+Scanner::Scanner(const StringPiece& in)
+  : data_(),
+    text_(in),
+    input_(text_),
+    mapping_(NULL),
+    mapping_size_(0),
     skip_(NULL),
+    skip_classes_(0),
     should_skip_(false),
     skip_repeat_(false),
     save_comments_(false),
     comments_(NULL),
-    comments_offset_(0) {
+    comments_offset_(0),
+    rule_set_(NULL),
+    rules_compiled_(false),
+    line_pos_(0),
+    line_count_(1),
+    line_start_(0),
+    line_index_(false) {
+}
+
+Scanner* Scanner::FromFile(const char* path) {
+#ifdef PCRE_SCANNER_MMAP
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return NULL;
+  }
+  if (S_ISREG(st.st_mode) && st.st_size > 0 && st.st_size <= INT_MAX) {
+    void* mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+                         fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return NULL;
+    Scanner* scanner =
+        new Scanner(StringPiece((const char*)mapping, (int)st.st_size));
+    scanner->mapping_ = mapping;
+    scanner->mapping_size_ = (size_t)st.st_size;
+    return scanner;
+  }
+  close(fd);
+  // Empty files, pipes and the like are read in below
+#endif
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) return NULL;
+  string contents;
+  char buffer[8192];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    contents.append(buffer, n);
+  const bool failed = ferror(file) != 0;
+  fclose(file);
+  if (failed) return NULL;
+  return new Scanner(contents);
 }
 
 Scanner::~Scanner() {
   delete skip_;
   delete comments_;
+  delete rule_set_;
+#ifdef PCRE_SCANNER_MMAP
+  if (mapping_ != NULL) munmap(mapping_, mapping_size_);
+#endif
+}
+
+/***** Hand-written skipping *****/
+
+// Alternatives that skip expressions are commonly built from, which
+// ConsumeSkip() runs without pcre
+enum {
+  kSkipSpace = 1,               // \s
+  kSkipSpaces = 2,              // \s+
+  kSkipSlashLine = 4,           // //.*\n
+  kSkipHashLine = 8,            // #.*\n
+  kSkipBlock = 16               // /[*](?:\n|.)*?[*]/
+};
+
+static const struct {
+  const char* pattern;
+  int         skip_class;
+} kSkipAlternatives[] = {
+  { "\\s", kSkipSpace },
+  { "\\s+", kSkipSpaces },
+  { "//.*\n", kSkipSlashLine },
+  { "#.*\n", kSkipHashLine },
+  { "/[*](?:\n|.)*?[*]/", kSkipBlock },
+  { "/[*](.|\n)*?[*]/", kSkipBlock },
+  { "/\\*(?:\n|.)*?\\*/", kSkipBlock },
+  { "/\\*[\\s\\S]*?\\*/", kSkipBlock },
+};
+
+// Return the skip classes that "re" is an alternation of, or 0 if it
+// is anything else.  "." is only taken to stop at "\n" alone when that
+// is pcre's newline convention.
+static int SkipClasses(const char* re) {
+  int newline = 0;
+  pcre_config(PCRE_CONFIG_NEWLINE, &newline);
+  if (newline != '\n') return 0;
+
+  const size_t count = sizeof(kSkipAlternatives) / sizeof(*kSkipAlternatives);
+  int classes = 0;
+  const char* p = re;
+  for (;;) {
+    size_t i, n = 0;
+    for (i = 0; i < count; ++i) {
+      n = strlen(kSkipAlternatives[i].pattern);
+      if (strncmp(p, kSkipAlternatives[i].pattern, n) == 0 &&
+          (p[n] == '|' || p[n] == '\0'))
+        break;
+    }
+    if (i == count) return 0;
+    classes |= kSkipAlternatives[i].skip_class;
+    p += n;
+    if (*p == '\0') break;
+    ++p;
+  }
+  // Which of \s and \s+ matches would depend on the order
+  if ((classes & kSkipSpace) && (classes & kSkipSpaces)) return 0;
+  return classes;
+}
+
+// pcre's \s outside UTF-8 mode
+static inline bool IsSkipSpace(unsigned char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Length of one match of the skip "classes" at [p, end), or 0
+static int SkipOnce(const char* p, const char* end, int classes) {
+  if (p == end) return 0;
+  const unsigned char c = *p;
+  if (IsSkipSpace(c)) {
+    if (classes & kSkipSpaces) {
+      const char* q = p + 1;
+      while (q < end && IsSkipSpace(*q)) ++q;
+      return (int)(q - p);
+    }
+    return (classes & kSkipSpace) ? 1 : 0;
+  }
+  if ((c == '#' && (classes & kSkipHashLine)) ||
+      (c == '/' && end - p >= 2 && p[1] == '/' &&
+       (classes & kSkipSlashLine))) {
+    const char* newline = (const char*)memchr(p + 1, '\n', end - p - 1);
+    return (newline == NULL) ? 0 : (int)(newline + 1 - p);
+  }
+  if (c == '/' && end - p >= 2 && p[1] == '*' && (classes & kSkipBlock)) {
+    for (const char* q = p + 2; q < end; ++q) {
+      q = (const char*)memchr(q, '*', end - q);
+      if (q == NULL || q + 1 == end) return 0;
+      if (q[1] == '/') return (int)(q + 2 - p);
+    }
+  }
+  return 0;
 }
 
 void Scanner::SetSkipExpression(const char* re) {
   delete skip_;
   if (re != NULL) {
     skip_ = new RE(re);
+    skip_classes_ = SkipClasses(re);
     should_skip_ = true;
     skip_repeat_ = true;
     ConsumeSkip();
   } else {
     skip_ = NULL;
+    skip_classes_ = 0;
     should_skip_ = false;
     skip_repeat_ = false;
   }
@@ -88,11 +297,13 @@ void Scanner::Skip(const char* re) {
   delete skip_;
   if (re != NULL) {
     skip_ = new RE(re);
+    skip_classes_ = SkipClasses(re);
     should_skip_ = true;
     skip_repeat_ = false;
     ConsumeSkip();
   } else {
     skip_ = NULL;
+    skip_classes_ = 0;
     should_skip_ = false;
     skip_repeat_ = false;
   }
@@ -109,24 +320,123 @@ void Scanner::EnableSkip() {
   ConsumeSkip();
 }
 
+static const unsigned long long kEachByte = 0x0101010101010101ULL;
+
+// Number of newline bytes among the eight bytes of "v"
+static inline int CountNewlines(unsigned long long v) {
+  const unsigned long long x = v ^ (kEachByte * '\n');   // newlines are 0
+  const unsigned long long low7 = kEachByte * 0x7F;
+  // The top bit of each byte is set iff that byte of x is zero
+  const unsigned long long zero = ~(((x & low7) + low7) | x | low7);
+  return static_cast<int>((((zero >> 7) * kEachByte)) >> 56);
+}
+
+// Number of newlines in [p, end)
+static long long CountNewlines(const char* p, const char* end) {
+  long long n = 0;
+  for (; end - p >= 8; p += 8) {
+    unsigned long long v;
+    memcpy(&v, p, sizeof(v));
+    n += CountNewlines(v);
+  }
+  for (; p < end; ++p)
+    n += (*p == '\n');
+  return n;
+}
+
+void Scanner::CountLines(int offset, bool record,
+                         int* pos, int* lines, int* line_start) const {
+  const char* data = text_.data();
+  const char* p = data + *pos;
+  const char* end = data + offset;
+  int n = *lines;
+  while (p < end) {
+    int c = 0;
+    if (end - p >= 8) {
+      unsigned long long v;
+      memcpy(&v, p, sizeof(v));
+      c = CountNewlines(v);
+      // Lines that start in this word only need finding one by one
+      // if one of them goes into the index
+      if (!record || (n - 1) / kLineIndexStride ==
+                     (n - 1 + c) / kLineIndexStride) {
+        n += c;
+        p += 8;
+        continue;
+      }
+      c = 8;
+    } else {
+      c = (int)(end - p);
+    }
+    for (const char* q = p + c; p < q; ++p) {
+      if (*p == '\n' && (++n - 1) % kLineIndexStride == 0 && record)
+        line_starts_.push_back((int)(p + 1 - data));
+    }
+  }
+  // The line's start is after the last newline passed, if any
+  if (n != *lines) {
+    const char* q = end;
+    while (q[-1] != '\n') --q;
+    *line_start = (int)(q - data);
+  }
+  *pos = offset;
+  *lines = n;
+}
+
+void Scanner::LineAndColumn(int offset, int* line, int* column) const {
+  assert(offset >= 0 && offset <= text_.size());
+  int pos, lines, line_start;
+  if (offset >= line_pos_) {
+    CountLines(offset, line_index_, &line_pos_, &line_count_, &line_start_);
+    pos = line_pos_;
+    lines = line_count_;
+    line_start = line_start_;
+  } else {
+    pos = 0;
+    lines = 1;
+    if (line_index_) {
+      // The last indexed line start at or before "offset"
+      const int i = (int)(std::upper_bound(line_starts_.begin(),
+                                           line_starts_.end(), offset) -
+                          line_starts_.begin()) - 1;
+      pos = line_starts_[i];
+      lines = 1 + i * kLineIndexStride;
+    }
+    line_start = pos;
+    CountLines(offset, false, &pos, &lines, &line_start);
+  }
+  *line = lines;
+  *column = offset - line_start + 1;
+}
+
+void Scanner::LineAndColumn(int* line, int* column) const {
+  LineAndColumn(Offset(), line, column);
+}
+
 int Scanner::LineNumber() const {
-  // TODO: Make it more efficient by keeping track of the last point
-  // where we computed line numbers and counting newlines since then.
-  // We could use std:count, but not all systems have it. :-(
-  int count = 1;
-  for (const char* p = data_.data(); p < input_.data(); ++p)
-    if (*p == '\n')
-      ++count;
-  return count;
+  int line, column;
+  LineAndColumn(&line, &column);
+  return line;
+}
+
+void Scanner::set_line_index(bool index) {
+  line_index_ = index;
+  line_starts_.clear();
+  if (index) {
+    // Count again from the start, indexing as we go
+    line_starts_.push_back(0);
+    line_pos_ = 0;
+    line_count_ = 1;
+    line_start_ = 0;
+  }
 }
 
 int Scanner::Offset() const {
-  return (int)(input_.data() - data_.c_str());
+  return (int)(input_.data() - text_.data());
 }
 
 bool Scanner::LookingAt(const RE& re) const {
-  int consumed;
-  return re.DoMatch(input_, RE::ANCHOR_START, &consumed, 0, 0);
+  return re.DoMatch(input_, RE::ANCHOR_START, NULL, 0, 0);
 }
 
 
@@ -139,13 +449,61 @@ bool Scanner::Consume(const RE& re,
   return result;
 }
 
+bool Scanner::AddRule(int id, const char* pattern) {
+  // A compiled set takes no more patterns, so start a new one; the
+  // earlier rules' programs come from the cache
+  if (rule_set_ == NULL || rules_compiled_) {
+    RE::Set* set = new RE::Set(RE::ANCHOR_START);
+    for (size_t i = 0; i < rule_patterns_.size(); ++i)
+      set->Add(rule_patterns_[i], NULL);
+    delete rule_set_;
+    rule_set_ = set;
+    rules_compiled_ = false;
+  }
+  // Add() compiles just this pattern, and refuses it if it could not
+  // be joined to the others (by naming the same group, say)
+  if (rule_set_->Add(pattern, NULL) < 0) return false;
+  rule_patterns_.push_back(pattern);
+  rule_ids_.push_back(id);
+  return true;
+}
+
+bool Scanner::NextToken(int* id, StringPiece* token) {
+  if (rule_set_ == NULL) return false;
+  if (!rules_compiled_) {
+    // Only a limit such as the size of the joined program can make this
+    // fail now, and then no rule matches
+    rules_compiled_ = true;
+    rule_set_->Compile();
+  }
+  StringPiece match;
+  const int rule = rule_set_->LongestMatch(input_, &match);
+  if (rule < 0 || match.empty()) return false;
+  *id = rule_ids_[rule];
+  if (token != NULL) *token = match;
+  input_.remove_prefix(match.size());
+  if (should_skip_) ConsumeSkip();
+  return true;
+}
+
 // helper function to consume *skip_ and honour save_comments_
 void Scanner::ConsumeSkip() {
   const char* start_data = input_.data();
-  while (skip_->Consume(&input_)) {
-    if (!skip_repeat_) {
-      // Only one skip allowed.
-      break;
+  if (skip_classes_ != 0) {
+    const char* p = start_data;
+    const char* end = p + input_.size();
+    int n;
+    while ((n = SkipOnce(p, end, skip_classes_)) > 0) {
+      p += n;
+      if (!skip_repeat_) break;
+    }
+    input_.remove_prefix((int)(p - start_data));
+  } else {
+    while (skip_->Consume(&input_)) {
+      if (!skip_repeat_) {
+        // Only one skip allowed.
+        break;
+      }
     }
   }
   if (save_comments_) {
@@ -174,8 +532,8 @@ void Scanner::GetComments(int start, int end, vector<StringPiece> *ranges) {
   // lower_bound)
   for (vector<StringPiece>::const_iterator it = comments_->begin();
        it != comments_->end(); ++it) {
-    if ((it->data() >= data_.c_str() + start &&
-         it->data() + it->size() <= data_.c_str() + end)) {
+    if ((it->data() >= text_.data() + start &&
+         it->data() + it->size() <= text_.data() + end)) {
       ranges->push_back(*it);
     }
   }
@@ -196,4 +554,171 @@ void Scanner::GetNextComments(vector<StringPiece> *ranges) {
   }
 }
 
+/***** Scanning streams *****/
+
+StreamScanner::StreamScanner(const Reader& reader, int chunk_size)
+  : reader_(reader),
+    chunk_size_(chunk_size > 0 ? chunk_size : kDefaultChunkSize),
+    eof_(false),
+    error_(false),
+    pos_(0),
+    base_(0),
+    line_pos_(0),
+    line_count_(1),
+    skip_(NULL),
+    should_skip_(false) {
+}
+
+StreamScanner::StreamScanner(int fd, int chunk_size)
+  : reader_([fd](char* buffer, int size) {
+      int n;
+      do {
+        n = (int)read(fd, buffer, size);
+      } while (n < 0 && errno == EINTR);
+      return n;
+    }),
+    chunk_size_(chunk_size > 0 ? chunk_size : kDefaultChunkSize),
+    eof_(false),
+    error_(false),
+    pos_(0),
+    base_(0),
+    line_pos_(0),
+    line_count_(1),
+    skip_(NULL),
+    should_skip_(false) {
+}
+
+StreamScanner::~StreamScanner() {
+  delete skip_;
+}
+
+long long StreamScanner::LineNumber() const {
+  line_count_ += CountNewlines(buffer_.data() + line_pos_,
+                               buffer_.data() + pos_);
+  line_pos_ = pos_;
+  return line_count_;
+}
+
+long long StreamScanner::Offset() const {
+  return base_ + (long long)pos_;
+}
+
+bool StreamScanner::Fill() {
+  if (eof_) return false;
+  // Drop the consumed input, counting its lines first
+  if (pos_ > 0) {
+    LineNumber();
+    buffer_.erase(0, pos_);
+    base_ += (long long)pos_;
+    pos_ = 0;
+    line_pos_ = 0;
+  }
+  const size_t old_size = buffer_.size();
+  buffer_.resize(old_size + chunk_size_);
+  int n = reader_(&buffer_[old_size], chunk_size_);
+  if (n <= 0) {
+    eof_ = true;
+    error_ = (n < 0);
+    n = 0;
+  }
+  buffer_.resize(old_size + n);
+  return n > 0;
+}
+
+int StreamScanner::Match(const RE& re, int n) {
+  const int vecsize = re.VecSize(n);
+  vec_.resize(vecsize);
+  while (pos_ == buffer_.size() && Fill()) { }
+  for (;;) {
+    const StringPiece window(buffer_.data() + pos_,
+                             (int)(buffer_.size() - pos_));
+    const int rc = re.Exec(window, 0, RE::ANCHOR_START,
+                           eof_ ? 0 : PCRE_PARTIAL_HARD,
+                           &vec_[0], vecsize, NULL);
+    if (rc == PCRE_ERROR_PARTIAL || rc == PCRE_ERROR_SHORTUTF8) {
+      // The token may go on in the next chunk.  At the end of the
+      // input, the next try runs without partial matching.
+      Fill();
+      continue;
+    }
+    return (rc >= 0) ? vec_[1] : -1;
+  }
+}
+
+void StreamScanner::Advance(int n) {
+  pos_ += n;
+  if (should_skip_) {
+    int skipped;
+    while ((skipped = Match(*skip_, 0)) > 0)
+      pos_ += skipped;
+  }
+}
+
+bool StreamScanner::LookingAt(const RE& re) {
+  return Match(re, 0) >= 0;
+}
+
+bool StreamScanner::Consume(const RE& re,
+                            const Arg& arg0,
+                            const Arg& arg1,
+                            const Arg& arg2) {
+  const Arg* args[3];
+  int n = 0;
+  if (&arg0 != &RE::no_arg) {
+    args[n++] = &arg0;
+    if (&arg1 != &RE::no_arg) {
+      args[n++] = &arg1;
+      if (&arg2 != &RE::no_arg)
+        args[n++] = &arg2;
+    }
+  }
+  if (re.NumberOfCapturingGroups() < n) return false;
+
+  const int length = Match(re, n);
+  if (length < 0) return false;
+  const char* text = buffer_.data() + pos_;
+  if (n > 0 && should_skip_) {
+    // Skipping may read more input and move the window, so give
+    // StringPiece arguments a copy of the token that stays put
+    token_.assign(text, length);
+    text = token_.data();
+  }
+  for (int i = 0; i < n; i++) {
+    const int start = vec_[2 * (i + 1)];
+    const int limit = vec_[2 * (i + 1) + 1];
+    if (!args[i]->Parse(text + start, limit - start))
+      return false;
+  }
+  Advance(length);
+  return true;
+}
+
+void StreamScanner::SetSkipExpression(const char* re) {
+  delete skip_;
+  if (re != NULL) {
+    skip_ = new RE(re);
+    should_skip_ = true;
+    Advance(0);
+  } else {
+    skip_ = NULL;
+    should_skip_ = false;
+  }
+}
+
+void StreamScanner::DisableSkip() {
+  assert(skip_ != NULL);
+  should_skip_ = false;
+}
+
+void StreamScanner::EnableSkip() {
+  assert(skip_ != NULL);
+  should_skip_ = true;
+  Advance(0);
+}
+
+bool StreamScanner::AtEnd() {
+  while (pos_ == buffer_.size() && Fill()) { }
+  return pos_ == buffer_.size();
+}
+
 }   // namespace pcrecpp
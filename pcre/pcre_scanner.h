@@ -45,6 +45,7 @@
 #define _PCRE_SCANNER_H
 
 #include <assert.h>
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -57,15 +58,41 @@ class PCRECPP_EXP_DEFN Scanner {
  public:
   Scanner();
   explicit Scanner(const std::string& input);
+  explicit Scanner(const char* input);
+
+  // Scan "input" in place, without copying it.  The caller's storage
+  // must outlive the Scanner and any StringPieces it hands out.
+  explicit Scanner(const StringPiece& input);
+
+  // Scan the contents of the file at "path", mapped read-only into
+  // memory where the system allows, and read in otherwise.  Returns
+  // NULL if the file cannot be read.  The caller owns the result.
+  static Scanner* FromFile(const char* path);
+
   ~Scanner();
 
   // Return current line number.  The returned line-number is
   // one-based.  I.e. it returns 1 + the number of consumed newlines.
   //
-  // Note: this method may be slow.  It may take time proportional to
-  // the size of the input.
+  // Newlines are counted from where the previous call left off, so
+  // calling this as the input is consumed costs time proportional to
+  // the size of the input overall, not on every call.
   int LineNumber() const;
 
+  // Store the one-based line and byte column of the current position,
+  // or of byte "offset" in the input.  Offsets before the furthest one
+  // asked about so far are counted from the start of the input, unless
+  // the line index is enabled.
+  void LineAndColumn(int* line, int* column) const;
+  void LineAndColumn(int offset, int* line, int* column) const;
+
+  // Keep a sparse index of line starts as newlines are counted, so
+  // that LineAndColumn() finds any earlier offset in O(log n) time.
+  // It takes one int per kLineIndexStride lines of input.
+  static const int kLineIndexStride = 256;
+  void set_line_index(bool index);
+  bool line_index() const { return line_index_; }
+
   // Return the byte-offset that the scanner is looking in the
   // input data;
   int Offset() const;
@@ -113,6 +140,27 @@ class PCRECPP_EXP_DEFN Scanner {
   // that matches the skip pattern is immediately dropped.
   void EnableSkip();
 
+  /***** Tokenizing with a set of rules *****/
+
+  // Add a token rule for NextToken().  Returns false, adding nothing,
+  // if "pattern" is not a valid regular expression or cannot be joined
+  // to the rules already added (by naming the same group, say).
+  bool AddRule(int id, const char* pattern);
+
+  // Match all of the rules at the current position at once, and
+  // consume the longest match (the earliest added rule wins a tie),
+  // followed by any input the skip expression matches.  Stores the
+  // rule's id in "*id" and the token in "*token" (if not NULL).
+  // Returns false if no rule matches a non-empty token here.  The rules
+  // are joined into a single program, so each token costs one match
+  // rather than one per rule; see RE::Set for what rules may contain.
+  //
+  //    scanner.AddRule(IDENT, "[A-Za-z_]\\w*");
+  //    scanner.AddRule(NUMBER, "\\d+");
+  //    scanner.AddRule(ARROW, "->");
+  //    while (scanner.NextToken(&id, &token)) ...
+  bool NextToken(int* id, StringPiece* token);
+
   /***** Special wrappers around SetSkip() for some common idioms *****/
 
   // Arranges to skip whitespace, C comments, C++ comments.
@@ -147,9 +195,13 @@ class PCRECPP_EXP_DEFN Scanner {
   void GetNextComments(std::vector<StringPiece> *ranges);
 
  private:
-  std::string   data_;          // All the input data
+  std::string   data_;          // Our copy of the input, if we made one
+  StringPiece   text_;          // All the input data
   StringPiece   input_;         // Unprocessed input
+  void*         mapping_;       // The file mapped by FromFile(), or NULL
+  size_t        mapping_size_;
   RE*           skip_;          // If non-NULL, RE for skipping input
+  int           skip_classes_;  // What skip_ matches, if run by hand
   bool          should_skip_;   // If true, use skip_
   bool          skip_repeat_;   // If true, repeat skip_ as long as it works
   bool          save_comments_; // If true, aggregate the skip expression
@@ -162,9 +214,125 @@ class PCRECPP_EXP_DEFN Scanner {
   // the offset into comments_ that has been returned by GetNextComments
   int           comments_offset_;
 
+  // Rules for NextToken(), and the set built from them, which is
+  // compiled when first needed
+  std::vector<std::string> rule_patterns_;
+  std::vector<int>         rule_ids_;
+  RE::Set*                 rule_set_;
+  bool                     rules_compiled_;
+
+  // How far newlines have been counted: up to byte line_pos_, which is
+  // on line line_count_, and that line starts at line_start_
+  mutable int   line_pos_;
+  mutable int   line_count_;
+  mutable int   line_start_;
+
+  // If line_index_, line_starts_[i] is the start of line
+  // 1 + i * kLineIndexStride, for all lines up to line_pos_
+  bool                     line_index_;
+  mutable std::vector<int> line_starts_;
+
   // helper function to consume *skip_ and honour
   // save_comments_
   void ConsumeSkip();
+
+  // Scanners hold pointers into their own data
+  Scanner(const Scanner&) = delete;
+  Scanner& operator=(const Scanner&) = delete;
+
+  // Advance a line count of "*lines" at "*pos" (the line starting at
+  // "*line_start") to "offset".  With "record", add the line starts
+  // passed on the way to line_starts_.
+  void CountLines(int offset, bool record,
+                  int* pos, int* lines, int* line_start) const;
+};
+
+// A Scanner for input that is read a chunk at a time, from a file
+// descriptor or a reader function, so that input of any size can be
+// scanned in bounded memory.  It keeps a window of unconsumed input of
+// about two chunks, growing it only while a token is longer than that.
+// Tokens are matched with PCRE_PARTIAL_HARD, so one that may continue
+// past the end of the window waits for the next chunk instead of being
+// cut short at a chunk boundary.
+//
+//      StreamScanner scanner(fd);
+//      scanner.SetSkipExpression("\\s+");
+//      while (scanner.Consume("(\\w+) = (\\d+)", &var, &number)) {
+//        ...;
+//      }
+//
+// Patterns are matched starting at the current position, as with
+// Scanner.  StringPiece arguments point into the window and are only
+// valid until the next call.  Comments are not saved.
+class PCRECPP_EXP_DEFN StreamScanner {
+ public:
+  // Fills "buffer" with up to "size" bytes of input, returning the
+  // number of bytes stored, 0 at the end of the input, or -1 on error
+  typedef std::function<int (char* buffer, int size)> Reader;
+
+  static const int kDefaultChunkSize = 64 << 10;
+
+  explicit StreamScanner(const Reader& reader,
+                         int chunk_size = kDefaultChunkSize);
+
+  // Read from "fd", which the caller closes after the scanner is done
+  explicit StreamScanner(int fd, int chunk_size = kDefaultChunkSize);
+
+  ~StreamScanner();
+
+  // As for Scanner, but counting over the whole stream
+  long long LineNumber() const;
+  long long Offset() const;
+
+  // As for Scanner.  These read more input as needed.
+  bool LookingAt(const RE& re);
+  bool Consume(const RE& re,
+               const Arg& arg0 = RE::no_arg,
+               const Arg& arg1 = RE::no_arg,
+               const Arg& arg2 = RE::no_arg);
+  void SetSkipExpression(const char* re);
+  void DisableSkip();
+  void EnableSkip();
+
+  // Return true iff all of the input has been consumed
+  bool AtEnd();
+
+  // Return true iff the reader reported an error
+  bool error() const { return error_; }
+
+  // Number of bytes of input held in memory
+  size_t buffered() const { return buffer_.size(); }
+
+ private:
+  StreamScanner(const StreamScanner&) = delete;
+  StreamScanner& operator=(const StreamScanner&) = delete;
+
+  // Match "re" at the current position, reading more input while the
+  // match might extend past the window.  Returns the length of the
+  // match and stores the group offsets (relative to the current
+  // position) in vec_, or returns -1 if there is no match.
+  int Match(const RE& re, int n);
+
+  // Read another chunk onto the end of the window.  Returns false at
+  // the end of the input or on error.
+  bool Fill();
+
+  // Consume "n" bytes, then the skip expression if it is enabled
+  void Advance(int n);
+
+  Reader            reader_;
+  int               chunk_size_;
+  bool              eof_;
+  bool              error_;
+  std::string       buffer_;        // The window
+  size_t            pos_;           // Current position in buffer_
+  long long         base_;          // Stream offset of buffer_[0]
+  mutable size_t    line_pos_;      // Newlines are counted up to here
+  mutable long long line_count_;
+  RE*               skip_;
+  bool              should_skip_;
+  std::vector<int>  vec_;
+  std::string       token_;         // The last token, if skipping moved it
 };
 
 }   // namespace pcrecpp
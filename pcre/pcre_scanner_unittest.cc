@@ -40,6 +40,10 @@
 #include <string.h>      /* for strchr */
 #include <string>
 #include <vector>
+#ifdef HAVE_UNISTD_H
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "pcrecpp.h"
 #include "pcre_stringpiece.h"
@@ -60,6 +64,7 @@ using std::vector;
 using std::string;
 using pcrecpp::StringPiece;
 using pcrecpp::Scanner;
+using pcrecpp::StreamScanner;
 
 static void TestScanner() {
   const char input[] = "\n"
@@ -146,6 +151,377 @@ static void TestBigComment() {
   CHECK_EQ(value, "value");
 }
 
+// Line and column of "offset" in "input", counted the slow way
+static void SlowLineAndColumn(const string& input, int offset,
+                              int* line, int* column) {
+  *line = 1;
+  int line_start = 0;
+  for (int i = 0; i < offset; ++i) {
+    if (input[i] == '\n') {
+      ++*line;
+      line_start = i + 1;
+    }
+  }
+  *column = offset - line_start + 1;
+}
+
+static void CheckLineAndColumn(const Scanner& s, const string& input,
+                               int offset) {
+  int line, column, expected_line, expected_column;
+  s.LineAndColumn(offset, &line, &column);
+  SlowLineAndColumn(input, offset, &expected_line, &expected_column);
+  CHECK_EQ(line, expected_line);
+  CHECK_EQ(column, expected_column);
+}
+
+static void TestLineNumbers() {
+  // Lines of all lengths, including empty ones and runs of newlines
+  string input;
+  for (int i = 0; i < 3000; ++i)
+    input += string(i % 37, 'a' + i % 26) + ((i % 11 == 0) ? "\n\n" : "\n");
+  input += "last";
+
+  // Following the scanner through the input
+  Scanner s(input);
+  s.SetSkipExpression("\\s+");
+  int tokens = 0, line, column;
+  CHECK_EQ(s.LineNumber(), 3);     // after the leading blank lines
+  while (s.Consume("\\w+")) {
+    ++tokens;
+    s.LineAndColumn(&line, &column);
+    CHECK_EQ(s.LineNumber(), line);
+    int expected_line, expected_column;
+    SlowLineAndColumn(input, s.Offset(), &expected_line, &expected_column);
+    CHECK_EQ(line, expected_line);
+    CHECK_EQ(column, expected_column);
+  }
+  CHECK_EQ(s.Offset(), (int)input.size());
+  CHECK_EQ(line, 3000 + 273 + 1);
+  CHECK_EQ(column, 5);
+
+  // Arbitrary offsets, with and without the index
+  for (int indexed = 0; indexed < 2; ++indexed) {
+    Scanner t(input);
+    t.set_line_index(indexed != 0);
+    CHECK_EQ(t.line_index(), indexed != 0);
+    CheckLineAndColumn(t, input, (int)input.size());
+    for (int offset = (int)input.size(); offset >= 0; offset -= 97)
+      CheckLineAndColumn(t, input, offset);
+    for (int offset = 0; offset <= (int)input.size(); offset += 1009)
+      CheckLineAndColumn(t, input, offset);
+    CheckLineAndColumn(t, input, 0);
+  }
+
+  // Offsets on either side of each newline
+  Scanner u(input);
+  u.set_line_index(true);
+  for (int i = 0; i < 200; ++i) {
+    CheckLineAndColumn(u, input, i);
+    CheckLineAndColumn(u, input, (int)input.size() - i);
+  }
+
+  Scanner empty("");
+  empty.LineAndColumn(&line, &column);
+  CHECK_EQ(line, 1);
+  CHECK_EQ(column, 1);
+}
+
+// Scan "a = 1; b = 22; // end" and check what comes back
+static void CheckAssignments(Scanner* s, const char* base) {
+  string var;
+  int number;
+  vector<StringPiece> comments;
+  s->SkipCXXComments();
+  s->set_save_comments(true);
+  CHECK_EQ(s->Consume("(\\w+) = (\\d+);", &var, &number), true);
+  CHECK_EQ(var, "a");
+  CHECK_EQ(s->Consume("(\\w+) = (\\d+);", &var, &number), true);
+  CHECK_EQ(number, 22);
+  CHECK_EQ(s->LineNumber(), 3);
+  CHECK_EQ(s->Offset(), 22);
+  s->GetComments(0, s->Offset(), &comments);
+  CHECK_EQ(comments.size(), 2);
+  CHECK_EQ(comments[1].as_string(), " // end\n");
+  if (base != NULL)
+    CHECK_EQ(comments[1].data(), base + 14);
+}
+
+static void TestExternalInput() {
+  static const char kInput[] = "a = 1;\nb = 22; // end\nc";
+
+  // Borrowed without a copy, and without a terminating NUL
+  char buffer[sizeof(kInput) + 8];
+  memcpy(buffer, kInput, sizeof(kInput) - 1);
+  memset(buffer + sizeof(kInput) - 1, 'x', 9);
+  Scanner borrowed(StringPiece(buffer, (int)sizeof(kInput) - 1));
+  CheckAssignments(&borrowed, buffer);
+  CHECK_EQ(borrowed.Consume("c"), true);
+  CHECK_EQ(borrowed.LookingAt("x"), false);
+
+  // Copied from a string or a C string, as before
+  Scanner copied(string(kInput) + "");
+  CheckAssignments(&copied, NULL);
+  Scanner from_chars(kInput);
+  CheckAssignments(&from_chars, NULL);
+
+  // Read from a file
+  const char* path = "pcre_scanner_unittest.tmp";
+  FILE* file = fopen(path, "wb");
+  CHECK_EQ(file != NULL, true);
+  fwrite(kInput, 1, sizeof(kInput) - 1, file);
+  fclose(file);
+  Scanner* mapped = Scanner::FromFile(path);
+  CHECK_EQ(mapped != NULL, true);
+  CheckAssignments(mapped, NULL);
+  CHECK_EQ(mapped->Consume("c"), true);
+  CHECK_EQ(mapped->Offset(), (int)sizeof(kInput) - 1);
+  delete mapped;
+
+  file = fopen(path, "wb");
+  fclose(file);
+  Scanner* empty = Scanner::FromFile(path);
+  CHECK_EQ(empty != NULL, true);
+  CHECK_EQ(empty->Offset(), 0);
+  CHECK_EQ(empty->LookingAt(""), true);
+  CHECK_EQ(empty->Consume("\\w"), false);
+  delete empty;
+  remove(path);
+
+  CHECK_EQ(Scanner::FromFile(path) == NULL, true);
+}
+
+// Hands out "input" a few bytes at a time, varying the amount
+class PieceReader {
+ public:
+  PieceReader(const string& input, int max_piece)
+    : input_(input), pos_(0), max_piece_(max_piece), calls_(0) { }
+  int operator()(char* buffer, int size) {
+    int n = 1 + (calls_++ % max_piece_);
+    if (n > size) n = size;
+    if (n > (int)(input_.size() - pos_)) n = (int)(input_.size() - pos_);
+    memcpy(buffer, input_.data() + pos_, n);
+    pos_ += n;
+    return n;
+  }
+ private:
+  const string& input_;
+  size_t pos_;
+  int max_piece_;
+  int calls_;
+};
+
+static void TestStreamScanner() {
+  string input = "\n";
+  for (int i = 0; i < 200; ++i) {
+    char buf[100];
+    sprintf(buf, "var%d = %d; // comment %d\n", i, i * 7919, i);
+    input += buf;
+  }
+  input += "   ";
+
+  // Whatever the chunking, the tokens, offsets and line numbers come
+  // out as from a Scanner over the whole input
+  const char* re = "(\\w+) = (\\d+);";
+  for (int piece = 1; piece <= 13; piece += 4) {
+    for (int chunk = 1; chunk <= 64; chunk *= 4) {
+      Scanner whole(input);
+      StreamScanner stream(PieceReader(input, piece), chunk);
+      whole.SkipCXXComments();
+      stream.SetSkipExpression("\\s|//.*\n|/[*](?:\n|.)*?[*]/");
+      string var1, var2;
+      int n1, n2;
+      StringPiece name;
+      while (whole.Consume(re, &var1, &n1)) {
+        CHECK_EQ(stream.Consume(re, &name, &n2), true);
+        CHECK_EQ(name.as_string(), var1);
+        CHECK_EQ(n2, n1);
+        CHECK_EQ(stream.Offset(), whole.Offset());
+        CHECK_EQ(stream.LineNumber(), whole.LineNumber());
+      }
+      CHECK_EQ(stream.Consume(re, &var2, &n2), false);
+      CHECK_EQ(stream.AtEnd(), true);
+      CHECK_EQ(stream.error(), false);
+      CHECK_EQ(stream.Offset(), (long long)input.size());
+      CHECK_EQ(stream.LineNumber(), 202);
+    }
+  }
+
+  // The window stays bounded over long input, but grows for a token
+  // longer than a chunk
+  string big;
+  for (int i = 0; i < 20000; ++i)
+    big += "token ";
+  big += string(10000, 'x') + " end";
+  StreamScanner bounded(PieceReader(big, 1000), 256);
+  bounded.SetSkipExpression("\\s+");
+  size_t max_buffered = 0;
+  int tokens = 0;
+  while (bounded.Consume("token")) {
+    ++tokens;
+    if (bounded.buffered() > max_buffered) max_buffered = bounded.buffered();
+  }
+  CHECK_EQ(tokens, 20000);
+  CHECK_EQ(max_buffered <= 2 * 256, true);
+  string x;
+  CHECK_EQ(bounded.Consume("(x+)", &x), true);
+  CHECK_EQ(x.size(), 10000);
+  CHECK_EQ(bounded.LookingAt("end"), true);
+  CHECK_EQ(bounded.LookingAt("end\\z"), true);
+  CHECK_EQ(bounded.LookingAt("en$"), false);
+  CHECK_EQ(bounded.Consume("end"), true);
+  CHECK_EQ(bounded.AtEnd(), true);
+
+  // Reader errors end the input
+  StreamScanner failing([](char*, int) { return -1; });
+  CHECK_EQ(failing.AtEnd(), true);
+  CHECK_EQ(failing.error(), true);
+  CHECK_EQ(failing.LookingAt(""), true);
+
+#ifdef HAVE_UNISTD_H
+  const char* path = "pcre_scanner_unittest.tmp";
+  FILE* file = fopen(path, "wb");
+  fwrite(input.data(), 1, input.size(), file);
+  fclose(file);
+  int fd = open(path, O_RDONLY);
+  CHECK_EQ(fd >= 0, true);
+  {
+    StreamScanner from_fd(fd, 16);
+    from_fd.SetSkipExpression("\\s+|//.*\n");
+    int count = 0;
+    while (from_fd.Consume(re)) ++count;
+    CHECK_EQ(count, 200);
+    CHECK_EQ(from_fd.AtEnd(), true);
+  }
+  close(fd);
+  remove(path);
+#endif
+}
+
+static void TestRules() {
+  enum { IDENT, NUMBER, ARROW, GE, GT, EQ, KEYWORD, STRING };
+  const char input[] = "message Wave {\n"
+                       "  optional string out = 1; // \"sine\"\n"
+                       "  x->y >= 10 > 2 \"a b\"\n"
+                       "}\n";
+  Scanner s(input);
+  s.SkipCXXComments();
+  CHECK_EQ(s.AddRule(KEYWORD, "message|optional|string"), true);
+  CHECK_EQ(s.AddRule(IDENT, "[A-Za-z_]\\w*"), true);
+  CHECK_EQ(s.AddRule(NUMBER, "\\d+"), true);
+  CHECK_EQ(s.AddRule(ARROW, "->"), true);
+  CHECK_EQ(s.AddRule(GT, ">"), true);
+  CHECK_EQ(s.AddRule(GE, ">="), true);
+  CHECK_EQ(s.AddRule(EQ, "="), true);
+  CHECK_EQ(s.AddRule(STRING, "\"[^\"]*\""), true);
+  CHECK_EQ(s.AddRule(NUMBER, "("), false);
+
+  const int expected_ids[] = { KEYWORD, IDENT, KEYWORD, KEYWORD, IDENT, EQ,
+                               NUMBER, IDENT, ARROW, IDENT, GE, NUMBER, GT,
+                               NUMBER, STRING };
+  const char* expected_tokens[] = { "message", "Wave", "optional", "string",
+                                    "out", "=", "1", "x", "->", "y", ">=",
+                                    "10", ">", "2", "\"a b\"" };
+  int id;
+  StringPiece token;
+  for (size_t i = 0; i < sizeof(expected_ids) / sizeof(*expected_ids); ++i) {
+    CHECK_EQ(s.NextToken(&id, &token), true);
+    CHECK_EQ(id, expected_ids[i]);
+    CHECK_EQ(token.as_string(), expected_tokens[i]);
+    if (i == 1) CHECK_EQ(s.NextToken(&id, NULL), false);   // "{"
+    if (i == 1) CHECK_EQ(s.Consume("\\{"), true);
+    if (i == 6) CHECK_EQ(s.Consume(";"), true);
+  }
+  CHECK_EQ(s.LineNumber(), 4);
+
+  // Rules added later take part too
+  CHECK_EQ(s.NextToken(&id, &token), false);
+  CHECK_EQ(s.AddRule(99, "[{}]"), true);
+  CHECK_EQ(s.NextToken(&id, &token), true);
+  CHECK_EQ(id, 99);
+  CHECK_EQ(s.Offset(), (int)sizeof(input) - 1);
+  CHECK_EQ(s.NextToken(&id, &token), false);
+
+  // A rule that cannot be joined to the others is refused
+  Scanner named("abc 123");
+  named.SetSkipExpression("\\s+");
+  CHECK_EQ(named.AddRule(IDENT, "(?<w>[a-z]+)"), true);
+  CHECK_EQ(named.AddRule(NUMBER, "(?<w>\\d+)"), false);
+  CHECK_EQ(named.AddRule(NUMBER, "(?<n>\\d+)"), true);
+  CHECK_EQ(named.NextToken(&id, &token), true);
+  CHECK_EQ(id, IDENT);
+  CHECK_EQ(named.NextToken(&id, &token), true);
+  CHECK_EQ(id, NUMBER);
+  CHECK_EQ(token.as_string(), "123");
+
+  // Rules that only match the empty string never make a token
+  Scanner empty("abc");
+  empty.AddRule(1, "x*");
+  CHECK_EQ(empty.NextToken(&id, &token), false);
+  CHECK_EQ(empty.Offset(), 0);
+}
+
+// The offsets a scanner stops at, consuming a byte at a time with
+// "skip" in between
+static vector<int> SkipStops(const string& input, const char* skip,
+                             bool repeat) {
+  Scanner s(input);
+  if (repeat)
+    s.SetSkipExpression(skip);
+  else
+    s.Skip(skip);
+  vector<int> stops;
+  do {
+    stops.push_back(s.Offset());
+  } while (s.Consume("[\\s\\S]"));
+  return stops;
+}
+
+static void TestSkipFastPath() {
+  // Every byte value, and comments cut short at the end
+  string bytes;
+  for (int c = 0; c < 256; ++c)
+    bytes += (char)c;
+  const char* inputs[] = {
+    "  a \t\v\f\r\n b // line\n c /* block\n * / ** */ d # hash\n e",
+    "/* unterminated *",
+    "// no newline",
+    "# no newline",
+    "/*/ x */ /**/ //\n#\n/",
+    "\xa0\x85 x \x1c",
+  };
+  const char* skips[] = {
+    "\\s|//.*\n|/[*](?:\n|.)*?[*]/",
+    "\\s+|#.*\n",
+    "\\s+",
+    "\\s",
+    "/[*](.|\n)*?[*]/|\\s+",
+    "/\\*[\\s\\S]*?\\*/|//.*\n",
+    "/\\*(?:\n|.)*?\\*/",
+  };
+  for (size_t i = 0; i <= sizeof(inputs) / sizeof(*inputs); ++i) {
+    const string input = (i == 0) ? bytes : string(inputs[i - 1]);
+    for (size_t j = 0; j < sizeof(skips) / sizeof(*skips); ++j) {
+      // The same expression in a group is left to pcre
+      const string general = string("(?:") + skips[j] + ")";
+      for (int repeat = 0; repeat < 2; ++repeat) {
+        CHECK_EQ(SkipStops(input, skips[j], repeat != 0) ==
+                 SkipStops(input, general.c_str(), repeat != 0), true);
+      }
+    }
+  }
+
+  // Comments are still saved
+  Scanner s("a /* one */ // two\nb");
+  s.SkipCXXComments();
+  s.set_save_comments(true);
+  CHECK_EQ(s.Consume("a"), true);
+  CHECK_EQ(s.Offset(), 19);
+  vector<StringPiece> comments;
+  s.GetNextComments(&comments);
+  CHECK_EQ(comments.size(), 1);
+  CHECK_EQ(comments[0].as_string(), " /* one */ // two\n");
+}
+
 // TODO: also test scanner and big-comment in a thread with a
 //       small stack size
 
@@ -154,6 +530,11 @@ int main(int argc, char** argv) {
   (void)argv;
   TestScanner();
   TestBigComment();
+  TestLineNumbers();
+  TestExternalInput();
+  TestStreamScanner();
+  TestRules();
+  TestSkipFastPath();
 
   // Done
   printf("OK\n");
@@ -35,9 +35,111 @@
 #endif
 
 #include <iostream>
+#include <string.h>
 #include "pcrecpp_internal.h"
 #include "pcre_stringpiece.h"
 
 std::ostream& operator<<(std::ostream& o, const pcrecpp::StringPiece& piece) {
   return (o << piece.as_string());
 }
+
+namespace pcrecpp {
+
+const int StringPiece::npos;
+
+// Mix one eight-byte word into the hash, as MurmurHash3 does
+static inline unsigned long long HashWord(unsigned long long h,
+                                          unsigned long long w) {
+  w *= 0x87c37b91114253d5ULL;
+  w = (w << 31) | (w >> 33);
+  w *= 0x4cf5ad432745937fULL;
+  h ^= w;
+  h = (h << 27) | (h >> 37);
+  return h * 5 + 0x52dce729;
+}
+
+size_t StringPiece::hash() const {
+  unsigned long long h = 0x9e3779b97f4a7c15ULL ^ (unsigned long long)length_;
+  const char* p = ptr_;
+  int n = length_;
+  for (; n >= 8; p += 8, n -= 8) {
+    unsigned long long w;
+    memcpy(&w, p, sizeof(w));
+    h = HashWord(h, w);
+  }
+  if (n > 0) {
+    unsigned long long w = 0;
+    memcpy(&w, p, n);
+    h = HashWord(h, w);
+  }
+  // Let every input bit affect every output bit
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return static_cast<size_t>(h);
+}
+
+int StringPiece::find(char c, int pos) const {
+  if (pos < 0 || pos >= length_) return npos;
+  const char* found =
+      static_cast<const char*>(memchr(ptr_ + pos, c, length_ - pos));
+  return (found == NULL) ? npos : static_cast<int>(found - ptr_);
+}
+
+int StringPiece::find(const StringPiece& s, int pos) const {
+  if (pos < 0 || pos > length_) return npos;
+  if (s.length_ == 0) return pos;
+  if (s.length_ == 1) return find(s.ptr_[0], pos);
+  // memchr() finds the candidates for the first byte
+  const char* p = ptr_ + pos;
+  const char* last = ptr_ + length_ - s.length_;
+  while (p <= last) {
+    p = static_cast<const char*>(memchr(p, s.ptr_[0], last - p + 1));
+    if (p == NULL) return npos;
+    if (memcmp(p + 1, s.ptr_ + 1, s.length_ - 1) == 0)
+      return static_cast<int>(p - ptr_);
+    ++p;
+  }
+  return npos;
+}
+
+int StringPiece::rfind(char c, int pos) const {
+  if (length_ == 0) return npos;
+  int i = (pos < 0 || pos >= length_) ? length_ - 1 : pos;
+  for (; i >= 0; --i)
+    if (ptr_[i] == c) return i;
+  return npos;
+}
+
+int StringPiece::rfind(const StringPiece& s, int pos) const {
+  if (s.length_ > length_) return npos;
+  int i = length_ - s.length_;
+  if (pos >= 0 && pos < i) i = pos;
+  if (s.length_ == 0) return i;
+  for (; i >= 0; --i) {
+    if (ptr_[i] == s.ptr_[0] &&
+        memcmp(ptr_ + i + 1, s.ptr_ + 1, s.length_ - 1) == 0)
+      return i;
+  }
+  return npos;
+}
+
+int StringPiece::find_first_of(const StringPiece& s, int pos) const {
+  if (pos < 0 || pos >= length_ || s.length_ == 0) return npos;
+  if (s.length_ == 1) return find(s.ptr_[0], pos);
+  // A bitmap of the bytes in "s", tested a byte at a time
+  unsigned char set[256 / 8] = { 0 };
+  for (int i = 0; i < s.length_; ++i) {
+    const unsigned char c = s.ptr_[i];
+    set[c >> 3] |= static_cast<unsigned char>(1 << (c & 7));
+  }
+  for (int i = pos; i < length_; ++i) {
+    const unsigned char c = ptr_[i];
+    if (set[c >> 3] & (1 << (c & 7))) return i;
+  }
+  return npos;
+}
+
+}   // namespace pcrecpp
@@ -39,6 +39,8 @@
 #define _PCRE_STRINGPIECE_H
 
 #include <cstring>
+#include <cstddef>
+#include <functional>  // for std::hash
 #include <string>
 #include <iosfwd>    // for ostream forward-declaration
 
@@ -151,6 +153,25 @@ class PCRECPP_EXP_DEFN StringPiece {
   bool starts_with(const StringPiece& x) const {
     return ((length_ >= x.length_) && (memcmp(ptr_, x.ptr_, x.length_) == 0));
   }
+
+  // Does "this" end with "x"
+  bool ends_with(const StringPiece& x) const {
+    return ((length_ >= x.length_) &&
+            (memcmp(ptr_ + (length_ - x.length_), x.ptr_, x.length_) == 0));
+  }
+
+  // A fast, non-cryptographic hash of the contents.  Values may differ
+  // between platforms and releases, so do not store them.
+  size_t hash() const;
+
+  // Searching, as for std::string.  Positions are byte offsets, and
+  // npos means "not found" (or, for rfind, "from the end").
+  static const int npos = -1;
+  int find(const StringPiece& s, int pos = 0) const;
+  int find(char c, int pos = 0) const;
+  int rfind(const StringPiece& s, int pos = npos) const;
+  int rfind(char c, int pos = npos) const;
+  int find_first_of(const StringPiece& s, int pos = 0) const;
 };
 
 }   // namespace pcrecpp
@@ -173,6 +194,15 @@ template<> struct __type_traits<pcrecpp::StringPiece> {
 };
 #endif
 
+// allow StringPiece to key unordered containers
+namespace std {
+template<> struct hash<pcrecpp::StringPiece> {
+  size_t operator()(const pcrecpp::StringPiece& piece) const {
+    return piece.hash();
+  }
+};
+}   // namespace std
+
 // allow StringPiece to be logged
 PCRECPP_EXP_DECL std::ostream& operator<<(std::ostream& o,
                                           const pcrecpp::StringPiece& piece);
@@ -7,6 +7,8 @@
 
 #include <stdio.h>
 #include <map>
+#include <set>
+#include <unordered_map>
 #include <algorithm>    // for make_pair
 
 #include "pcrecpp.h"
@@ -142,11 +144,88 @@ static void CheckComparisonOperators() {
 #undef CMP_N
 }
 
+static void CheckHash() {
+  // Equal contents hash alike wherever they live
+  string s1("some record name");
+  char buffer[] = "xsome record namex";
+  CHECK(StringPiece(s1).hash() == StringPiece(buffer + 1, 16).hash());
+  CHECK(StringPiece().hash() == StringPiece("").hash());
+
+  // Different contents rarely collide, whatever the length
+  std::set<size_t> hashes;
+  string text;
+  for (int i = 0; i < 1000; i++) {
+    text += (char)('a' + i % 26);
+    hashes.insert(StringPiece(text).hash());
+    hashes.insert(StringPiece(text.data() + 1, i).hash());
+  }
+  CHECK(hashes.size() == 2000);
+
+  typedef std::unordered_map<StringPiece, int> TestMap;
+  TestMap map;
+  map[StringPiece("foo")] = 1;
+  map[StringPiece(s1)] = 2;
+  CHECK(map.size() == 2);
+  CHECK(map.find(StringPiece(buffer + 1, 16))->second == 2);
+  CHECK(map.find("bar") == map.end());
+  CHECK(map.count(StringPiece("foobar", 3)) == 1);
+}
+
+static void CheckFind() {
+  const StringPiece one("x");
+  const int npos = StringPiece::npos;
+  StringPiece s("abcabc xyz");
+  CHECK(s.find('a') == 0);
+  CHECK(s.find('a', 1) == 3);
+  CHECK(s.find('q') == npos);
+  CHECK(s.find('a', 10) == npos);
+  CHECK(s.find("bc") == 1);
+  CHECK(s.find("bc", 2) == 4);
+  CHECK(s.find("abc x") == 3);
+  CHECK(s.find("xyz") == 7);
+  CHECK(s.find("xyzz") == npos);
+  CHECK(s.find("") == 0);
+  CHECK(s.find("", 10) == 10);
+  CHECK(s.find("", 11) == npos);
+  CHECK(s.find(StringPiece("\0", 1)) == npos);
+  CHECK(StringPiece().find("a") == npos);
+  CHECK(StringPiece().find("") == 0);
+
+  CHECK(s.rfind('a') == 3);
+  CHECK(s.rfind('a', 2) == 0);
+  CHECK(s.rfind('z') == 9);
+  CHECK(s.rfind('q') == npos);
+  CHECK(s.rfind("abc") == 3);
+  CHECK(s.rfind("abc", 2) == 0);
+  CHECK(s.rfind("xyz") == 7);
+  CHECK(s.rfind("") == 10);
+  CHECK(s.rfind("", 4) == 4);
+  CHECK(s.rfind("abcabc xyz!") == npos);
+  CHECK(StringPiece().rfind('a') == npos);
+
+  CHECK(s.find_first_of("zyx") == 7);
+  CHECK(s.find_first_of("cb") == 1);
+  CHECK(s.find_first_of("c", 3) == 5);
+  CHECK(s.find_first_of(" \t") == 6);
+  CHECK(s.find_first_of("") == npos);
+  CHECK(s.find_first_of("qrs") == npos);
+  CHECK(s.find_first_of("a", 10) == npos);
+  CHECK(StringPiece("\xff\x80 ").find_first_of("\x80") == 1);
+
+  CHECK(s.starts_with("abc"));
+  CHECK(s.ends_with("xyz"));
+  CHECK(s.ends_with(""));
+  CHECK(!s.ends_with("xy"));
+  CHECK(!one.ends_with("xx"));
+}
+
 int main(int argc, char** argv) {
   (void)argc;
   (void)argv;
   CheckComparisonOperators();
   CheckSTLComparator();
+  CheckHash();
+  CheckFind();
 
   printf("OK\n");
   return 0;
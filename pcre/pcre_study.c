@@ -1428,6 +1428,447 @@ return yield;
 
 
 
+#if defined COMPILE_PCRE8
+/*************************************************
+*     Find a string that every match contains    *
+*************************************************/
+
+/* A run of literal characters, with the bounds of its offset from the start
+of a match. */
+
+typedef struct literal_run {
+  pcre_uint32 length;
+  pcre_uint32 min_offset;
+  pcre_uint32 max_offset;
+  pcre_uchar chars[REQ_STRING_MAX];
+} literal_run;
+
+/* Add to a greatest offset, which stays unset once it has become unset. */
+
+static pcre_uint32
+add_offset(pcre_uint32 offset, pcre_uint32 n)
+{
+if (offset == REQ_OFFSET_UNSET || n >= REQ_OFFSET_UNSET - offset)
+  return REQ_OFFSET_UNSET;
+return offset + n;
+}
+
+/* End the current run, keeping it if it is the longest so far. */
+
+static void
+end_run(literal_run *run, literal_run *best)
+{
+if (run->length > best->length) *best = *run;
+run->length = 0;
+}
+
+/* Append "count" copies of a character that is "length" code units long to
+the current run. A run that is full is ended, and a new one started. */
+
+static void
+add_to_run(literal_run *run, literal_run *best, const pcre_uchar *c,
+  int length, int count, pcre_uint32 min, pcre_uint32 max)
+{
+while (count-- > 0)
+  {
+  if (run->length + length > REQ_STRING_MAX) end_run(run, best);
+  if (run->length == 0)
+    {
+    run->min_offset = min;
+    run->max_offset = max;
+    }
+  memcpy(run->chars + run->length, c, IN_UCHARS(length));
+  run->length += length;
+  min++;
+  max = add_offset(max, 1);
+  }
+}
+
+/* Scan the items at the outer level of a pattern that has no alternatives
+there, looking for the longest run of case-sensitive literal characters that
+every match must contain. Groups with only one alternative that are not
+repeated are scanned as if their contents were at the outer level. The least
+offset of a run is the sum of the minimum lengths of the items before it, and
+the greatest is the sum of their maximum lengths, if they are all bounded. The
+lengths are in characters, so in UTF-8 mode the greatest offset is left unset
+because it is no bound on an offset in bytes.
+
+The scan stops at anything it does not understand, so what it finds is always
+safe to use, though not always the best that could be found. The caller must
+make sure that the pattern does not contain (*ACCEPT), which would let a match
+end before the string.
+
+Arguments:
+  re              compiled pattern block
+  code            pointer to the start of the pattern's code
+  best            where to put the longest run
+
+Returns:          nothing; best->length is zero if there is no run
+*/
+
+static void
+find_required_string(const REAL_PCRE *re, const pcre_uchar *code,
+  literal_run *best)
+{
+BOOL utf = (re->options & PCRE_UTF8) != 0;
+literal_run run;
+pcre_uint32 min = 0;
+pcre_uint32 max = utf? REQ_OFFSET_UNSET : 0;
+register const pcre_uchar *cc = code + 1 + LINK_SIZE;
+
+best->length = 0;
+run.length = 0;
+if (code[GET(code, 1)] == OP_ALT) return;
+
+for (;;)
+  {
+  int d, count, len;
+  pcre_uint32 dmax;
+  pcre_uchar type;
+  register pcre_uchar op = *cc;
+
+  switch (op)
+    {
+    /* Literal characters extend the current run. */
+
+    case OP_CHAR:
+    case OP_PLUS:
+    case OP_MINPLUS:
+    case OP_POSPLUS:
+    len = 1;
+#ifdef SUPPORT_UTF
+    if (utf && HAS_EXTRALEN(cc[1])) len += GET_EXTRALEN(cc[1]);
+#endif
+    add_to_run(&run, best, cc + 1, len, 1, min, max);
+    min++;
+    max = add_offset(max, 1);
+    cc += 1 + len;
+    if (op != OP_CHAR)
+      {
+      end_run(&run, best);
+      max = REQ_OFFSET_UNSET;
+      }
+    break;
+
+    case OP_EXACT:
+    len = 1;
+#ifdef SUPPORT_UTF
+    if (utf && HAS_EXTRALEN(cc[1 + IMM2_SIZE]))
+      len += GET_EXTRALEN(cc[1 + IMM2_SIZE]);
+#endif
+    d = GET2(cc, 1);
+    add_to_run(&run, best, cc + 1 + IMM2_SIZE, len, d, min, max);
+    min += d;
+    max = add_offset(max, d);
+    cc += 1 + IMM2_SIZE + len;
+    break;
+
+    /* Things that match no characters leave the run as it is. */
+
+    case OP_ASSERT:
+    case OP_ASSERT_NOT:
+    case OP_ASSERTBACK:
+    case OP_ASSERTBACK_NOT:
+    do cc += GET(cc, 1); while (*cc == OP_ALT);
+    cc += 1 + LINK_SIZE;
+    break;
+
+    case OP_SOD:
+    case OP_SOM:
+    case OP_EOD:
+    case OP_EODN:
+    case OP_CIRC:
+    case OP_CIRCM:
+    case OP_DOLL:
+    case OP_DOLLM:
+    case OP_NOT_WORD_BOUNDARY:
+    case OP_WORD_BOUNDARY:
+    case OP_SET_SOM:
+    case OP_KET:
+    cc += PRIV(OP_lengths)[op];
+    break;
+
+    /* A group with one alternative that is not repeated is scanned as part of
+    the current sequence. Any other group ends the run. */
+
+    case OP_BRA:
+    case OP_CBRA:
+    case OP_ONCE:
+    case OP_ONCE_NC:
+    if (cc[GET(cc, 1)] == OP_KET)
+      {
+      cc += 1 + LINK_SIZE;
+      if (op == OP_CBRA) cc += IMM2_SIZE;
+      break;
+      }
+    /* Fall through */
+
+    case OP_SBRA:
+    case OP_SCBRA:
+    case OP_BRAPOS:
+    case OP_SBRAPOS:
+    case OP_CBRAPOS:
+    case OP_SCBRAPOS:
+    count = 0;
+    d = find_minlength(re, cc, code, re->options, NULL, &count);
+    if (d < 0) goto END_SCAN;
+    end_run(&run, best);
+    min += d;
+    max = REQ_OFFSET_UNSET;
+    do cc += GET(cc, 1); while (*cc == OP_ALT);
+    cc += 1 + LINK_SIZE;
+    break;
+
+    case OP_COND:
+    case OP_SCOND:
+    end_run(&run, best);
+    max = REQ_OFFSET_UNSET;
+    do cc += GET(cc, 1); while (*cc == OP_ALT);
+    cc += 1 + LINK_SIZE;
+    break;
+
+    case OP_BRAZERO:
+    case OP_BRAMINZERO:
+    case OP_BRAPOSZERO:
+    case OP_SKIPZERO:
+    end_run(&run, best);
+    max = REQ_OFFSET_UNSET;
+    cc += PRIV(OP_lengths)[op];
+    do cc += GET(cc, 1); while (*cc == OP_ALT);
+    cc += 1 + LINK_SIZE;
+    break;
+
+    /* Other single characters, and repeated characters, end the run. */
+
+    case OP_CHARI:
+    case OP_NOT:
+    case OP_NOTI:
+    d = 1;
+    dmax = 1;
+    goto CHAR_ITEM;
+
+    case OP_PLUSI:
+    case OP_MINPLUSI:
+    case OP_POSPLUSI:
+    case OP_NOTPLUS:
+    case OP_NOTPLUSI:
+    case OP_NOTMINPLUS:
+    case OP_NOTMINPLUSI:
+    case OP_NOTPOSPLUS:
+    case OP_NOTPOSPLUSI:
+    d = 1;
+    dmax = REQ_OFFSET_UNSET;
+    goto CHAR_ITEM;
+
+    case OP_EXACTI:
+    case OP_NOTEXACT:
+    case OP_NOTEXACTI:
+    d = GET2(cc, 1);
+    dmax = d;
+    goto CHAR_ITEM;
+
+    case OP_UPTO:
+    case OP_UPTOI:
+    case OP_NOTUPTO:
+    case OP_NOTUPTOI:
+    case OP_MINUPTO:
+    case OP_MINUPTOI:
+    case OP_NOTMINUPTO:
+    case OP_NOTMINUPTOI:
+    case OP_POSUPTO:
+    case OP_POSUPTOI:
+    case OP_NOTPOSUPTO:
+    case OP_NOTPOSUPTOI:
+    d = 0;
+    dmax = GET2(cc, 1);
+    goto CHAR_ITEM;
+
+    case OP_QUERY:
+    case OP_QUERYI:
+    case OP_NOTQUERY:
+    case OP_NOTQUERYI:
+    case OP_MINQUERY:
+    case OP_MINQUERYI:
+    case OP_NOTMINQUERY:
+    case OP_NOTMINQUERYI:
+    case OP_POSQUERY:
+    case OP_POSQUERYI:
+    case OP_NOTPOSQUERY:
+    case OP_NOTPOSQUERYI:
+    d = 0;
+    dmax = 1;
+    goto CHAR_ITEM;
+
+    case OP_STAR:
+    case OP_STARI:
+    case OP_NOTSTAR:
+    case OP_NOTSTARI:
+    case OP_MINSTAR:
+    case OP_MINSTARI:
+    case OP_NOTMINSTAR:
+    case OP_NOTMINSTARI:
+    case OP_POSSTAR:
+    case OP_POSSTARI:
+    case OP_NOTPOSSTAR:
+    case OP_NOTPOSSTARI:
+    d = 0;
+    dmax = REQ_OFFSET_UNSET;
+
+    CHAR_ITEM:
+    cc += PRIV(OP_lengths)[op];
+#ifdef SUPPORT_UTF
+    if (utf && HAS_EXTRALEN(cc[-1])) cc += GET_EXTRALEN(cc[-1]);
+#endif
+    end_run(&run, best);
+    min += d;
+    max = (dmax == REQ_OFFSET_UNSET)? dmax : add_offset(max, dmax);
+    break;
+
+    case OP_PROP:
+    case OP_NOTPROP:
+    cc += 2;
+    /* Fall through */
+
+    case OP_NOT_DIGIT:
+    case OP_DIGIT:
+    case OP_NOT_WHITESPACE:
+    case OP_WHITESPACE:
+    case OP_NOT_WORDCHAR:
+    case OP_WORDCHAR:
+    case OP_ANY:
+    case OP_ALLANY:
+    case OP_HSPACE:
+    case OP_NOT_HSPACE:
+    case OP_VSPACE:
+    case OP_NOT_VSPACE:
+    end_run(&run, best);
+    min++;
+    max = add_offset(max, 1);
+    cc++;
+    break;
+
+    /* These match one character, or a sequence of them. */
+
+    case OP_EXTUNI:
+    case OP_ANYNL:
+    end_run(&run, best);
+    min++;
+    max = REQ_OFFSET_UNSET;
+    cc++;
+    break;
+
+    /* Repeated character types have extra parameters for \p and \P. */
+
+    case OP_TYPESTAR:
+    case OP_TYPEMINSTAR:
+    case OP_TYPEPOSSTAR:
+    case OP_TYPEPLUS:
+    case OP_TYPEMINPLUS:
+    case OP_TYPEPOSPLUS:
+    case OP_TYPEQUERY:
+    case OP_TYPEMINQUERY:
+    case OP_TYPEPOSQUERY:
+    type = cc[1];
+    d = (op == OP_TYPEPLUS || op == OP_TYPEMINPLUS || op == OP_TYPEPOSPLUS)?
+      1 : 0;
+    dmax = (op == OP_TYPEQUERY || op == OP_TYPEMINQUERY ||
+      op == OP_TYPEPOSQUERY)? 1 : REQ_OFFSET_UNSET;
+    goto TYPE_ITEM;
+
+    case OP_TYPEUPTO:
+    case OP_TYPEMINUPTO:
+    case OP_TYPEPOSUPTO:
+    case OP_TYPEEXACT:
+    type = cc[1 + IMM2_SIZE];
+    d = (op == OP_TYPEEXACT)? GET2(cc, 1) : 0;
+    dmax = GET2(cc, 1);
+
+    TYPE_ITEM:
+    cc += PRIV(OP_lengths)[op];
+    if (type == OP_PROP || type == OP_NOTPROP) cc += 2;
+    if (type == OP_EXTUNI || type == OP_ANYNL) dmax = REQ_OFFSET_UNSET;
+    end_run(&run, best);
+    min += d;
+    max = (dmax == REQ_OFFSET_UNSET)? dmax : add_offset(max, dmax);
+    break;
+
+    /* Classes may be followed by a quantifier. */
+
+    case OP_CLASS:
+    case OP_NCLASS:
+#if defined SUPPORT_UTF || defined COMPILE_PCRE16 || defined COMPILE_PCRE32
+    case OP_XCLASS:
+    if (op == OP_XCLASS)
+      cc += GET(cc, 1);
+    else
+      cc += PRIV(OP_lengths)[OP_CLASS];
+#else
+    cc += PRIV(OP_lengths)[OP_CLASS];
+#endif
+
+    switch (*cc)
+      {
+      case OP_CRSTAR:
+      case OP_CRMINSTAR:
+      case OP_CRPOSSTAR:
+      d = 0;
+      dmax = REQ_OFFSET_UNSET;
+      cc++;
+      break;
+
+      case OP_CRPLUS:
+      case OP_CRMINPLUS:
+      case OP_CRPOSPLUS:
+      d = 1;
+      dmax = REQ_OFFSET_UNSET;
+      cc++;
+      break;
+
+      case OP_CRQUERY:
+      case OP_CRMINQUERY:
+      case OP_CRPOSQUERY:
+      d = 0;
+      dmax = 1;
+      cc++;
+      break;
+
+      case OP_CRRANGE:
+      case OP_CRMINRANGE:
+      case OP_CRPOSRANGE:
+      d = GET2(cc, 1);
+      dmax = GET2(cc, 1 + IMM2_SIZE);
+      if (dmax == 0) dmax = REQ_OFFSET_UNSET;
+      cc += 1 + 2 * IMM2_SIZE;
+      break;
+
+      default:
+      d = 1;
+      dmax = 1;
+      break;
+      }
+    end_run(&run, best);
+    min += d;
+    max = (dmax == REQ_OFFSET_UNSET)? dmax : add_offset(max, dmax);
+    break;
+
+    /* Anything else, including the end of the pattern, back references,
+    recursion, and backtracking verbs, ends the scan. So does a callout,
+    because skipping places where the string is not found would hide callouts
+    that come before it. */
+
+    default:
+    goto END_SCAN;
+    }
+  }
+
+END_SCAN:
+end_run(&run, best);
+}
+#endif  /* COMPILE_PCRE8 */
+
+
+
+
 /*************************************************
 *          Study a compiled expression           *
 *************************************************/
@@ -1462,6 +1903,9 @@ int min;
 int count = 0;
 BOOL bits_set = FALSE;
 pcre_uint8 start_bits[32];
+#if defined COMPILE_PCRE8
+literal_run req_string;
+#endif
 PUBL(extra) *extra = NULL;
 pcre_study_data *study;
 const pcre_uint8 *tables;
@@ -1553,6 +1997,16 @@ switch(min = find_minlength(re, code, code, re->options, NULL, &count))
   default: break;
   }
 
+/* Find a string that every match must contain. This cannot be done if the
+pattern contains (*ACCEPT); the compiler does not set a required character in
+that case, so only patterns that have one are scanned. */
+
+#if defined COMPILE_PCRE8
+req_string.length = 0;
+if ((re->flags & PCRE_REQCHSET) != 0)
+  find_required_string(re, code, &req_string);
+#endif
+
 /* If a set of starting bytes has been identified, or if the minimum length is
 greater than zero, or if JIT optimization has been requested, or if
 PCRE_STUDY_EXTRA_NEEDED is set, get a pcre[16]_extra block and a
@@ -1619,6 +2073,24 @@ if (bits_set || min > 0 || (options & (
     }
   else study->minlength = 0;
 
+  /* A required string of a single character is no better than the required
+  character that the compiler has already found. */
+
+  study->req_min_offset = 0;
+  study->req_max_offset = REQ_OFFSET_UNSET;
+  study->req_length = 0;
+  memset(study->req_string, 0, sizeof(study->req_string));
+#if defined COMPILE_PCRE8
+  if (req_string.length >= 2)
+    {
+    study->flags |= PCRE_STUDY_REQSTR;
+    study->req_min_offset = req_string.min_offset;
+    study->req_max_offset = req_string.max_offset;
+    study->req_length = req_string.length;
+    memcpy(study->req_string, req_string.chars, req_string.length);
+    }
+#endif
+
   /* If JIT support was compiled and requested, attempt the JIT compilation.
   If no starting bytes were found, and the minimum length is zero, and JIT
   compilation fails, abandon the extra block and return NULL, unless
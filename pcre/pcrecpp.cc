@@ -37,11 +37,16 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <limits.h>      /* for SHRT_MIN, USHRT_MAX, etc */
+#include <float.h>       /* for FLT_EVAL_METHOD */
 #include <string.h>      /* for memcpy */
 #include <assert.h>
 #include <errno.h>
 #include <string>
 #include <algorithm>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include "pcrecpp_internal.h"
 #include "pcre.h"
@@ -80,6 +85,298 @@ static const string empty_string;
 // If the user doesn't ask for any options, we just use this one
 static RE_Options default_options;
 
+// Size limits for the per-thread JIT stack
+static const int kJitStackStart = 32 * 1024;
+static const int kJitStackMax = 512 * 1024;
+
+// Size limits (in ints) for the per-thread DFA workspace.  pcretest
+// uses 1000 ints by default.
+static const int kDfaWorkspaceStart = 1000;
+static const int kDfaWorkspaceInitialMax = 64 * 1024;
+static const int kDfaWorkspaceMax = 4 * 1024 * 1024;
+
+// Each thread that runs a JIT compiled expression gets its own JIT
+// stack, allocated on first use and released when the thread exits.
+// A pcre_jit_stack must never be shared by concurrent matches, and
+// RE objects may be used by several threads at once.
+namespace {
+class ThreadJitStack {
+ public:
+  ThreadJitStack() : stack_(NULL) { }
+  ~ThreadJitStack() {
+    if (stack_ != NULL) pcre_jit_stack_free(stack_);
+  }
+  // Returns NULL if the stack cannot be allocated, in which case pcre
+  // falls back to a small stack on the machine stack.
+  pcre_jit_stack* get() {
+    if (stack_ == NULL) stack_ = pcre_jit_stack_alloc(kJitStackStart,
+                                                      kJitStackMax);
+    return stack_;
+  }
+ private:
+  pcre_jit_stack* stack_;
+};
+
+thread_local ThreadJitStack thread_jit_stack;
+
+// Workspace for pcre_dfa_exec(), likewise private to each thread.  It
+// only ever grows, to the largest size any pattern has needed.
+thread_local std::vector<int> thread_dfa_workspace;
+}   // namespace
+
+// Callback handed to pcre_assign_jit_stack(), so that JIT matches run
+// through pcre_exec() use the calling thread's stack as well.
+static pcre_jit_stack* GetThreadJitStack(void*) {
+  return thread_jit_stack.get();
+}
+
+struct RE::Program {
+  pcre*         re;
+  pcre_extra*   extra;          // Study data (or NULL)
+  bool          anchored;       // Compiled with PCRE_ANCHORED
+  int           capture_count;  // PCRE_INFO_CAPTURECOUNT
+  int           backref_max;    // PCRE_INFO_BACKREFMAX
+  int           dfa_workspace;  // Starting pcre_dfa_exec() workspace size
+  // Set once pcre_dfa_exec() has said that the pattern is beyond it, so
+  // that later matches go straight to pcre_exec()
+  mutable std::atomic<bool> dfa_unsupported;
+  bool          is_literal;     // The pattern matches just "literal"
+  string        literal;
+  // Named group numbers, lowest first, keyed by the names in the
+  // pattern's name table.  (?J) and (?| allow several per name.
+  std::unordered_map<StringPiece, std::vector<int> > group_index;
+
+  // Bookkeeping for ProgramCache.  The reference count itself lives in
+  // the compiled pattern and is maintained with pcre_refcount(), under
+  // the lock of shard "shard".
+  size_t        shard;
+  size_t        bytes;          // Memory charged to the cache
+  const string* key;            // Key in the cache, or NULL if not cached
+  std::list<Program*>::iterator lru;
+};
+
+/***** The process-wide cache of compiled programs *****/
+
+// Default limit on the memory used by the cache
+static const size_t kDefaultCacheLimit = 8 << 20;
+
+// Programs map to one of kCacheShards independently locked shards, so
+// that threads constructing unrelated REs do not contend.
+static const size_t kCacheShards = 16;
+
+class ProgramCache {
+ public:
+  typedef RE::Program Program;
+
+  // The cache is never destroyed, so that static REs can still release
+  // their programs while the process exits.
+  static ProgramCache* Get() {
+    static ProgramCache* cache = new ProgramCache;
+    return cache;
+  }
+
+  static size_t ShardFor(const string& key) {
+    return std::hash<string>()(key) % kCacheShards;
+  }
+
+  // Return the program cached under "key" with a new reference, or
+  // NULL if there is none.
+  Program* Lookup(const string& key);
+
+  // Offer "prog", which holds one reference and was compiled for
+  // "key", to the cache.  Returns the program the caller should use: a
+  // program another thread cached first (in which case "prog" is
+  // released), or "prog" itself.
+  Program* Insert(const string& key, Program* prog);
+
+  // Add a reference to "prog".  Fails if the count is saturated.
+  bool Ref(Program* prog);
+
+  // Drop a reference to "prog", freeing it when none are left.
+  void Unref(Program* prog);
+
+  void SetLimit(size_t bytes);
+  size_t limit() const { return limit_.load(); }
+  void Clear();
+  RE_CacheStats Stats();
+
+ private:
+  struct Shard {
+    std::mutex                          mu;
+    std::unordered_map<string, Program*> table;
+    std::list<Program*>                 lru;    // Most recently used first
+    size_t                              bytes;
+    Shard() : bytes(0) { }
+  };
+
+  ProgramCache() : limit_(kDefaultCacheLimit), hits_(0), misses_(0),
+                   evictions_(0) { }
+
+  // Evict entries from "shard" until it uses at most "bytes".  Programs
+  // that lose their last reference are appended to "dead" and must be
+  // freed once the lock is released.  REQUIRES shard->mu held.
+  void EvictLocked(Shard* shard, size_t bytes, std::vector<Program*>* dead);
+
+  static void Free(Program* prog);
+  static void FreeAll(const std::vector<Program*>& dead);
+
+  Shard                         shards_[kCacheShards];
+  std::atomic<size_t>           limit_;
+  std::atomic<unsigned long>    hits_;
+  std::atomic<unsigned long>    misses_;
+  std::atomic<unsigned long>    evictions_;
+};
+
+// pcre_refcount() keeps a 16-bit count, and saturates rather than wraps
+static const int kMaxRefcount = 65535;
+
+ProgramCache::Program* ProgramCache::Lookup(const string& key) {
+  Shard* shard = &shards_[ShardFor(key)];
+  std::lock_guard<std::mutex> l(shard->mu);
+  std::unordered_map<string, Program*>::iterator it = shard->table.find(key);
+  if (it == shard->table.end()) {
+    ++misses_;
+    return NULL;
+  }
+  Program* prog = it->second;
+  if (pcre_refcount(prog->re, 0) >= kMaxRefcount) {
+    ++misses_;
+    return NULL;
+  }
+  pcre_refcount(prog->re, 1);
+  shard->lru.splice(shard->lru.begin(), shard->lru, prog->lru);
+  ++hits_;
+  return prog;
+}
+
+ProgramCache::Program* ProgramCache::Insert(const string& key,
+                                            Program* prog) {
+  size_t shard_limit = limit_.load() / kCacheShards;
+  if (shard_limit == 0 || prog->bytes > shard_limit) return prog;
+
+  Shard* shard = &shards_[prog->shard];
+  std::vector<Program*> dead;
+  Program* result = prog;
+  {
+    std::lock_guard<std::mutex> l(shard->mu);
+    std::pair<std::unordered_map<string, Program*>::iterator, bool> ins =
+        shard->table.insert(std::make_pair(key, prog));
+    if (!ins.second) {
+      // Somebody else compiled the same program while we did.
+      Program* existing = ins.first->second;
+      if (pcre_refcount(existing->re, 0) < kMaxRefcount) {
+        pcre_refcount(existing->re, 1);
+        if (pcre_refcount(prog->re, -1) == 0) dead.push_back(prog);
+        result = existing;
+      }
+    } else {
+      pcre_refcount(prog->re, 1);               // The cache's reference
+      prog->key = &ins.first->first;
+      shard->lru.push_front(prog);
+      prog->lru = shard->lru.begin();
+      shard->bytes += prog->bytes;
+      EvictLocked(shard, shard_limit, &dead);
+    }
+  }
+  FreeAll(dead);
+  return result;
+}
+
+bool ProgramCache::Ref(Program* prog) {
+  std::lock_guard<std::mutex> l(shards_[prog->shard].mu);
+  if (pcre_refcount(prog->re, 0) >= kMaxRefcount) return false;
+  pcre_refcount(prog->re, 1);
+  return true;
+}
+
+void ProgramCache::Unref(Program* prog) {
+  if (prog == NULL) return;
+  int count;
+  {
+    std::lock_guard<std::mutex> l(shards_[prog->shard].mu);
+    count = pcre_refcount(prog->re, -1);
+  }
+  if (count == 0) Free(prog);
+}
+
+void ProgramCache::EvictLocked(Shard* shard, size_t bytes,
+                               std::vector<Program*>* dead) {
+  while (shard->bytes > bytes && !shard->lru.empty()) {
+    Program* victim = shard->lru.back();
+    shard->lru.pop_back();
+    shard->bytes -= victim->bytes;
+    const string* key = victim->key;
+    victim->key = NULL;
+    shard->table.erase(shard->table.find(*key));
+    ++evictions_;
+    if (pcre_refcount(victim->re, -1) == 0) dead->push_back(victim);
+  }
+}
+
+void ProgramCache::SetLimit(size_t bytes) {
+  limit_ = bytes;
+  for (size_t i = 0; i < kCacheShards; i++) {
+    std::vector<Program*> dead;
+    {
+      std::lock_guard<std::mutex> l(shards_[i].mu);
+      EvictLocked(&shards_[i], bytes / kCacheShards, &dead);
+    }
+    FreeAll(dead);
+  }
+}
+
+void ProgramCache::Clear() {
+  for (size_t i = 0; i < kCacheShards; i++) {
+    std::vector<Program*> dead;
+    {
+      std::lock_guard<std::mutex> l(shards_[i].mu);
+      EvictLocked(&shards_[i], 0, &dead);
+    }
+    FreeAll(dead);
+  }
+}
+
+RE_CacheStats ProgramCache::Stats() {
+  RE_CacheStats stats;
+  stats.hits = hits_;
+  stats.misses = misses_;
+  stats.evictions = evictions_;
+  stats.entries = 0;
+  stats.bytes = 0;
+  for (size_t i = 0; i < kCacheShards; i++) {
+    std::lock_guard<std::mutex> l(shards_[i].mu);
+    stats.entries += shards_[i].table.size();
+    stats.bytes += shards_[i].bytes;
+  }
+  return stats;
+}
+
+void ProgramCache::Free(Program* prog) {
+  if (prog->extra != NULL)      pcre_free_study(prog->extra);
+  (*pcre_free)(prog->re);
+  delete prog;
+}
+
+void ProgramCache::FreeAll(const std::vector<Program*>& dead) {
+  for (size_t i = 0; i < dead.size(); i++) Free(dead[i]);
+}
+
+/*static*/ void RE::SetCacheLimit(size_t bytes) {
+  ProgramCache::Get()->SetLimit(bytes);
+}
+
+/*static*/ size_t RE::CacheLimit() {
+  return ProgramCache::Get()->limit();
+}
+
+/*static*/ void RE::ClearCache() {
+  ProgramCache::Get()->Clear();
+}
+
+/*static*/ RE_CacheStats RE::GetCacheStats() {
+  return ProgramCache::Get()->Stats();
+}
+
 void RE::Init(const string& pat, const RE_Options* options) {
   pattern_ = pat;
   if (options == NULL) {
@@ -88,18 +385,59 @@ void RE::Init(const string& pat, const RE_Options* options) {
     options_ = *options;
   }
   error_ = &empty_string;
-  re_full_ = NULL;
-  re_partial_ = NULL;
+  full_ = NULL;
+  start_ = NULL;
 
-  re_partial_ = Compile(UNANCHORED);
-  if (re_partial_ != NULL) {
-    re_full_ = Compile(ANCHOR_BOTH);
+  // Only the unanchored form is compiled up front.  Many expressions
+  // are only ever used for PartialMatch() or Consume(), so the anchored
+  // forms wait until a match needs them (see GetProgram()).
+  const char* compile_error;
+  partial_ = Compile(UNANCHORED, &compile_error);
+  if (partial_ == NULL) {
+    error_ = new string(compile_error);
   }
 }
 
+void RE::Copy(const RE& re) {
+  pattern_ = re.pattern_;
+  options_ = re.options_;
+  if (re.error_ == &empty_string) {
+    error_ = &empty_string;
+  } else {
+    error_ = new string(*re.error_);
+  }
+
+  // Take our own references to whatever "re" has compiled so far.  A
+  // program whose reference count is saturated is compiled afresh.
+  ProgramCache* cache = ProgramCache::Get();
+  partial_ = re.partial_;
+  if (partial_ != NULL && !cache->Ref(partial_)) {
+    const char* compile_error;
+    partial_ = Compile(UNANCHORED, &compile_error);
+  }
+  Program* full = re.full_.load(std::memory_order_acquire);
+  full_ = (full != NULL && cache->Ref(full)) ? full : NULL;
+  Program* start = re.start_.load(std::memory_order_acquire);
+  start_ = (start != NULL && cache->Ref(start)) ? start : NULL;
+}
+
+void RE::Move(RE* re) noexcept {
+  pattern_.swap(re->pattern_);
+  re->pattern_.clear();
+  options_ = re->options_;
+  error_ = re->error_;
+  partial_ = re->partial_;
+  full_ = re->full_.exchange(NULL);
+  start_ = re->start_.exchange(NULL);
+  re->error_ = &empty_string;
+  re->partial_ = NULL;
+}
+
 void RE::Cleanup() {
-  if (re_full_ != NULL)         (*pcre_free)(re_full_);
-  if (re_partial_ != NULL)      (*pcre_free)(re_partial_);
+  ProgramCache* cache = ProgramCache::Get();
+  cache->Unref(full_.load());
+  cache->Unref(start_.load());
+  cache->Unref(partial_);
   if (error_ != &empty_string)  delete error_;
 }
 
@@ -109,7 +447,65 @@ RE::~RE() {
 }
 
 
-pcre* RE::Compile(Anchor anchor) {
+RE::Program* RE::Compile(Anchor anchor, const char** error) const {
+  // Everything that changes the compiled program goes into the key.
+  // The match limits are applied at match time, so they are left out.
+  char flags[64];
+  snprintf(flags, sizeof(flags), "%d:%d:%d:%d:", static_cast<int>(anchor),
+           options_.all_options(), options_.study(), options_.jit());
+  string key(flags);
+  key += pattern_;
+
+  ProgramCache* cache = ProgramCache::Get();
+  Program* prog = cache->Lookup(key);
+  if (prog != NULL) return prog;
+
+  prog = CompileProgram(anchor, error);
+  if (prog == NULL) return NULL;
+  prog->shard = ProgramCache::ShardFor(key);
+  prog->bytes += key.size();
+  return cache->Insert(key, prog);
+}
+
+// Options that do not change what a pattern without metacharacters
+// matches
+static const int kLiteralOptions =
+    PCRE_MULTILINE | PCRE_DOTALL | PCRE_EXTENDED | PCRE_DOLLAR_ENDONLY |
+    PCRE_EXTRA | PCRE_UNGREEDY | PCRE_UTF8 | PCRE_NO_AUTO_CAPTURE |
+    PCRE_NO_UTF8_CHECK;
+
+// If "pattern" (compiled with "options") matches exactly one fixed,
+// non-empty string, store that string in "*literal" and return true.
+// Escaped punctuation, as QuoteMeta() produces, counts as literal.
+// Anything doubtful is reported as not literal.
+static bool LiteralPattern(const char* pattern, int options,
+                           string* literal) {
+  if ((options & ~kLiteralOptions) != 0) return false;
+  const bool extended = (options & PCRE_EXTENDED) != 0;
+  literal->clear();
+  for (const char* s = pattern; *s != '\0'; s++) {
+    const unsigned char c = *s;
+    if (c == '\\') {
+      const unsigned char next = s[1];
+      if (next == '0' && !(s[2] >= '0' && s[2] <= '7')) {
+        *literal += '\0';
+      } else if (next >= 0x80 || next == '\0' || isalnum(next)) {
+        return false;       // Escape sequences, or a dangling backslash
+      } else {
+        *literal += next;
+      }
+      s++;
+    } else if (strchr("^$.[|()?*+{", c) != NULL ||
+               (extended && (c == '#' || isspace(c)))) {
+      return false;
+    } else {
+      *literal += c;
+    }
+  }
+  return !literal->empty();
+}
+
+RE::Program* RE::CompileProgram(Anchor anchor, const char** error) const {
   // First, convert RE_Options into pcre options
   int pcre_options = 0;
   pcre_options = options_.all_options();
@@ -125,13 +521,18 @@ pcre* RE::Compile(Anchor anchor) {
   //                    a pcre anchored match.
   //    ANCHOR_BOTH     Tack a "\z" to the end of the original pattern
   //                    and use a pcre anchored match.
+  //
+  // When JIT compiling, the anchored forms are also compiled with
+  // PCRE_ANCHORED, because pcre_jit_exec() cannot anchor at runtime.
+  bool anchored = (anchor != UNANCHORED && options_.jit());
+  if (anchored)
+    pcre_options |= PCRE_ANCHORED;
 
-  const char* compile_error;
   int eoffset;
   pcre* re;
   if (anchor != ANCHOR_BOTH) {
     re = pcre_compile(pattern_.c_str(), pcre_options,
-                      &compile_error, &eoffset, NULL);
+                      error, &eoffset, NULL);
   } else {
     // Tack a '\z' at the end of RE.  Parenthesize it first so that
     // the '\z' applies to all top-level alternatives in the regexp.
@@ -139,12 +540,121 @@ pcre* RE::Compile(Anchor anchor) {
     wrapped += pattern_;
     wrapped += ")\\z";
     re = pcre_compile(wrapped.c_str(), pcre_options,
-                      &compile_error, &eoffset, NULL);
+                      error, &eoffset, NULL);
   }
   if (re == NULL) {
-    if (error_ == &empty_string) error_ = new string(compile_error);
+    return NULL;
+  }
+
+  Program* prog = new Program;
+  prog->re = re;
+  prog->extra = Study(re);
+  prog->anchored = anchored;
+  prog->dfa_unsupported.store(false, std::memory_order_relaxed);
+  prog->is_literal = LiteralPattern(pattern_.c_str(), options_.all_options(),
+                                    &prog->literal);
+  prog->shard = 0;
+  prog->key = NULL;
+  pcre_refcount(re, 1);
+  pcre_fullinfo(re, NULL, PCRE_INFO_CAPTURECOUNT, &prog->capture_count);
+  pcre_fullinfo(re, NULL, PCRE_INFO_BACKREFMAX, &prog->backref_max);
+
+  // Entries in the name table are the group number, high byte first,
+  // then the NUL-terminated name
+  int name_count = 0, name_entry_size = 0;
+  const unsigned char* name_table = NULL;
+  pcre_fullinfo(re, NULL, PCRE_INFO_NAMECOUNT, &name_count);
+  pcre_fullinfo(re, NULL, PCRE_INFO_NAMEENTRYSIZE, &name_entry_size);
+  pcre_fullinfo(re, NULL, PCRE_INFO_NAMETABLE, &name_table);
+  for (int i = 0; i < name_count; i++) {
+    const unsigned char* entry = name_table + i * name_entry_size;
+    const int number = (entry[0] << 8) | entry[1];
+    std::vector<int>& numbers =
+        prog->group_index[reinterpret_cast<const char*>(entry + 2)];
+    numbers.insert(std::lower_bound(numbers.begin(), numbers.end(), number),
+                   number);
+  }
+
+  size_t size = 0;
+  pcre_fullinfo(re, NULL, PCRE_INFO_SIZE, &size);
+  prog->bytes = sizeof(Program) + size +
+                name_count * (name_entry_size + 4 * sizeof(void*));
+  // Each opcode may be an active DFA state, which takes three ints in
+  // each of the current and next state lists.  Few patterns have most
+  // of their opcodes active at once, so start with room for one list.
+  prog->dfa_workspace = static_cast<int>(
+      std::min<size_t>(std::max<size_t>(3 * size, kDfaWorkspaceStart),
+                       kDfaWorkspaceInitialMax));
+  if (prog->extra != NULL) {
+    size = 0;
+    pcre_fullinfo(re, prog->extra, PCRE_INFO_STUDYSIZE, &size);
+    prog->bytes += size;
+    size = 0;
+    pcre_fullinfo(re, prog->extra, PCRE_INFO_JITSIZE, &size);
+    prog->bytes += size;
+  }
+  return prog;
+}
+
+pcre_extra* RE::Study(pcre* re) const {
+  if (!options_.study()) return NULL;
+
+  const char* study_error;
+  int study_options = options_.jit() ? PCRE_STUDY_JIT_COMPILE : 0;
+  pcre_extra* extra = pcre_study(re, study_options, &study_error);
+  // A failed study is not fatal: we just match without the extra data.
+  if (extra != NULL && extra->executable_jit != NULL)
+    pcre_assign_jit_stack(extra, GetThreadJitStack, NULL);
+  return extra;
+}
+
+// Returns true if "pattern" already ends in an unescaped "\z" that
+// applies to the whole expression, so that anchoring its unanchored
+// form at the start gives a full match.  We are conservative: any
+// alternation, comment, \Q quoting or \c escape disqualifies it.
+static bool EndsWithEndAnchor(const string& pattern) {
+  size_t n = pattern.size();
+  if (n < 2 || pattern[n-1] != 'z' || pattern[n-2] != '\\') return false;
+  size_t backslashes = 0;
+  for (size_t i = n - 1; i > 0 && pattern[i-1] == '\\'; i--)
+    backslashes++;
+  if (backslashes % 2 == 0) return false;       // "\\z" is a literal 'z'
+  return (pattern.find_first_of("|#") == string::npos &&
+          pattern.find("\\Q") == string::npos &&
+          pattern.find("\\c") == string::npos);
+}
+
+const RE::Program* RE::GetProgram(Anchor anchor) const {
+  if (partial_ == NULL || anchor == UNANCHORED) return partial_;
+  // Without JIT, anchoring at the start is done at match time.
+  if (anchor == ANCHOR_START && !options_.jit()) return partial_;
+
+  std::atomic<Program*>& slot = (anchor == ANCHOR_BOTH) ? full_ : start_;
+  Program* prog = slot.load(std::memory_order_acquire);
+  if (prog != NULL) return prog;
+
+  ProgramCache* cache = ProgramCache::Get();
+  if (anchor == ANCHOR_BOTH && EndsWithEndAnchor(pattern_)) {
+    // The pattern already ends in "\z": share the start-anchored form.
+    prog = const_cast<Program*>(GetProgram(ANCHOR_START));
+    if (prog != NULL && !cache->Ref(prog)) prog = NULL;
+  }
+  if (prog == NULL) {
+    const char* compile_error;
+    prog = Compile(anchor, &compile_error);
+    if (prog == NULL) return NULL;
   }
-  return re;
+
+  // Several threads may race to compile the same form.  The first one
+  // to publish its program wins; the others drop theirs.
+  Program* expected = NULL;
+  if (!slot.compare_exchange_strong(expected, prog,
+                                    std::memory_order_acq_rel,
+                                    std::memory_order_acquire)) {
+    cache->Unref(prog);
+    return expected;
+  }
+  return prog;
 }
 
 /***** Matching interfaces *****/
@@ -186,9 +696,13 @@ bool RE::FullMatch(const StringPiece& text,
   if (&ptr16 == &no_arg) { goto done; } args[n++] = &ptr16;
  done:
 
-  int consumed;
   int vec[kVecSize];
-  return DoMatchImpl(text, ANCHOR_BOTH, &consumed, args, n, vec, kVecSize);
+  if (n == 0) {
+    // Nothing to extract: pcre need not record any offsets
+    return TryMatch(text, 0, ANCHOR_BOTH, true, vec, VecSize(-1)) > 0;
+  }
+  int consumed;
+  return DoMatchImpl(text, ANCHOR_BOTH, &consumed, args, n, vec, VecSize(n));
 }
 
 bool RE::PartialMatch(const StringPiece& text,
@@ -228,9 +742,13 @@ bool RE::PartialMatch(const StringPiece& text,
   if (&ptr16 == &no_arg) { goto done; } args[n++] = &ptr16;
  done:
 
-  int consumed;
   int vec[kVecSize];
-  return DoMatchImpl(text, UNANCHORED, &consumed, args, n, vec, kVecSize);
+  if (n == 0) {
+    // Nothing to extract: pcre need not record any offsets
+    return TryMatch(text, 0, UNANCHORED, true, vec, VecSize(-1)) > 0;
+  }
+  int consumed;
+  return DoMatchImpl(text, UNANCHORED, &consumed, args, n, vec, VecSize(n));
 }
 
 bool RE::Consume(StringPiece* input,
@@ -273,7 +791,7 @@ bool RE::Consume(StringPiece* input,
   int consumed;
   int vec[kVecSize];
   if (DoMatchImpl(*input, ANCHOR_START, &consumed,
-                  args, n, vec, kVecSize)) {
+                  args, n, vec, VecSize(n))) {
     input->remove_prefix(consumed);
     return true;
   } else {
@@ -321,7 +839,7 @@ bool RE::FindAndConsume(StringPiece* input,
   int consumed;
   int vec[kVecSize];
   if (DoMatchImpl(*input, UNANCHORED, &consumed,
-                  args, n, vec, kVecSize)) {
+                  args, n, vec, VecSize(n))) {
     input->remove_prefix(consumed);
     return true;
   } else {
@@ -329,10 +847,87 @@ bool RE::FindAndConsume(StringPiece* input,
   }
 }
 
+// Split "rewrite" into literal runs and \N references once, so that
+// applying it needs no parsing.  An invalid escape leaves ok_ false.
+Rewriter::Rewriter(const StringPiece& rewrite)
+  : max_group_(0),
+    ok_(true) {
+  const char* s = rewrite.data();
+  const char* end = s + rewrite.size();
+  while (s < end) {
+    const char* backslash =
+        static_cast<const char*>(memchr(s, '\\', end - s));
+    const char* literal_end = (backslash == NULL) ? end : backslash;
+    if (literal_end > s) {
+      Segment segment = { -1, static_cast<int>(literals_.size()),
+                          static_cast<int>(literal_end - s) };
+      literals_.append(s, literal_end - s);
+      // Merge with a preceding literal, such as an escaped backslash
+      if (!segments_.empty() && segments_.back().group < 0)
+        segments_.back().length += segment.length;
+      else
+        segments_.push_back(segment);
+    }
+    if (backslash == NULL) break;
+    s = backslash + 1;
+    if (s < end && isdigit(*s)) {
+      Segment segment = { *s - '0', 0, 0 };
+      segments_.push_back(segment);
+      if (segment.group > max_group_) max_group_ = segment.group;
+    } else if (s < end && *s == '\\') {
+      Segment segment = { -1, static_cast<int>(literals_.size()), 1 };
+      literals_ += '\\';
+      if (!segments_.empty() && segments_.back().group < 0)
+        segments_.back().length++;
+      else
+        segments_.push_back(segment);
+    } else {
+      ok_ = false;
+      break;
+    }
+    s++;
+  }
+}
+
+bool Rewriter::Append(string* out, const StringPiece& text,
+                      const int* vec, int matches) const {
+  bool ok = true;
+  for (size_t i = 0; i < segments_.size(); i++) {
+    const Segment& segment = segments_[i];
+    if (segment.group < 0) {
+      out->append(literals_, segment.offset, segment.length);
+    } else if (segment.group >= matches) {
+      ok = false;
+    } else {
+      const int start = vec[2 * segment.group];
+      if (start >= 0)
+        out->append(text.data() + start, vec[2 * segment.group + 1] - start);
+    }
+  }
+  return ok;
+}
+
+// Returns the highest group that "rewrite" refers to with \N, or 0.
+static int MaxSubmatch(const StringPiece& rewrite) {
+  int max = 0;
+  for (const char *s = rewrite.data(), *end = s + rewrite.size();
+       s < end; s++) {
+    if (*s == '\\' && s + 1 < end) {
+      s++;
+      if (isdigit(*s)) {
+        int n = (*s - '0');
+        if (n > max) max = n;
+      }
+    }
+  }
+  return max;
+}
+
 bool RE::Replace(const StringPiece& rewrite,
                  string *str) const {
   int vec[kVecSize];
-  int matches = TryMatch(*str, 0, UNANCHORED, true, vec, kVecSize);
+  int vecsize = VecSize(MaxSubmatch(rewrite));
+  int matches = TryMatch(*str, 0, UNANCHORED, true, vec, vecsize);
   if (matches == 0)
     return false;
 
@@ -346,109 +941,65 @@ bool RE::Replace(const StringPiece& rewrite,
   return true;
 }
 
-// Returns PCRE_NEWLINE_CRLF, PCRE_NEWLINE_CR, or PCRE_NEWLINE_LF.
-// Note that PCRE_NEWLINE_CRLF is defined to be P_N_CR | P_N_LF.
-// Modified by PH to add PCRE_NEWLINE_ANY and PCRE_NEWLINE_ANYCRLF.
-
-static int NewlineMode(int pcre_options) {
-  // TODO: if we can make it threadsafe, cache this var
-  int newline_mode = 0;
-  /* if (newline_mode) return newline_mode; */  // do this once it's cached
-  if (pcre_options & (PCRE_NEWLINE_CRLF|PCRE_NEWLINE_CR|PCRE_NEWLINE_LF|
-                      PCRE_NEWLINE_ANY|PCRE_NEWLINE_ANYCRLF)) {
-    newline_mode = (pcre_options &
-                    (PCRE_NEWLINE_CRLF|PCRE_NEWLINE_CR|PCRE_NEWLINE_LF|
-                     PCRE_NEWLINE_ANY|PCRE_NEWLINE_ANYCRLF));
-  } else {
-    int newline;
-    pcre_config(PCRE_CONFIG_NEWLINE, &newline);
-    if (newline == 10)
-      newline_mode = PCRE_NEWLINE_LF;
-    else if (newline == 13)
-      newline_mode = PCRE_NEWLINE_CR;
-    else if (newline == 3338)
-      newline_mode = PCRE_NEWLINE_CRLF;
-    else if (newline == -1)
-      newline_mode = PCRE_NEWLINE_ANY;
-    else if (newline == -2)
-      newline_mode = PCRE_NEWLINE_ANYCRLF;
-    else
-      assert(NULL == "Unexpected return value from pcre_config(NEWLINE)");
-  }
-  return newline_mode;
+int RE::GlobalReplace(const StringPiece& rewrite,
+                      string *str) const {
+  return GlobalReplace(Rewriter(rewrite), str);
 }
 
-int RE::GlobalReplace(const StringPiece& rewrite,
+int RE::GlobalReplace(const Rewriter& rewriter,
                       string *str) const {
+  string out;
+  int count = GlobalReplace(rewriter, *str, &out);
+  if (count > 0) swap(out, *str);
+  return count;
+}
+
+int RE::GlobalReplace(const Rewriter& rewriter,
+                      const StringPiece& text,
+                      string *out) const {
+  out->clear();
+  if (!rewriter.ok()) {
+    out->append(text.data(), text.size());
+    return 0;
+  }
   int count = 0;
   int vec[kVecSize];
-  string out;
+  int vecsize = VecSize(rewriter.max_group());
   int start = 0;
   bool last_match_was_empty_string = false;
 
-  while (start <= static_cast<int>(str->length())) {
+  while (start <= static_cast<int>(text.size())) {
     // If the previous match was for the empty string, we shouldn't
     // just match again: we'll match in the same way and get an
-    // infinite loop.  Instead, we do the match in a special way:
-    // anchored -- to force another try at the same position --
-    // and with a flag saying that this time, ignore empty matches.
-    // If this special match returns, that means there's a non-empty
-    // match at this position as well, and we can continue.  If not,
-    // we do what perl does, and just advance by one.
+    // infinite loop.  Instead, we search on with a flag saying that an
+    // empty match at this position does not count.  That finds a
+    // non-empty match here if there is one, and otherwise moves on a
+    // character (or a CRLF pair) as perl does.
     // Notice that perl prints '@@@' for this;
     //    perl -le '$_ = "aa"; s/b*|aa/@/g; print'
-    int matches;
-    if (last_match_was_empty_string) {
-      matches = TryMatch(*str, start, ANCHOR_START, false, vec, kVecSize);
-      if (matches <= 0) {
-        int matchend = start + 1;     // advance one character.
-        // If the current char is CR and we're in CRLF mode, skip LF too.
-        // Note it's better to call pcre_fullinfo() than to examine
-        // all_options(), since options_ could have changed bewteen
-        // compile-time and now, but this is simpler and safe enough.
-        // Modified by PH to add ANY and ANYCRLF.
-        if (matchend < static_cast<int>(str->length()) &&
-            (*str)[start] == '\r' && (*str)[matchend] == '\n' &&
-            (NewlineMode(options_.all_options()) == PCRE_NEWLINE_CRLF ||
-             NewlineMode(options_.all_options()) == PCRE_NEWLINE_ANY ||
-             NewlineMode(options_.all_options()) == PCRE_NEWLINE_ANYCRLF)) {
-          matchend++;
-        }
-        // We also need to advance more than one char if we're in utf8 mode.
-#ifdef SUPPORT_UTF8
-        if (options_.utf8()) {
-          while (matchend < static_cast<int>(str->length()) &&
-                 ((*str)[matchend] & 0xc0) == 0x80)
-            matchend++;
-        }
-#endif
-        if (start < static_cast<int>(str->length()))
-          out.append(*str, start, matchend - start);
-        start = matchend;
-        last_match_was_empty_string = false;
-        continue;
-      }
-    } else {
-      matches = TryMatch(*str, start, UNANCHORED, true, vec, kVecSize);
-      if (matches <= 0)
-        break;
-    }
+    int matches = Exec(text, start, UNANCHORED,
+                       last_match_was_empty_string ? PCRE_NOTEMPTY_ATSTART : 0,
+                       vec, vecsize, NULL);
+    if (matches < 0)
+      break;
+    if (matches == 0)           // vec was too small
+      matches = vecsize / 3;
     int matchstart = vec[0], matchend = vec[1];
     assert(matchstart >= start);
     assert(matchend >= matchstart);
-    out.append(*str, start, matchstart - start);
-    Rewrite(&out, rewrite, *str, vec, matches);
+    if (count == 0) {
+      // Most rewrites change the length of the text only a little
+      out->reserve(text.size() + text.size() / 8 + 16);
+    }
+    out->append(text.data() + start, matchstart - start);
+    rewriter.Append(out, text, vec, matches);
     start = matchend;
     count++;
     last_match_was_empty_string = (matchstart == matchend);
   }
 
-  if (count == 0)
-    return 0;
-
-  if (start < static_cast<int>(str->length()))
-    out.append(*str, start, str->length() - start);
-  swap(out, *str);
+  if (start < static_cast<int>(text.size()))
+    out->append(text.data() + start, text.size() - start);
   return count;
 }
 
@@ -456,62 +1007,160 @@ bool RE::Extract(const StringPiece& rewrite,
                  const StringPiece& text,
                  string *out) const {
   int vec[kVecSize];
-  int matches = TryMatch(text, 0, UNANCHORED, true, vec, kVecSize);
+  int vecsize = VecSize(MaxSubmatch(rewrite));
+  int matches = TryMatch(text, 0, UNANCHORED, true, vec, vecsize);
   if (matches == 0)
     return false;
   out->erase();
   return Rewrite(out, rewrite, text, vec, matches);
 }
 
-/*static*/ string RE::QuoteMeta(const StringPiece& unquoted) {
-  string result;
+namespace {
 
-  // Escape any ascii character not in [A-Za-z_0-9].
-  //
-  // Note that it's legal to escape a character even if it has no
-  // special meaning in a regular expression -- so this function does
-  // that.  (This also makes it identical to the perl function of the
-  // same name; see `perldoc -f quotemeta`.)  The one exception is
-  // escaping NUL: rather than doing backslash + NUL, like perl does,
-  // we do '\0', because pcre itself doesn't take embedded NUL chars.
-  for (int ii = 0; ii < unquoted.size(); ++ii) {
-    // Note that using 'isalnum' here raises the benchmark time from
-    // 32ns to 58ns:
-    if (unquoted[ii] == '\0') {
-      result += "\\0";
-    } else if ((unquoted[ii] < 'a' || unquoted[ii] > 'z') &&
-               (unquoted[ii] < 'A' || unquoted[ii] > 'Z') &&
-               (unquoted[ii] < '0' || unquoted[ii] > '9') &&
-               unquoted[ii] != '_' &&
-               // If this is the part of a UTF8 or Latin1 character, we need
-               // to copy this byte without escaping.  Experimentally this is
-               // what works correctly with the regexp library.
-               !(unquoted[ii] & 128)) {
-      result += '\\';
-      result += unquoted[ii];
-    } else {
-      result += unquoted[ii];
+// Which bytes QuoteMeta() escapes: any ascii character not in
+// [A-Za-z_0-9].
+//
+// Note that it's legal to escape a character even if it has no
+// special meaning in a regular expression -- so QuoteMeta() does
+// that.  (This also makes it identical to the perl function of the
+// same name; see `perldoc -f quotemeta`.)  The one exception is
+// escaping NUL: rather than doing backslash + NUL, like perl does,
+// we do '\0', because pcre itself doesn't take embedded NUL chars.
+struct QuoteMetaTable {
+  unsigned char escape[256];
+  QuoteMetaTable() {
+    for (int c = 0; c < 256; c++) {
+      escape[c] = ((c < 'a' || c > 'z') &&
+                   (c < 'A' || c > 'Z') &&
+                   (c < '0' || c > '9') &&
+                   c != '_' &&
+                   // If this is the part of a UTF8 or Latin1 character, we
+                   // need to copy this byte without escaping.
+                   // Experimentally this is what works correctly with the
+                   // regexp library.
+                   !(c & 128));
     }
   }
+};
+
+}  // namespace
 
+/*static*/ string RE::QuoteMeta(const StringPiece& unquoted) {
+  static const QuoteMetaTable table;
+  const unsigned char* in =
+      reinterpret_cast<const unsigned char*>(unquoted.data());
+  const int n = unquoted.size();
+
+  // Size the result first, so that it is written in one allocation
+  int escapes = 0;
+  for (int ii = 0; ii < n; ++ii)
+    escapes += table.escape[in[ii]];
+  if (escapes == 0)
+    return unquoted.as_string();
+
+  string result(n + escapes, '\\');
+  char* out = &result[0];
+  for (int ii = 0; ii < n; ++ii) {
+    const unsigned char c = in[ii];
+    out += table.escape[c];     // step over the backslash
+    *out++ = (c == '\0') ? '0' : c;
+  }
   return result;
 }
 
 /***** Actual matching and rewriting code *****/
 
-int RE::TryMatch(const StringPiece& text,
-                 int startpos,
-                 Anchor anchor,
-                 bool empty_ok,
-                 int *vec,
-                 int vecsize) const {
-  pcre* re = (anchor == ANCHOR_BOTH) ? re_full_ : re_partial_;
-  if (re == NULL) {
-    //fprintf(stderr, "Matching against invalid re: %s\n", error_->c_str());
-    return 0;
+// pcre_exec() options that make no difference to a literal pattern
+static const int kLiteralExecOptions =
+    PCRE_ANCHORED | PCRE_NOTBOL | PCRE_NOTEOL | PCRE_NOTEMPTY |
+    PCRE_NOTEMPTY_ATSTART | PCRE_NO_UTF8_CHECK;
+
+// Match a pattern that is just "literal" as pcre_exec() would.  With
+// "anchored" the match must start at "startpos", and with "at_end" it
+// must also run to the end of "text".
+static int ExecLiteral(const string& literal,
+                       const StringPiece& text,
+                       int startpos,
+                       bool anchored,
+                       bool at_end,
+                       int* vec,
+                       int vecsize) {
+  const char* subject = (text.data() == NULL) ? "" : text.data();
+  const int size = text.size();
+  const int n = literal.size();
+  if (startpos < 0 || startpos > size) return PCRE_ERROR_BADOFFSET;
+  int found = -1;
+  if (anchored) {
+    if ((at_end ? size - startpos == n : size - startpos >= n) &&
+        memcmp(subject + startpos, literal.data(), n) == 0)
+      found = startpos;
+  } else {
+    found = StringPiece(subject, size).find(literal, startpos);
   }
+  if (found < 0) return PCRE_ERROR_NOMATCH;
+  if (vecsize < 3) return 0;    // as pcre_exec() does without room
+  vec[0] = found;
+  vec[1] = found + n;
+  return 1;
+}
+
+// Run pcre_dfa_exec() in the calling thread's workspace, growing it
+// until the match fits.  Only the longest match is reported, as group 0;
+// the DFA matcher does not record capturing groups.
+static int ExecDFA(const pcre* re,
+                   int initial_workspace,
+                   const pcre_extra* extra,
+                   const char* subject,
+                   int length,
+                   int startpos,
+                   int options,
+                   int* vec,
+                   int vecsize) {
+  std::vector<int>& workspace = thread_dfa_workspace;
+  if (static_cast<int>(workspace.size()) < initial_workspace)
+    workspace.resize(initial_workspace);
+
+  int longest[2];
+  int rc;
+  for (;;) {
+    rc = pcre_dfa_exec(re, extra, subject, length, startpos, options,
+                       longest, 2, &workspace[0],
+                       static_cast<int>(workspace.size()));
+    if (rc != PCRE_ERROR_DFA_WSSIZE ||
+        workspace.size() >= static_cast<size_t>(kDfaWorkspaceMax))
+      break;
+    workspace.resize(2 * workspace.size());
+  }
+  if (rc < 0 && rc != PCRE_ERROR_PARTIAL) return rc;
+
+  // rc == 0 only says that there were more matches than room for them
+  const int slots = vecsize / 3 * 2;
+  for (int i = 0; i < slots; i++) vec[i] = (i < 2) ? longest[i] : -1;
+  return (rc < 0) ? rc : 1;
+}
 
-  pcre_extra extra = { 0, 0, 0, 0, 0, 0, 0, 0 };
+int RE::Exec(const StringPiece& text,
+             int startpos,
+             Anchor anchor,
+             int options,
+             int *vec,
+             int vecsize,
+             const unsigned char** mark) const {
+  const Program* prog = GetProgram(anchor);
+  if (prog == NULL) {
+    //fprintf(stderr, "Matching against invalid re: %s\n", error_->c_str());
+    return PCRE_ERROR_NULL;
+  }
+  pcre* re = prog->re;
+  const pcre_extra* studied = prog->extra;
+
+  pcre_extra extra = { 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+  if (studied != NULL) {
+    extra.flags = studied->flags &
+                  (PCRE_EXTRA_STUDY_DATA | PCRE_EXTRA_EXECUTABLE_JIT);
+    extra.study_data = studied->study_data;
+    extra.executable_jit = studied->executable_jit;
+  }
   if (options_.match_limit() > 0) {
     extra.flags |= PCRE_EXTRA_MATCH_LIMIT;
     extra.match_limit = options_.match_limit();
@@ -520,24 +1169,81 @@ int RE::TryMatch(const StringPiece& text,
     extra.flags |= PCRE_EXTRA_MATCH_LIMIT_RECURSION;
     extra.match_limit_recursion = options_.match_limit_recursion();
   }
+  if (mark != NULL) {
+    *mark = NULL;
+    extra.flags |= PCRE_EXTRA_MARK;
+    extra.mark = const_cast<unsigned char**>(mark);
+  }
 
   // int options = 0;
   // Changed by PH as a result of bugzilla #1288
-  int options = (options_.all_options() & PCRE_NO_UTF8_CHECK);
+  options |= (options_.all_options() & PCRE_NO_UTF8_CHECK);
 
-  if (anchor != UNANCHORED)
+  if (anchor != UNANCHORED && !prog->anchored)
     options |= PCRE_ANCHORED;
-  if (!empty_ok)
-    options |= PCRE_NOTEMPTY;
-
-  int rc = pcre_exec(re,              // The regular expression object
-                     &extra,
-                     (text.data() == NULL) ? "" : text.data(),
-                     text.size(),
-                     startpos,
-                     options,
-                     vec,
-                     vecsize);
+
+  if (prog->is_literal && (options & ~kLiteralExecOptions) == 0 &&
+      (!options_.utf8() || (options & PCRE_NO_UTF8_CHECK) != 0)) {
+    return ExecLiteral(prog->literal, text, startpos,
+                       anchor != UNANCHORED || (options & PCRE_ANCHORED) != 0,
+                       anchor == ANCHOR_BOTH, vec, vecsize);
+  }
+
+  const char* subject = (text.data() == NULL) ? "" : text.data();
+  int rc;
+  // The DFA matcher records no submatches, so a caller whose vector has
+  // room for more than the whole match gets pcre_exec() instead.
+  if (options_.engine() == RE_Options::DFA && vecsize < 6 &&
+      !prog->dfa_unsupported.load(std::memory_order_relaxed)) {
+    rc = ExecDFA(re, prog->dfa_workspace, &extra, subject, text.size(),
+                 startpos, options, vec, vecsize);
+    // Back references and the like are beyond the DFA matcher
+    if (rc != PCRE_ERROR_DFA_UITEM && rc != PCRE_ERROR_DFA_UCOND)
+      return rc;
+    prog->dfa_unsupported.store(true, std::memory_order_relaxed);
+  }
+#ifdef SUPPORT_JIT
+  // pcre_jit_exec() skips the sanity checks done by pcre_exec(), so only
+  // take the fast path when there is no UTF-8 subject to validate.  The
+  // anchored JIT programs already carry PCRE_ANCHORED from compile time.
+  // Partial matching is not JIT compiled; pcre_exec() interprets it.
+  if ((extra.flags & PCRE_EXTRA_EXECUTABLE_JIT) != 0 &&
+      (options & PCRE_ANCHORED) == 0 &&
+      (options & (PCRE_PARTIAL_SOFT | PCRE_PARTIAL_HARD)) == 0 &&
+      (!options_.utf8() || (options & PCRE_NO_UTF8_CHECK) != 0)) {
+    rc = pcre_jit_exec(re, &extra, subject, text.size(), startpos,
+                       options, vec, vecsize, thread_jit_stack.get());
+    if (rc == PCRE_ERROR_JIT_STACKLIMIT) {
+      // Out of JIT stack: retry in the interpreter, which is bounded by
+      // match_limit_recursion rather than by the JIT stack size.
+      extra.flags &= ~PCRE_EXTRA_EXECUTABLE_JIT;
+      rc = pcre_exec(re, &extra, subject, text.size(), startpos,
+                     options, vec, vecsize);
+    }
+  } else
+#endif
+  {
+    rc = pcre_exec(re,              // The regular expression object
+                   &extra,
+                   subject,
+                   text.size(),
+                   startpos,
+                   options,
+                   vec,
+                   vecsize);
+  }
+  return rc;
+}
+
+int RE::TryMatch(const StringPiece& text,
+                 int startpos,
+                 Anchor anchor,
+                 bool empty_ok,
+                 int *vec,
+                 int vecsize,
+                 const unsigned char** mark) const {
+  int rc = Exec(text, startpos, anchor, empty_ok ? 0 : PCRE_NOTEMPTY,
+                vec, vecsize, mark);
 
   // Handle errors
   if (rc == PCRE_ERROR_NOMATCH) {
@@ -551,7 +1257,8 @@ int RE::TryMatch(const StringPiece& text,
     // capturing subpatterns exceeds the size of the vector.
     // When this happens, there is a match and the output vector
     // is filled, but we miss out on the positions of the extra subpatterns.
-    rc = vecsize / 2;
+    // A vector with no room at all still reports one (unrecorded) pair.
+    rc = (vecsize >= 3) ? vecsize / 3 : 1;
   }
 
   return rc;
@@ -564,13 +1271,14 @@ bool RE::DoMatchImpl(const StringPiece& text,
                      int n,
                      int* vec,
                      int vecsize) const {
-  assert((1 + n) * 3 <= vecsize);  // results + PCRE workspace
+  // results + PCRE workspace, or nothing when no offsets are wanted
+  assert((n == 0 && consumed == NULL) || (1 + n) * 3 <= vecsize);
   int matches = TryMatch(text, 0, anchor, true, vec, vecsize);
   assert(matches >= 0);  // TryMatch never returns negatives
   if (matches == 0)
     return false;
 
-  *consumed = vec[1];
+  if (consumed != NULL) *consumed = vec[1];
 
   if (n == 0 || args == NULL) {
     // We are not interested in results
@@ -603,8 +1311,9 @@ bool RE::DoMatch(const StringPiece& text,
                  const Arg* const args[],
                  int n) const {
   assert(n >= 0);
-  size_t const vecsize = (1 + n) * 3;  // results + PCRE workspace
-                                       // (as for kVecSize)
+  if (partial_ == NULL) return false;  // the pattern failed to compile
+  // Without args or "consumed" nobody looks at the offsets
+  size_t const vecsize = VecSize((n == 0 && consumed == NULL) ? -1 : n);
   int space[21];   // use stack allocation for small vecsize (common case)
   int* vec = vecsize <= 21 ? space : new int[vecsize];
   bool retval = DoMatchImpl(text, anchor, consumed, args, n, vec, (int)vecsize);
@@ -612,6 +1321,57 @@ bool RE::DoMatch(const StringPiece& text,
   return retval;
 }
 
+bool RE::MatchOffsets(const StringPiece& text,
+                      Anchor anchor,
+                      int n,
+                      int* offsets) const {
+  assert(n >= 0);
+  // Checked before matching, as it is cheaper than a failed parse
+  if (NumberOfCapturingGroups() < n) return false;
+
+  const int vecsize = VecSize(n == 0 ? -1 : n);
+  int space[kVecSize];   // use stack allocation for small vecsize
+  int* vec = vecsize <= kVecSize ? space : new int[vecsize];
+  const bool matched = TryMatch(text, 0, anchor, true, vec, vecsize) > 0;
+  if (matched && n > 0) memcpy(offsets, vec + 2, 2 * n * sizeof(*vec));
+  if (vec != space) delete [] vec;
+  return matched;
+}
+
+bool RE::DoMatchNamed(const StringPiece& text,
+                      Anchor anchor,
+                      const NamedArg* const* args,
+                      const std::vector<int>** groups,
+                      int n) const {
+  int max_group = 0;
+  for (int i = 0; i < n; i++) {
+    groups[i] = NamedGroups(args[i]->name_);
+    if (groups[i] == NULL) return false;
+    max_group = std::max(max_group, groups[i]->back());
+  }
+
+  int space[2 * kMaxArgs];
+  int* offsets = (max_group <= kMaxArgs) ? space : new int[2 * max_group];
+  bool ok = MatchOffsets(text, anchor, max_group, offsets);
+  for (int i = 0; ok && i < n; i++) {
+    // With duplicate names, the first group that took part in the
+    // match, as pcre_get_named_substring() picks
+    int start = -1, limit = -1;
+    for (size_t k = 0; start == -1 && k < groups[i]->size(); k++) {
+      const int group = (*groups[i])[k];
+      start = offsets[2 * (group - 1)];
+      limit = offsets[2 * (group - 1) + 1];
+    }
+    if (start == -1) {
+      ok = args[i]->arg_.Parse(NULL, 0);
+    } else {
+      ok = args[i]->arg_.Parse(text.data() + start, limit - start);
+    }
+  }
+  if (offsets != space) delete [] offsets;
+  return ok;
+}
+
 bool RE::Rewrite(string *out, const StringPiece &rewrite,
                  const StringPiece &text, int *vec, int veclen) const {
   for (const char *s = rewrite.data(), *end = s + rewrite.size();
@@ -637,7 +1397,12 @@ bool RE::Rewrite(string *out, const StringPiece &rewrite,
         return false;
       }
     } else {
-      *out += c;
+      // Copy the run of literal text up to the next escape in one go
+      const char* escape =
+          static_cast<const char*>(memchr(s, '\\', end - s));
+      if (escape == NULL) escape = end;
+      out->append(s, escape - s);
+      s = escape - 1;
     }
   }
   return true;
@@ -646,15 +1411,444 @@ bool RE::Rewrite(string *out, const StringPiece &rewrite,
 // Return the number of capturing subpatterns, or -1 if the
 // regexp wasn't valid on construction.
 int RE::NumberOfCapturingGroups() const {
-  if (re_partial_ == NULL) return -1;
-
-  int result;
-  int pcre_retval = pcre_fullinfo(re_partial_,  // The regular expression object
-                                  NULL,         // We did not study the pattern
-                                  PCRE_INFO_CAPTURECOUNT,
-                                  &result);
-  assert(pcre_retval == 0);
-  return result;
+  if (partial_ == NULL) return -1;
+  return partial_->capture_count;
+}
+
+int RE::NamedGroupIndex(const StringPiece& name) const {
+  const std::vector<int>* numbers = NamedGroups(name);
+  return (numbers == NULL) ? -1 : numbers->front();
+}
+
+const std::vector<int>* RE::NamedGroups(const StringPiece& name) const {
+  if (partial_ == NULL) return NULL;
+  std::unordered_map<StringPiece, std::vector<int> >::const_iterator it =
+      partial_->group_index.find(name);
+  return (it == partial_->group_index.end()) ? NULL : &it->second;
+}
+
+int RE::VecSize(int n) const {
+  // pcre_exec() mallocs a private vector for every match if ours cannot
+  // hold the back references, so make room for them when that is cheap.
+  // A pattern without them needs no vector at all when "n" is -1.
+  int groups = n;
+  if (partial_ != NULL && partial_->backref_max > 0 &&
+      partial_->backref_max > groups && partial_->backref_max <= kMaxArgs)
+    groups = partial_->backref_max;
+  if (groups < 0) return 0;
+  return (1 + groups) * 3;  // results + PCRE workspace
+}
+
+/***** Iterating over matches *****/
+
+RE::FindAllRange RE::FindAll(const StringPiece& text) const & {
+  return FindAllRange(this, text);
+}
+
+RE::FindAllIterator::FindAllIterator(const RE* re, const StringPiece& text)
+  : re_(re),
+    start_(0),
+    last_match_was_empty_(false) {
+  match_.text_ = text;
+  const int groups = re->NumberOfCapturingGroups();
+  if (groups < 0) {
+    re_ = NULL;
+    return;
+  }
+  match_.vec_.resize(re->VecSize(groups));
+  Next();
+}
+
+void RE::FindAllIterator::Next() {
+  const StringPiece& text = match_.text_;
+  if (re_ == NULL || start_ > static_cast<int>(text.size())) {
+    re_ = NULL;
+    return;
+  }
+  // After an empty match, search on without allowing another empty
+  // match at the same place, as GlobalReplace() does.
+  const int vecsize = static_cast<int>(match_.vec_.size());
+  int* vec = &match_.vec_[0];
+  int rc = re_->Exec(text, start_, UNANCHORED,
+                     last_match_was_empty_ ? PCRE_NOTEMPTY_ATSTART : 0,
+                     vec, vecsize, NULL);
+  if (rc < 0) {
+    re_ = NULL;
+    return;
+  }
+  match_.groups_ = vecsize / 3;
+  start_ = vec[1];
+  last_match_was_empty_ = (vec[0] == vec[1]);
+}
+
+/***** Splitting *****/
+
+bool RE::NextField(const StringPiece& text, bool last, int* pos,
+                   StringPiece* field) const {
+  const int start = *pos;
+  if (start < 0) return false;
+  const int size = text.size();
+  int sep_begin = size, sep_end = -1;
+  if (!last) {
+    int vec[kVecSize];
+    if (Exec(text, start, UNANCHORED, PCRE_NOTEMPTY_ATSTART,
+             vec, VecSize(0), NULL) >= 0 &&
+        (vec[0] < size || vec[1] > vec[0])) {   // not empty at the end
+      sep_begin = vec[0];
+      sep_end = vec[1];
+    }
+  }
+  field->set(text.data() + start, sep_begin - start);
+  *pos = sep_end;
+  return true;
+}
+
+int RE::Split(const StringPiece& text,
+              std::vector<StringPiece>* fields,
+              int max_fields) const {
+  fields->clear();
+  return Tokenize(text, [fields](const StringPiece& field) {
+    fields->push_back(field);
+    return true;
+  }, max_fields);
+}
+
+/***** Sets of patterns *****/
+
+RE::Set::Set(Anchor anchor, const RE_Options& options)
+  : anchor_(anchor),
+    options_(options),
+    first_(NULL),
+    all_(NULL),
+    compiled_(false) {
+}
+
+RE::Set::~Set() {
+  for (size_t i = 0; i < res_.size(); i++) delete res_[i];
+  delete first_;
+  delete all_;
+}
+
+int RE::Set::Add(const StringPiece& pattern, string* error) {
+  if (compiled_) {
+    if (error != NULL) *error = "pattern added to a compiled set";
+    return -1;
+  }
+  RE* re = new RE(pattern.as_string(), options_);
+  if (!re->error().empty()) {
+    if (error != NULL) *error = re->error();
+    delete re;
+    return -1;
+  }
+  // The combined programs could not have two groups of the same name
+  const std::unordered_map<StringPiece, std::vector<int> >& names =
+      re->partial_->group_index;
+  for (std::unordered_map<StringPiece, std::vector<int> >::const_iterator
+           it = names.begin(); it != names.end(); ++it) {
+    for (size_t i = 0; i < res_.size(); i++) {
+      if (res_[i]->partial_->group_index.count(it->first) > 0) {
+        if (error != NULL) {
+          char index[32];
+          snprintf(index, sizeof(index), "%d", static_cast<int>(i));
+          *error = "group name " + it->first.as_string() +
+                   " is already used by pattern " + index;
+        }
+        delete re;
+        return -1;
+      }
+    }
+  }
+  patterns_.push_back(pattern.as_string());
+  res_.push_back(re);
+  return size() - 1;
+}
+
+// Wrap "pattern" in a group that survives being joined to others: an
+// unterminated \Q or a trailing comment in extended mode would
+// otherwise swallow the closing parenthesis.
+static string WrapPattern(const string& pattern, const RE_Options& options) {
+  return "(?:" + pattern + (options.extended() ? "\\E\n)" : "\\E)");
+}
+
+// Whether "p" may be a group number, as in (?1), (?+1) or (?-1)
+static bool IsGroupNumber(const string& p, size_t i) {
+  if (i < p.size() && p[i] == '-') i++;
+  else if (i < p.size() && p[i] == '+') i++;
+  return i < p.size() && isdigit(p[i]);
+}
+
+// Whether "p" refers to groups by number other than in back
+// references (which PCRE_INFO_BACKREFMAX covers): subroutine calls such
+// as (?1), (?-1) or \g<1>, and conditions such as (?(1)...) or (?(R1)...).
+// Joining the pattern to others renumbers its groups.  Escapes and \Q...\E
+// are skipped; anything else that merely looks like a reference, in a
+// character class say, only costs the pattern a match of its own.
+static bool UsesGroupNumbers(const string& p) {
+  for (size_t i = 0; i < p.size(); i++) {
+    if (p[i] == '\\') {
+      if (i + 1 < p.size() && p[i + 1] == 'Q') {
+        size_t end = p.find("\\E", i + 2);
+        if (end == string::npos) return false;
+        i = end + 1;
+      } else if (i + 2 < p.size() && p[i + 1] == 'g' &&
+                 (p[i + 2] == '<' || p[i + 2] == '\'') &&
+                 IsGroupNumber(p, i + 3)) {
+        return true;
+      } else {
+        i++;
+      }
+    } else if (p.compare(i, 2, "(?") == 0) {
+      size_t j = i + 2;
+      if (j < p.size() && p[j] == '(') {
+        j++;
+        if (j < p.size() && p[j] == 'R') j++;
+      }
+      if (IsGroupNumber(p, j)) return true;
+    }
+  }
+  return false;
+}
+
+bool RE::Set::Compile() {
+  if (compiled_) return false;
+  compiled_ = true;
+
+  // FirstMatch: the alternatives are tried in order at each starting
+  // position, and the (*MARK) on the successful path names the pattern.
+  // The branch reset group keeps every pattern's back references valid,
+  // but a subroutine call such as (?1) would reach the first pattern's
+  // group 1, and two patterns may not name the same group number
+  // differently, so such patterns are run on their own.
+  string first = "(?|";
+  bool first_named = false;
+  // Match: a lookahead at the start of the text for each pattern, each
+  // capturing the pattern when it is found.  Unanchored, every lookahead
+  // searches the text by itself, so this saves calls rather than scans.
+  // Patterns that refer to their groups by number would need
+  // renumbering, so they are run on their own.
+  static const char* const kSkip[] = { "[\\s\\S]*?", "", "" };
+  string all;
+  int group = 0;
+  groups_.assign(patterns_.size(), 0);
+  separate_.clear();
+  for (size_t i = 0; i < patterns_.size(); i++) {
+    const string wrapped = WrapPattern(patterns_[i], options_);
+    const bool numbered = UsesGroupNumbers(patterns_[i]);
+    const bool named = !res_[i]->partial_->group_index.empty();
+    if (numbered || (named && first_named)) {
+      separate_.push_back(static_cast<int>(i));
+    } else {
+      first_named = first_named || named;
+      char mark[32];
+      snprintf(mark, sizeof(mark), "%s(*MARK:%d)",
+               first.size() > 3 ? "|" : "", static_cast<int>(i));
+      first += mark + wrapped;
+    }
+
+    if (numbered || res_[i]->partial_->backref_max > 0) continue;
+    groups_[i] = ++group;
+    group += res_[i]->NumberOfCapturingGroups();
+    all += "(?=(?:";
+    all += kSkip[anchor_];
+    all += "(" + wrapped + ")";
+    if (anchor_ == ANCHOR_BOTH) all += "\\z";
+    all += ")?)";
+  }
+  first += ")";
+
+  first_ = new RE(first, options_);
+  all_ = new RE(all, options_);
+  return first_->error().empty() && all_->error().empty();
+}
+
+int RE::Set::FirstMatch(const StringPiece& text) const {
+  if (first_ == NULL || patterns_.empty()) return -1;
+  int vec[kVecSize];
+  const unsigned char* mark;
+  // The start of the match is needed only to compare with the patterns
+  // that are run on their own
+  int best = -1, best_start = 0;
+  if (first_->TryMatch(text, 0, anchor_, true, vec,
+                       first_->VecSize(separate_.empty() ? -1 : 0),
+                       &mark) > 0 && mark != NULL) {
+    best = atoi(reinterpret_cast<const char*>(mark));
+    best_start = vec[0];
+  }
+  for (size_t k = 0; k < separate_.size(); k++) {
+    const int i = separate_[k];
+    if (res_[i]->TryMatch(text, 0, anchor_, true, vec,
+                          res_[i]->VecSize(0)) > 0 &&
+        (best < 0 || vec[0] < best_start ||
+         (vec[0] == best_start && i < best))) {
+      best = i;
+      best_start = vec[0];
+    }
+  }
+  return best;
+}
+
+bool RE::Set::Match(const StringPiece& text, std::vector<int>* matches) const {
+  matches->clear();
+  if (all_ == NULL) return false;
+
+  const int vecsize = all_->VecSize(all_->NumberOfCapturingGroups());
+  int space[kVecSize];
+  std::vector<int> heap;
+  int* vec = space;
+  if (vecsize > kVecSize) {
+    heap.resize(vecsize);
+    vec = &heap[0];
+  }
+  // The lookaheads always succeed, possibly without capturing anything
+  const int n = all_->TryMatch(text, 0, ANCHOR_START, true, vec, vecsize);
+  for (size_t i = 0; i < groups_.size(); i++) {
+    bool matched;
+    if (groups_[i] == 0)
+      matched = res_[i]->DoMatch(text, anchor_, NULL, NULL, 0);
+    else
+      matched = groups_[i] < n && vec[2 * groups_[i]] >= 0;
+    if (matched) matches->push_back(static_cast<int>(i));
+  }
+  return !matches->empty();
+}
+
+int RE::Set::LongestMatch(const StringPiece& text, StringPiece* match) const {
+  if (all_ == NULL) return -1;
+
+  const int vecsize = all_->VecSize(all_->NumberOfCapturingGroups());
+  int space[kVecSize];
+  std::vector<int> heap;
+  int* vec = space;
+  if (vecsize > kVecSize) {
+    heap.resize(vecsize);
+    vec = &heap[0];
+  }
+  const int n = all_->TryMatch(text, 0, ANCHOR_START, true, vec, vecsize);
+  int best = -1, best_start = 0, best_end = 0;
+  for (size_t i = 0; i < groups_.size(); i++) {
+    int start, end;
+    if (groups_[i] == 0) {
+      int own[kVecSize];
+      if (res_[i]->TryMatch(text, 0, anchor_, true, own,
+                            res_[i]->VecSize(0)) == 0)
+        continue;
+      start = own[0];
+      end = own[1];
+    } else if (groups_[i] < n && vec[2 * groups_[i]] >= 0) {
+      start = vec[2 * groups_[i]];
+      end = vec[2 * groups_[i] + 1];
+    } else {
+      continue;
+    }
+    if (best < 0 || start < best_start ||
+        (start == best_start && end - start > best_end - best_start)) {
+      best = static_cast<int>(i);
+      best_start = start;
+      best_end = end;
+    }
+  }
+  if (best >= 0) match->set(text.data() + best_start, best_end - best_start);
+  return best;
+}
+
+/***** Matching streamed input *****/
+
+StreamMatcher::StreamMatcher(const RE& re)
+  : re_(re),
+    context_(1) {
+  int groups = 0;
+  if (re.partial_ != NULL) {
+    int lookbehind = 0;
+    pcre_fullinfo(re.partial_->re, NULL, PCRE_INFO_MAXLOOKBEHIND, &lookbehind);
+    // Lookbehind is counted in characters, which are at most 4 bytes
+    if (re.options_.utf8()) lookbehind *= 4;
+    // Always keep a byte, so that nothing mistakes the start of the
+    // buffer for the start of the stream (\A, for instance).
+    if (lookbehind > 1) context_ = lookbehind;
+    groups = re.partial_->capture_count;
+  }
+  vec_.resize((1 + groups) * 3);
+  Reset();
+}
+
+void StreamMatcher::Reset() {
+  buffer_.clear();
+  base_ = 0;
+  discard_ = 0;
+  start_ = 0;
+  after_empty_ = false;
+  matched_ = false;
+  vec_[0] = vec_[1] = 0;
+}
+
+StreamMatcher::Status StreamMatcher::Feed(const StringPiece& chunk) {
+  Compact();
+  buffer_.append(chunk.data(), chunk.size());
+  return Search(PCRE_PARTIAL_HARD);
+}
+
+StreamMatcher::Status StreamMatcher::Finish() {
+  Compact();
+  return Search(0);
+}
+
+void StreamMatcher::Compact() {
+  if (discard_ == 0) return;
+  buffer_.erase(0, discard_);
+  base_ += discard_;
+  start_ -= static_cast<int>(discard_);
+  discard_ = 0;
+}
+
+StreamMatcher::Status StreamMatcher::Search(int options) {
+  matched_ = false;
+  if (base_ > 0) options |= PCRE_NOTBOL;
+  if (after_empty_) options |= PCRE_NOTEMPTY_ATSTART;
+  const int rc = re_.Exec(buffer_, start_, RE::UNANCHORED, options,
+                          &vec_[0], static_cast<int>(vec_.size()), NULL);
+  if (rc >= 0) {
+    // Searching resumes after the match, or just after it if it was empty
+    matched_ = true;
+    after_empty_ = (vec_[0] == vec_[1]);
+    start_ = vec_[1];
+    Discard(start_);
+    return MATCHED;
+  }
+  if (rc == PCRE_ERROR_PARTIAL) {
+    // Keep the partial match, and search it again with more data
+    if (vec_[0] != start_) after_empty_ = false;
+    start_ = vec_[0];
+    Discard(start_);
+    return NEED_MORE;
+  }
+  if (rc == PCRE_ERROR_SHORTUTF8) {
+    // The buffer ends part way through a character
+    Discard(start_);
+    return NEED_MORE;
+  }
+  // Nothing from start_ on can begin a match
+  after_empty_ = false;
+  start_ = static_cast<int>(buffer_.size());
+  Discard(start_);
+  return NO_MATCH;
+}
+
+void StreamMatcher::Discard(size_t start) {
+  size_t limit = (start > context_) ? start - context_ : 0;
+  if (re_.options_.utf8()) {
+    while (limit > 0 && limit < buffer_.size() &&
+           (buffer_[limit] & 0xc0) == 0x80)
+      limit--;
+  }
+  discard_ = limit;
+}
+
+StringPiece StreamMatcher::match(int n) const {
+  if (!matched_ || n < 0 || (n + 1) * 3 > static_cast<int>(vec_.size()) ||
+      vec_[2 * n] < 0)
+    return StringPiece();
+  return StringPiece(buffer_.data() + vec_[2 * n],
+                     vec_[2 * n + 1] - vec_[2 * n]);
 }
 
 /***** Parsers for various types *****/
@@ -692,52 +1886,121 @@ bool Arg::parse_uchar(const char* str, int n, void* dest) {
   return true;
 }
 
-// Largest number spec that we are willing to parse
-static const int kMaxNumberLength = 32;
-
-// REQUIRES "buf" must have length at least kMaxNumberLength+1
-// REQUIRES "n > 0"
-// Copies "str" into "buf" and null-terminates if necessary.
-// Returns one of:
-//      a. "str" if no termination is needed
-//      b. "buf" if the string was copied and null-terminated
-//      c. "" if the input was invalid and has no hope of being parsed
-static const char* TerminateNumber(char* buf, const char* str, int n) {
-  if ((n > 0) && isspace(*str)) {
-    // We are less forgiving than the strtoxxx() routines and do not
-    // allow leading spaces.
-    return "";
-  }
-
-  // See if the character right after the input text may potentially
-  // look like a digit.
-  if (isdigit(str[n]) ||
-      ((str[n] >= 'a') && (str[n] <= 'f')) ||
-      ((str[n] >= 'A') && (str[n] <= 'F'))) {
-    if (n > kMaxNumberLength) return ""; // Input too big to be a valid number
-    memcpy(buf, str, n);
-    buf[n] = '\0';
-    return buf;
+// The numeric parsers below work directly on the (str, n) piece handed
+// to them by the matcher.  They do not copy it or need it terminated,
+// and they do not depend on the locale.  They accept what strtol() and
+// friends accept, except that leading white space is refused.
+
+// Value of an alphanumeric digit, or 36 for anything else
+static inline int DigitValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'Z') return c - 'A' + 10;
+  return 36;
+}
+
+#if (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) || \
+    defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM64)
+#define PCRECPP_SWAR_DIGITS 1
+
+// True if all eight bytes of "v" are ASCII digits
+static inline bool IsEightDigits(unsigned long long v) {
+  return ((((v + 0x4646464646464646ULL) | (v - 0x3030303030303030ULL)) &
+           0x8080808080808080ULL) == 0);
+}
+
+// Value of the eight ASCII digits in "v", first digit in the low byte
+static inline unsigned long long EightDigitsValue(unsigned long long v) {
+  v -= 0x3030303030303030ULL;
+  v = (v * 10) + (v >> 8);                      // pairs of digits
+  v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+       (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+  return v;
+}
+#endif
+
+// Parses an optionally signed integer from exactly the "n" bytes at
+// "str".  "radix" is 8, 10 or 16, or 0 to pick the base from a C-style
+// "0" or "0x" prefix.  Stores the magnitude in "*value" and whether it
+// was negative in "*negative".  Fails on empty input, junk, or a
+// magnitude above "max".
+static bool ParseInteger(const char* str, int n, int radix,
+                         unsigned long long max,
+                         unsigned long long* value, bool* negative) {
+  const char* end = str + n;
+  *negative = false;
+  if (str < end && (*str == '-' || *str == '+')) {
+    *negative = (*str == '-');
+    str++;
+  }
+  if ((radix == 0 || radix == 16) && end - str > 2 && str[0] == '0' &&
+      (str[1] == 'x' || str[1] == 'X') && DigitValue(str[2]) < 16) {
+    str += 2;
+    radix = 16;
+  } else if (radix == 0) {
+    radix = (str < end && str[0] == '0') ? 8 : 10;
+  }
+  if (str == end) return false;
+
+  unsigned long long v = 0;
+#ifdef PCRECPP_SWAR_DIGITS
+  if (radix == 10) {
+    while (end - str >= 8) {
+      unsigned long long chunk;
+      memcpy(&chunk, str, 8);
+      if (!IsEightDigits(chunk)) break;
+      chunk = EightDigitsValue(chunk);
+      if (v > (max - chunk) / 100000000) return false;
+      v = v * 100000000 + chunk;
+      str += 8;
+    }
+  }
+#endif
+  for (; str < end; str++) {
+    unsigned int d = DigitValue(*str);
+    if (d >= static_cast<unsigned int>(radix)) return false;
+    if (v > (max - d) / radix) return false;
+    v = v * radix + d;
+  }
+  *value = v;
+  return true;
+}
+
+// Parse a signed integer that must lie in [-max-1, max]
+static bool ParseSigned(const char* str, int n, int radix,
+                        unsigned long long max, long long* value) {
+  unsigned long long magnitude;
+  bool negative;
+  if (!ParseInteger(str, n, radix, max + 1, &magnitude, &negative))
+    return false;
+  if (!negative) {
+    if (magnitude > max) return false;
+    *value = static_cast<long long>(magnitude);
+  } else if (magnitude == 0) {
+    *value = 0;
   } else {
-    // We can parse right out of the supplied string, so return it.
-    return str;
+    *value = -static_cast<long long>(magnitude - 1) - 1;
   }
+  return true;
+}
+
+// Parse an unsigned integer that must lie in [0, max].  Like the
+// strtoul()-based code this replaces, any minus sign is refused.
+static bool ParseUnsigned(const char* str, int n, int radix,
+                          unsigned long long max,
+                          unsigned long long* value) {
+  bool negative;
+  return ParseInteger(str, n, radix, max, value, &negative) && !negative;
 }
 
 bool Arg::parse_long_radix(const char* str,
                            int n,
                            void* dest,
                            int radix) {
-  if (n == 0) return false;
-  char buf[kMaxNumberLength+1];
-  str = TerminateNumber(buf, str, n);
-  char* end;
-  errno = 0;
-  long r = strtol(str, &end, radix);
-  if (end != str + n) return false;   // Leftover junk
-  if (errno) return false;
+  long long r;
+  if (!ParseSigned(str, n, radix, LONG_MAX, &r)) return false;
   if (dest == NULL) return true;
-  *(reinterpret_cast<long*>(dest)) = r;
+  *(reinterpret_cast<long*>(dest)) = static_cast<long>(r);
   return true;
 }
 
@@ -745,17 +2008,10 @@ bool Arg::parse_ulong_radix(const char* str,
                             int n,
                             void* dest,
                             int radix) {
-  if (n == 0) return false;
-  char buf[kMaxNumberLength+1];
-  str = TerminateNumber(buf, str, n);
-  if (str[0] == '-') return false;    // strtoul() on a negative number?!
-  char* end;
-  errno = 0;
-  unsigned long r = strtoul(str, &end, radix);
-  if (end != str + n) return false;   // Leftover junk
-  if (errno) return false;
+  unsigned long long r;
+  if (!ParseUnsigned(str, n, radix, ULONG_MAX, &r)) return false;
   if (dest == NULL) return true;
-  *(reinterpret_cast<unsigned long*>(dest)) = r;
+  *(reinterpret_cast<unsigned long*>(dest)) = static_cast<unsigned long>(r);
   return true;
 }
 
@@ -814,24 +2070,8 @@ bool Arg::parse_longlong_radix(const char* str,
 #ifndef HAVE_LONG_LONG
   return false;
 #else
-  if (n == 0) return false;
-  char buf[kMaxNumberLength+1];
-  str = TerminateNumber(buf, str, n);
-  char* end;
-  errno = 0;
-#if defined HAVE_STRTOQ
-  long long r = strtoq(str, &end, radix);
-#elif defined HAVE_STRTOLL
-  long long r = strtoll(str, &end, radix);
-#elif defined HAVE__STRTOI64
-  long long r = _strtoi64(str, &end, radix);
-#elif defined HAVE_STRTOIMAX
-  long long r = strtoimax(str, &end, radix);
-#else
-#error parse_longlong_radix: cannot convert input to a long-long
-#endif
-  if (end != str + n) return false;   // Leftover junk
-  if (errno) return false;
+  long long r;
+  if (!ParseSigned(str, n, radix, LLONG_MAX, &r)) return false;
   if (dest == NULL) return true;
   *(reinterpret_cast<long long*>(dest)) = r;
   return true;
@@ -845,43 +2085,100 @@ bool Arg::parse_ulonglong_radix(const char* str,
 #ifndef HAVE_UNSIGNED_LONG_LONG
   return false;
 #else
-  if (n == 0) return false;
-  char buf[kMaxNumberLength+1];
-  str = TerminateNumber(buf, str, n);
-  if (str[0] == '-') return false;    // strtoull() on a negative number?!
-  char* end;
-  errno = 0;
-#if defined HAVE_STRTOQ
-  unsigned long long r = strtouq(str, &end, radix);
-#elif defined HAVE_STRTOLL
-  unsigned long long r = strtoull(str, &end, radix);
-#elif defined HAVE__STRTOI64
-  unsigned long long r = _strtoui64(str, &end, radix);
-#elif defined HAVE_STRTOIMAX
-  unsigned long long r = strtoumax(str, &end, radix);
-#else
-#error parse_ulonglong_radix: cannot convert input to a long-long
-#endif
-  if (end != str + n) return false;   // Leftover junk
-  if (errno) return false;
+  unsigned long long r;
+  if (!ParseUnsigned(str, n, radix, ULLONG_MAX, &r)) return false;
   if (dest == NULL) return true;
   *(reinterpret_cast<unsigned long long*>(dest)) = r;
   return true;
 #endif   /* HAVE_UNSIGNED_LONG_LONG */
 }
 
+// Exactly representable powers of ten
+static const double kExactPowersOfTen[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Parses a plain decimal number ([+-]digits[.digits][e[+-]digits]) from
+// exactly the "n" bytes at "str" when the result can be computed with a
+// single correctly rounded multiplication or division: the significand
+// fits in 53 bits and the power of ten is exact (Clinger's fast path).
+// Returns false for anything else, which the caller hands to strtod().
+static bool ParseDoubleFast(const char* str, int n, double* value) {
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD != 0
+  // Extended precision intermediates would round twice
+  return false;
+#endif
+  const char* end = str + n;
+  bool negative = false;
+  if (str < end && (*str == '-' || *str == '+')) {
+    negative = (*str == '-');
+    str++;
+  }
+
+  const unsigned long long kMaxExact = 1ULL << 53;
+  unsigned long long mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  for (; str < end && *str >= '0' && *str <= '9'; str++, digits++) {
+    mantissa = mantissa * 10 + (*str - '0');
+    if (mantissa > kMaxExact) return false;
+  }
+  if (str < end && *str == '.') {
+    for (str++; str < end && *str >= '0' && *str <= '9'; str++, digits++) {
+      mantissa = mantissa * 10 + (*str - '0');
+      if (mantissa > kMaxExact) return false;
+      exponent--;
+    }
+  }
+  if (digits == 0) return false;
+
+  if (str < end && (*str == 'e' || *str == 'E')) {
+    str++;
+    bool negative_exponent = false;
+    if (str < end && (*str == '-' || *str == '+')) {
+      negative_exponent = (*str == '-');
+      str++;
+    }
+    if (str == end) return false;
+    int e = 0;
+    for (; str < end && *str >= '0' && *str <= '9'; str++) {
+      e = e * 10 + (*str - '0');
+      if (e > 1000) return false;
+    }
+    exponent += negative_exponent ? -e : e;
+  }
+  if (str != end) return false;
+
+  double r = static_cast<double>(mantissa);
+  if (exponent < 0) {
+    if (exponent < -22) return false;
+    r /= kExactPowersOfTen[-exponent];
+  } else {
+    if (exponent > 22) return false;
+    r *= kExactPowersOfTen[exponent];
+  }
+  *value = negative ? -r : r;
+  return true;
+}
+
 bool Arg::parse_double(const char* str, int n, void* dest) {
   if (n == 0) return false;
-  static const int kMaxLength = 200;
-  char buf[kMaxLength];
-  if (n >= kMaxLength) return false;
-  memcpy(buf, str, n);
-  buf[n] = '\0';
-  errno = 0;
-  char* end;
-  double r = strtod(buf, &end);
-  if (end != buf + n) return false;   // Leftover junk
-  if (errno) return false;
+  double r;
+  if (!ParseDoubleFast(str, n, &r)) {
+    // Hard cases (long significands, huge exponents, inf, nan, hex
+    // floats, ...) go to strtod(), which needs a terminated copy.
+    static const int kMaxLength = 200;
+    char buf[kMaxLength];
+    if (n >= kMaxLength) return false;
+    memcpy(buf, str, n);
+    buf[n] = '\0';
+    errno = 0;
+    char* end;
+    r = strtod(buf, &end);
+    if (end != buf + n) return false;   // Leftover junk
+    if (errno) return false;
+  }
   if (dest == NULL) return true;
   *(reinterpret_cast<double*>(dest)) = r;
   return true;
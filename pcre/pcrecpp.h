@@ -125,6 +125,17 @@
 // If you need more, consider using the more general interface
 // pcrecpp::RE::DoMatch().  See pcrecpp.h for the signature for DoMatch.
 //
+// The typed interface has no such limit.  "Match" behaves like
+// "FullMatch" (or takes an RE::Anchor), and "MatchInto" parses the
+// groups into a std::tuple.  Both pick each parser at compile time:
+//
+//    int i;
+//    string s;
+//    pcrecpp::RE re("(\\w+):(\\d+)");
+//    re.Match("ruby:1234", &s, &i);
+//    std::tuple<string, int> t;
+//    re.MatchInto("ruby:1234", &t);
+//
 // -----------------------------------------------------------------------
 // PARTIAL MATCHES
 //
@@ -213,6 +224,34 @@
 // recurses.  match_limit() caps the number of matches pcre does;
 // match_limit_recrusion() caps the depth of recursion.
 //
+// The set_study() and set_jit() member functions do not map onto a
+// compile-time modifier.  set_study() runs pcre_study() over each
+// compiled form of the expression, which lets pcre reject impossible
+// start positions and short subjects without entering the matcher.
+// set_jit() additionally asks pcre_study() for JIT machine code and runs
+// matches through pcre_jit_exec(), using a JIT stack private to the
+// calling thread.  set_jit() implies set_study().  If pcre was built
+// without JIT support, or the pattern cannot be JIT compiled, matching
+// silently falls back to the (studied) interpreter.
+//
+//    RE re("(\\w+) = (\\d+)", RE_Options().set_jit(true));
+//
+// set_engine(RE_Options::DFA) matches with pcre_dfa_exec() instead of
+// pcre_exec().  The DFA matcher never backtracks, so its running time
+// is bounded by the length of the text times the size of the pattern,
+// which makes it a safer choice for untrusted input.  It reports the
+// longest match at the leftmost position rather than the first one a
+// backtracking search finds.  It does not record submatches, so calls
+// that need them (matching with arguments, rewrites that use \\1 and
+// up, iterating with FindAll() over a pattern with groups) are run by
+// pcre_exec(), and find the match it would.  Each thread keeps one DFA
+// workspace, which grows as patterns need it.  Patterns using features
+// the DFA matcher lacks (back references, conditions on groups, (*MARK)
+// and so on) are run by pcre_exec() once pcre_dfa_exec() has turned
+// them down.
+//
+//    RE re("\\d+(\\.\\d+)?", RE_Options().set_engine(RE_Options::DFA));
+//
 // Normally, to pass one or more modifiers to a RE class, you declare
 // a RE_Options object, set the appropriate options, and pass this
 // object to a RE constructor. Example:
@@ -253,6 +292,66 @@
 //                            .set_multiline(true)).PartialMatch(sometext);
 //
 // -----------------------------------------------------------------------
+// SHARING COMPILED EXPRESSIONS
+//
+// Compiled expressions are kept in a process-wide cache keyed by the
+// pattern, its options and the anchoring mode.  Constructing an RE whose
+// pattern and options match an earlier one reuses that compiled (and
+// studied) program instead of calling pcre_compile() again.  Programs
+// are reference counted, so an RE never loses its program when it is
+// evicted from the cache.  The cache is bounded in memory and drops the
+// least recently used entries first:
+//
+//    pcrecpp::RE::SetCacheLimit(1 << 20);      // at most 1MB, 0 disables
+//    pcrecpp::RE_CacheStats stats = pcrecpp::RE::GetCacheStats();
+//    printf("%lu hits, %lu misses\n", stats.hits, stats.misses);
+//
+// -----------------------------------------------------------------------
+// MATCHING MANY PATTERNS AT ONCE
+//
+// An RE::Set combines several patterns into one program, so that text
+// can be dispatched on them without trying each one in turn:
+//
+//    pcrecpp::RE::Set set(pcrecpp::RE::ANCHOR_START);
+//    set.Add("GET ", NULL);                    // index 0
+//    set.Add("POST ", NULL);                   // index 1
+//    set.Compile();
+//    int which = set.FirstMatch(line);         // -1 if none matched
+//
+// Set::Match reports every matching pattern instead, and
+// Set::LongestMatch the one with the longest match, as a lexer wants.
+// The patterns are joined with (*MARK) verbs and wrapped in groups, so
+// they must not use (*MARK) or named backtracking verbs themselves, nor
+// recurse into the whole pattern with (?R).  No two patterns in a set
+// may give a group the same name.  Patterns that refer to their groups
+// by number, in back references, subroutine calls such as (?1) or
+// (?-1), or conditions such as (?(1)...), are matched on their own
+// where joining them to the others would change what the numbers
+// refer to.
+//
+// Only FirstMatch is a single scan of the text.  Match and LongestMatch
+// run as one pcre_exec() call, but in an unanchored set each pattern
+// searches the text from the start on its own, so their cost still
+// grows with the number of patterns times the length of the text.
+// Anchored sets try each pattern only at the start.
+//
+// -----------------------------------------------------------------------
+// MATCHING INPUT THAT ARRIVES IN PIECES
+//
+// A StreamMatcher searches for an RE in a stream fed to it piece by
+// piece, keeping only what an unfinished match still needs:
+//
+//    pcrecpp::RE reply("OK (\\d+)\r\n");
+//    pcrecpp::StreamMatcher matcher(reply);
+//    while (ReadSome(&chunk)) {
+//      for (pcrecpp::StringPiece piece = chunk;
+//           matcher.Feed(piece) == pcrecpp::StreamMatcher::MATCHED;
+//           piece.clear()) {
+//        Handle(matcher.match(1));
+//      }
+//    }
+//
+// -----------------------------------------------------------------------
 // SCANNING TEXT INCREMENTALLY
 //
 // The "Consume" operation may be useful if you want to repeatedly
@@ -321,16 +420,37 @@
 //   pcrecpp::RE("b+").GlobalReplace("d", &s);
 //
 // will leave "s" containing "yada dada doo".  It returns the number
-// of replacements made.
+// of replacements made.  A rewrite with an invalid escape replaces
+// nothing and returns 0.  After an empty match, the search moves on by
+// a character, or by a CRLF pair when the newline convention includes
+// CRLF and the pattern does not itself contain \r or \n.
 //
 // Extract() is like Replace(), except that if the pattern matches,
 // "rewrite" is copied into "out" (an additional argument) with
 // substitutions.  The non-matching portions of "text" are ignored.
 // Returns true iff a match occurred and the extraction happened
 // successfully.  If no match occurs, the string is left unaffected.
+//
+// A rewrite string used for many replacements can be parsed once into a
+// Rewriter.  GlobalReplace() also accepts one, and can write its result
+// to a separate string that the caller reuses from call to call:
+//
+//   const pcrecpp::RE secret("password=\\S+");
+//   const pcrecpp::Rewriter hidden("password=***");
+//   string clean;
+//   for (...) {
+//     secret.GlobalReplace(hidden, line, &clean);
+//     ...
+//   }
 
 
 #include <string>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <tuple>
+#include <type_traits>
+#include <vector>
 #include <pcre.h>
 #include <pcrecpparg.h>   // defines the Arg class
 // This isn't technically needed here, but we include it
@@ -350,12 +470,19 @@ namespace pcrecpp {
 
 // RE_Options allow you to set options to be passed along to pcre,
 // along with other options we put on top of pcre.
-// Only 9 modifiers, plus match_limit and match_limit_recursion,
-// are supported now.
+// Only 9 modifiers, plus match_limit, match_limit_recursion, study,
+// jit and engine, are supported now.
 class PCRECPP_EXP_DEFN RE_Options {
  public:
+  // Matching algorithms
+  enum Engine {
+    BACKTRACKING,       // pcre_exec(), the default
+    DFA                 // pcre_dfa_exec()
+  };
+
   // constructor
-  RE_Options() : match_limit_(0), match_limit_recursion_(0), all_options_(0) {}
+  RE_Options() : match_limit_(0), match_limit_recursion_(0), all_options_(0),
+                 study_(false), jit_(false), engine_(BACKTRACKING) {}
 
   // alternative constructor.
   // To facilitate transfer of legacy code from C programs
@@ -366,7 +493,9 @@ class PCRECPP_EXP_DEFN RE_Options {
   //    RE(pattern,
   //      RE_Options().set_caseless(true).set_multiline(true)).PartialMatch(str);
   RE_Options(int option_flags) : match_limit_(0), match_limit_recursion_(0),
-                                 all_options_(option_flags) {}
+                                 all_options_(option_flags),
+                                 study_(false), jit_(false),
+                                 engine_(BACKTRACKING) {}
   // we're fine with the default destructor, copy constructor, etc.
 
   // accessors and mutators
@@ -445,6 +574,33 @@ class PCRECPP_EXP_DEFN RE_Options {
     PCRE_SET_OR_CLEAR(x, PCRE_NO_AUTO_CAPTURE);
   }
 
+  // Run pcre_study() over the compiled expression
+  bool study() const {
+    return study_ || jit_;
+  }
+  RE_Options &set_study(bool x) {
+    study_ = x;
+    return *this;
+  }
+
+  // Also JIT compile the expression (implies study)
+  bool jit() const {
+    return jit_;
+  }
+  RE_Options &set_jit(bool x) {
+    jit_ = x;
+    return *this;
+  }
+
+  // Matching algorithm
+  Engine engine() const {
+    return engine_;
+  }
+  RE_Options &set_engine(Engine x) {
+    engine_ = x;
+    return *this;
+  }
+
   RE_Options &set_all_options(int opt) {
     all_options_ = opt;
     return *this;
@@ -459,6 +615,9 @@ class PCRECPP_EXP_DEFN RE_Options {
   int match_limit_;
   int match_limit_recursion_;
   int all_options_;
+  bool study_;
+  bool jit_;
+  Engine engine_;
 };
 
 // These functions return some common RE_Options
@@ -481,6 +640,89 @@ static inline RE_Options EXTENDED() {
   return RE_Options().set_extended(true);
 }
 
+// Counters for the process-wide cache of compiled expressions
+struct RE_CacheStats {
+  unsigned long hits;           // Compiles satisfied from the cache
+  unsigned long misses;         // Compiles that had to call pcre_compile()
+  unsigned long evictions;      // Entries dropped to honour the limit
+  unsigned long entries;        // Entries currently cached
+  unsigned long bytes;          // Memory charged to the cached entries
+};
+
+// A rewrite string for Replace(), GlobalReplace() and Extract(), parsed
+// into literal text and references to groups (\0 to \9).  A Rewriter
+// is immutable, so it is safe for concurrent use by multiple threads.
+class PCRECPP_EXP_DEFN Rewriter {
+ public:
+  explicit Rewriter(const StringPiece& rewrite);
+
+  // False if the rewrite string has an invalid backslash escape
+  bool ok() const { return ok_; }
+
+  // Highest group referred to, or 0 if none is
+  int max_group() const { return max_group_; }
+
+  // Append the rewrite of a match in "text" to "*out".  "vec" holds the
+  // offset pairs of the first "matches" groups, as TryMatch() returns
+  // them.  Groups that did not match, including any at or past
+  // "matches", insert nothing; the result is false if there were any
+  // of the latter.
+  bool Append(string* out, const StringPiece& text,
+              const int* vec, int matches) const;
+
+ private:
+  struct Segment {
+    int group;          // Group to insert, or -1 for literal text
+    int offset;         // Literal text in literals_
+    int length;
+  };
+
+  string                literals_;    // The literal text of all segments
+  std::vector<Segment>  segments_;
+  int                   max_group_;
+  bool                  ok_;
+};
+
+// The text of one match found by RE::FindAll(), and of its groups.
+// The pieces point into the subject, which must outlive them.
+class PCRECPP_EXP_DEFN MatchSpans {
+ public:
+  MatchSpans() : groups_(0) { }
+
+  // Group "n" (the whole match for n == 0), or a piece with NULL data
+  // if the group did not take part in the match
+  StringPiece operator[](int n) const {
+    if (n < 0 || n >= groups_ || vec_[2 * n] < 0) return StringPiece();
+    return StringPiece(text_.data() + vec_[2 * n],
+                       vec_[2 * n + 1] - vec_[2 * n]);
+  }
+
+  // Number of groups, counting the whole match as group 0
+  int size() const { return groups_; }
+
+  // Offset of the match in the subject
+  int position() const { return vec_[0]; }
+
+ private:
+  friend class RE;
+  StringPiece       text_;
+  std::vector<int>  vec_;          // Offset pairs, then PCRE workspace
+  int               groups_;
+};
+
+// An argument bound to a named capturing group, made by RE::Named().
+// It refers to the name and the destination, which must outlive it.
+class PCRECPP_EXP_DEFN NamedArg {
+ public:
+  NamedArg(const StringPiece& name, const Arg& arg)
+    : name_(name), arg_(arg) { }
+
+ private:
+  friend class RE;
+  StringPiece name_;
+  Arg         arg_;
+};
+
 // Interface for regular expression matching.  Also corresponds to a
 // pre-compiled regular expression.  An "RE" object is safe for
 // concurrent use by multiple threads.
@@ -499,22 +741,27 @@ class PCRECPP_EXP_DEFN RE {
     Init(reinterpret_cast<const char*>(pat), &option);
   }
 
-  // Copy constructor & assignment - note that these are expensive
-  // because they recompile the expression.
-  RE(const RE& re) { Init(re.pattern_, &re.options_); }
+  // Copy constructor & assignment - these are cheap, because the copy
+  // shares the compiled (and studied) programs of the original.
+  RE(const RE& re) { Copy(re); }
   const RE& operator=(const RE& re) {
     if (this != &re) {
       Cleanup();
-
-      // This is the code that originally came from Google
-      // Init(re.pattern_.c_str(), &re.options_);
-
-      // This is the replacement from Ari Pollak
-      Init(re.pattern_, &re.options_);
+      Copy(re);
     }
     return *this;
   }
 
+  // Move constructor & assignment.  The moved-from RE is left holding
+  // an empty pattern that matches nothing.
+  RE(RE&& re) noexcept { Move(&re); }
+  RE& operator=(RE&& re) noexcept {
+    if (this != &re) {
+      Cleanup();
+      Move(&re);
+    }
+    return *this;
+  }
 
   ~RE();
 
@@ -610,6 +857,19 @@ class PCRECPP_EXP_DEFN RE {
   int GlobalReplace(const StringPiece& rewrite,
                     string *str) const;
 
+  // GlobalReplace() with a parsed rewrite.  Returns 0, leaving "str"
+  // alone, if the rewrite is not ok().
+  int GlobalReplace(const Rewriter& rewriter,
+                    string *str) const;
+
+  // Store "text" with every match replaced in "*out", which must not
+  // alias "text".  The previous contents of "*out" are discarded but its
+  // capacity is kept, so a caller reusing one string need not allocate.
+  // Returns the number of replacements.
+  int GlobalReplace(const Rewriter& rewriter,
+                    const StringPiece& text,
+                    string *out) const;
+
   bool Extract(const StringPiece &rewrite,
                const StringPiece &text,
                string *out) const;
@@ -623,8 +883,26 @@ class PCRECPP_EXP_DEFN RE {
   // Note QuoteMeta behaves the same as perl's QuoteMeta function,
   // *except* that it escapes the NUL character (\0) as backslash + 0,
   // rather than backslash + NUL.
+  //
+  // A pattern that is nothing but plain text, such as QuoteMeta()
+  // output, is matched with a direct substring search instead of pcre,
+  // unless it is caseless, has partial matching requested, or has a
+  // UTF-8 subject that still needs checking.
   static string QuoteMeta(const StringPiece& unquoted);
 
+  /***** The cache of compiled expressions *****/
+
+  // Limit the memory used by the cache.  Entries are evicted, least
+  // recently used first, until the cache fits.  A limit of 0 disables
+  // caching.
+  static void SetCacheLimit(size_t bytes);
+  static size_t CacheLimit();
+
+  // Drop every cached entry.  REs keep the programs they already hold.
+  static void ClearCache();
+
+  static RE_CacheStats GetCacheStats();
+
 
   /***** Generic matching interface *****/
 
@@ -636,7 +914,8 @@ class PCRECPP_EXP_DEFN RE {
   };
 
   // General matching routine.  Stores the length of the match in
-  // "*consumed" if successful.
+  // "*consumed" if successful.  "consumed" may be NULL if the caller
+  // does not need the length.
   bool DoMatch(const StringPiece& text,
                Anchor anchor,
                int* consumed,
@@ -646,6 +925,126 @@ class PCRECPP_EXP_DEFN RE {
   // regexp wasn't valid on construction.
   int NumberOfCapturingGroups() const;
 
+  // Many patterns matched in one program; see below
+  class Set;
+
+  // Iterate over the successive matches of the pattern in "text", as
+  // GlobalReplace() would find them.  Each step runs one search that
+  // starts where the previous match ended; nothing is parsed.  "text"
+  // and the RE must outlive the iteration.
+  //
+  //    for (const pcrecpp::MatchSpans& m : re.FindAll(text))
+  //      Use(m[0], m[1]);
+  class FindAllIterator;
+  class FindAllRange;
+  FindAllRange FindAll(const StringPiece& text) const &;
+  FindAllRange FindAll(const StringPiece& text) const && = delete;
+
+  /***** Splitting *****/
+
+  // Break "text" into the fields between successive matches of the
+  // pattern, storing views into "text" in "*fields".  "fields" is
+  // cleared first but keeps its capacity, so a vector reused from line
+  // to line stops allocating.  Leading and trailing empty fields are
+  // kept; empty text has no fields.  An empty match never ends a field
+  // where it started, so RE("").Split("abc", ...) gives "a", "b", "c".
+  // If "max_fields" is positive, the last field holds the rest of the
+  // text unsplit.  Returns the number of fields, or -1 if the pattern
+  // is invalid.
+  //
+  //    std::vector<StringPiece> parts;
+  //    pcrecpp::RE(", ").Split("red, green, blue", &parts);
+  int Split(const StringPiece& text,
+            std::vector<StringPiece>* fields,
+            int max_fields = 0) const;
+
+  // Like Split(), but hands each field to "callback" (anything callable
+  // as bool(const StringPiece&)) as it is found, stopping early when the
+  // callback returns false.  Returns the number of fields passed to the
+  // callback, or -1 if the pattern is invalid.
+  template <class Callback>
+  int Tokenize(const StringPiece& text, Callback callback,
+               int max_fields = 0) const {
+    if (!error_->empty()) return -1;
+    int pos = text.empty() ? -1 : 0;
+    int count = 0;
+    StringPiece field;
+    while (NextField(text, max_fields > 0 && count == max_fields - 1,
+                     &pos, &field)) {
+      count++;
+      if (!callback(field)) break;
+    }
+    return count;
+  }
+
+  /***** Typed matching interface *****/
+
+  // Like FullMatch() (or DoMatch() with "anchor"), but takes any number
+  // of arguments and picks each parser at compile time from the
+  // argument's type.  Arguments may be pointers to any type FullMatch()
+  // accepts, Arg objects such as Hex(&i), or (void*)NULL to skip a
+  // group.  Fails without matching if the pattern has fewer capturing
+  // groups than there are arguments.
+  //
+  //    int year, month;
+  //    re.Match("2009-04", &year, &month);
+  template <class... A>
+  bool Match(const StringPiece& text, const A&... args) const {
+    return Match(text, ANCHOR_BOTH, args...);
+  }
+  template <class... A>
+  bool Match(const StringPiece& text, Anchor anchor, const A&... args) const {
+    int offsets[2 * sizeof...(A) + 2];
+    if (!MatchOffsets(text, anchor, sizeof...(A), offsets)) return false;
+    return ParseCaptures(text.data(), offsets, args...);
+  }
+
+  // Like Match(), but each argument is bound to a named group with
+  // Named() rather than taken in order.  Fails without matching if any
+  // name is not in the pattern.  Names are looked up in a hash table
+  // built once per compiled pattern.  A name that several groups share,
+  // with (?J) or in a (?| group, is bound to the first of them that took
+  // part in the match, as pcre_get_named_substring() does.
+  //
+  //    int t;
+  //    string unit;
+  //    re.MatchNamed("temp=21C", RE::Named("temp", &t),
+  //                  RE::Named("unit", &unit));
+  static NamedArg Named(const StringPiece& name, const Arg& arg) {
+    return NamedArg(name, arg);
+  }
+  template <class... A>
+  bool MatchNamed(const StringPiece& text, const A&... named) const {
+    return MatchNamed(text, ANCHOR_BOTH, named...);
+  }
+  template <class... A>
+  bool MatchNamed(const StringPiece& text, Anchor anchor,
+                  const A&... named) const {
+    const NamedArg* args[] = { NULL, &named... };
+    const std::vector<int>* groups[sizeof...(A) + 1];
+    return DoMatchNamed(text, anchor, args + 1, groups, sizeof...(A));
+  }
+
+  // The number of the capturing group called "name", or -1 if there is
+  // none (or the pattern is invalid).  With duplicate names, the lowest
+  // number is returned; MatchNamed() instead uses the first of them that
+  // took part in the match.
+  int NamedGroupIndex(const StringPiece& name) const;
+
+  // Parse the capturing groups into the elements of a std::tuple (or
+  // anything else std::get and std::tuple_size work on), in order.
+  //
+  //    std::tuple<string, int> t;
+  //    re.MatchInto("ruby:1234", &t);
+  template <class Tuple>
+  bool MatchInto(const StringPiece& text, Tuple* out,
+                 Anchor anchor = ANCHOR_BOTH) const {
+    static const int n = std::tuple_size<Tuple>::value;
+    int offsets[2 * n + 2];
+    if (!MatchOffsets(text, anchor, n, offsets)) return false;
+    return ParseTuple<Tuple, 0>(text.data(), offsets, out);
+  }
+
   // The default value for an argument, to indicate the end of the argument
   // list. This must be used only in optional argument defaults. It should NOT
   // be passed explicitly. Some people have tried to use it like this:
@@ -657,7 +1056,17 @@ class PCRECPP_EXP_DEFN RE {
 
  private:
 
+  // One compiled (and possibly studied) form of the pattern.  Programs
+  // are shared through the cache and reference counted.
+  struct Program;
+  friend class ProgramCache;
+
+  friend class StreamMatcher;
+  friend class StreamScanner;
+
   void Init(const string& pattern, const RE_Options* options);
+  void Copy(const RE& re);
+  void Move(RE* re) noexcept;
   void Cleanup();
 
   // Match against "text", filling in "vec" (up to "vecsize" * 2/3) with
@@ -671,12 +1080,25 @@ class PCRECPP_EXP_DEFN RE {
   // against "foo", "bar", and "baz" respectively.
   // When matching RE("(foo)|hello") against "hello", it will return 1.
   // But the values for all subpattern are filled in into "vec".
+  // If "mark" is not NULL, it is set to the name of the last (*MARK)
+  // passed on the matching path, or NULL if there was none.
   int TryMatch(const StringPiece& text,
                int startpos,
                Anchor anchor,
                bool empty_ok,
                int *vec,
-               int vecsize) const;
+               int vecsize,
+               const unsigned char** mark = NULL) const;
+
+  // The pcre_exec() call underneath TryMatch(), taking extra pcre_exec()
+  // "options" and returning its result code unchanged.
+  int Exec(const StringPiece& text,
+           int startpos,
+           Anchor anchor,
+           int options,
+           int *vec,
+           int vecsize,
+           const unsigned char** mark) const;
 
   // Append the "rewrite" string, with backslash subsitutions from "text"
   // and "vec", to string "out".
@@ -686,6 +1108,71 @@ class PCRECPP_EXP_DEFN RE {
                int *vec,
                int veclen) const;
 
+  // Store in "*field" the field of "text" that starts at "*pos", and
+  // advance "*pos" past the separator that ends it (to -1 after the
+  // last field).  With "last", the field runs to the end of "text".
+  // Returns false, doing nothing, if "*pos" is already -1.
+  bool NextField(const StringPiece& text, bool last, int* pos,
+                 StringPiece* field) const;
+
+  // Match against "text" and store the offsets of the first "n"
+  // capturing groups in "offsets" (2 * n ints).  Returns false if the
+  // match failed or the pattern has fewer than "n" groups.
+  bool MatchOffsets(const StringPiece& text,
+                    Anchor anchor,
+                    int n,
+                    int* offsets) const;
+
+  // MatchNamed() on "n" arguments, using "groups" (room for "n"
+  // pointers) to hold the group numbers of their names
+  bool DoMatchNamed(const StringPiece& text,
+                    Anchor anchor,
+                    const NamedArg* const* args,
+                    const std::vector<int>** groups,
+                    int n) const;
+
+  // The numbers of the groups called "name", lowest first, or NULL
+  const std::vector<int>* NamedGroups(const StringPiece& name) const;
+
+  // Parse each capture of the typed matching interface in turn
+  static bool ParseCaptures(const char* text, const int* offsets) {
+    (void)text;
+    (void)offsets;
+    return true;
+  }
+  // A group that took no part in the match is parsed as (NULL, 0).
+  template <class T, class... A>
+  static bool ParseCaptures(const char* text, const int* offsets,
+                            const T& arg, const A&... rest) {
+    const int start = offsets[0];
+    const bool ok = (start == -1)
+        ? Arg::ParseInto(NULL, 0, arg)
+        : Arg::ParseInto(text + start, offsets[1] - start, arg);
+    return ok && ParseCaptures(text, offsets + 2, rest...);
+  }
+
+  template <class Tuple, size_t I>
+  static typename std::enable_if<I == std::tuple_size<Tuple>::value,
+                                 bool>::type
+  ParseTuple(const char* text, const int* offsets, Tuple* out) {
+    (void)text;
+    (void)offsets;
+    (void)out;
+    return true;
+  }
+  template <class Tuple, size_t I>
+  static typename std::enable_if<I < std::tuple_size<Tuple>::value,
+                                 bool>::type
+  ParseTuple(const char* text, const int* offsets, Tuple* out) {
+    const int start = offsets[2 * I];
+    const bool ok = (start == -1)
+        ? Arg::ParseInto(NULL, 0, &std::get<I>(*out))
+        : Arg::ParseInto(text + start, offsets[2 * I + 1] - start,
+                         &std::get<I>(*out));
+    if (!ok) return false;
+    return ParseTuple<Tuple, I + 1>(text, offsets, out);
+  }
+
   // internal implementation for DoMatch
   bool DoMatchImpl(const StringPiece& text,
                    Anchor anchor,
@@ -695,16 +1182,213 @@ class PCRECPP_EXP_DEFN RE {
                    int* vec,
                    int vecsize) const;
 
-  // Compile the regexp for the specified anchoring mode
-  pcre* Compile(Anchor anchor);
+  // Return a referenced program for the specified anchoring mode,
+  // from the cache or freshly compiled.  On failure, returns NULL and
+  // points "*error" at the pcre error message.
+  Program* Compile(Anchor anchor, const char** error) const;
+
+  // Size of the offset vector to pass to TryMatch() when extracting
+  // "n" submatches.  Pass -1 if no offsets are needed at all.
+  int VecSize(int n) const;
+
+  // Compile the regexp for the specified anchoring mode, bypassing
+  // the cache.  The result holds one reference.
+  Program* CompileProgram(Anchor anchor, const char** error) const;
+
+  // Study "re" if options_ ask for it.  Returns NULL if the pattern
+  // was not studied or studying found nothing useful.
+  pcre_extra* Study(pcre* re) const;
+
+  // Return the program to use for "anchor", compiling it if this is
+  // the first match that needs it.  Returns NULL if the pattern is
+  // invalid.  Safe to call from several threads at once.
+  const Program* GetProgram(Anchor anchor) const;
 
   string        pattern_;
   RE_Options    options_;
-  pcre*         re_full_;       // For full matches
-  pcre*         re_partial_;    // For partial matches
+  Program*      partial_;       // For partial matches
+  // The anchored forms are compiled on first use, and may share the
+  // partial form.  full_ is used for full matches, start_ only for JIT
+  // matches anchored at the start.  Each holds its own reference.
+  mutable std::atomic<Program*> full_;
+  mutable std::atomic<Program*> start_;
   const string* error_;         // Error indicator (or points to empty string)
 };
 
+// Steps through the matches of an RE::FindAll() range, holding the
+// spans of the current match.  Only single-pass iteration is supported.
+class PCRECPP_EXP_DEFN RE::FindAllIterator {
+ public:
+  typedef std::input_iterator_tag iterator_category;
+  typedef MatchSpans              value_type;
+  typedef std::ptrdiff_t          difference_type;
+  typedef const MatchSpans*       pointer;
+  typedef const MatchSpans&       reference;
+
+  // The end of every iteration
+  FindAllIterator() : re_(NULL), start_(0), last_match_was_empty_(false) { }
+
+  const MatchSpans& operator*() const { return match_; }
+  const MatchSpans* operator->() const { return &match_; }
+  FindAllIterator& operator++() {
+    Next();
+    return *this;
+  }
+
+  bool operator==(const FindAllIterator& other) const {
+    return re_ == other.re_ && (re_ == NULL || start_ == other.start_);
+  }
+  bool operator!=(const FindAllIterator& other) const {
+    return !(*this == other);
+  }
+
+ private:
+  friend class RE;
+  FindAllIterator(const RE* re, const StringPiece& text);
+
+  // Find the next match, or become the end iterator
+  void Next();
+
+  const RE*     re_;            // NULL once there are no more matches
+  int           start_;         // Where the next search starts
+  bool          last_match_was_empty_;
+  MatchSpans    match_;
+};
+
+class PCRECPP_EXP_DEFN RE::FindAllRange {
+ public:
+  FindAllIterator begin() const { return FindAllIterator(re_, text_); }
+  FindAllIterator end() const { return FindAllIterator(); }
+
+ private:
+  friend class RE;
+  FindAllRange(const RE* re, const StringPiece& text)
+    : re_(re), text_(text) { }
+
+  const RE*     re_;
+  StringPiece   text_;
+};
+
+// A set of patterns matched together in one program.  Add the
+// patterns, call Compile() once, then match from any number of threads.
+class PCRECPP_EXP_DEFN RE::Set {
+ public:
+  // All patterns share "anchor" and "options".
+  explicit Set(Anchor anchor = UNANCHORED,
+               const RE_Options& options = RE_Options());
+  ~Set();
+
+  // Add "pattern" to the set.  Returns its index, counting from zero,
+  // or -1 if it does not compile, names a group that an earlier pattern
+  // also names, or the set is already compiled, in which case "*error"
+  // (if not NULL) describes the problem.
+  int Add(const StringPiece& pattern, string* error);
+
+  // Build the combined programs.  Returns false if that fails, or if
+  // the set is already compiled.
+  bool Compile();
+
+  // Number of patterns added so far
+  int size() const { return static_cast<int>(patterns_.size()); }
+
+  // Return the index of the pattern that matches earliest in "text",
+  // preferring the lowest index when several match at the same place,
+  // or -1 if none does.  This is a single scan of "text", apart from
+  // patterns that refer to their groups by number.
+  int FirstMatch(const StringPiece& text) const;
+
+  // Store the indices of all patterns that match somewhere in "text"
+  // in "*matches", in increasing order.  Returns true if any matched.
+  // This is one pcre_exec() call, apart from patterns that refer to
+  // their groups by number, but unless the set is anchored each
+  // pattern scans "text" separately within it.
+  bool Match(const StringPiece& text, std::vector<int>* matches) const;
+
+  // Return the index of the pattern whose match starts earliest in
+  // "text" and, among those, is longest, preferring the lowest index
+  // on a tie; or -1 if none matches.  Each pattern's match is the one
+  // it finds on its own.  Stores the match in "*match".  This costs
+  // the same as Match().
+  int LongestMatch(const StringPiece& text, StringPiece* match) const;
+
+ private:
+  Set(const Set&) = delete;
+  Set& operator=(const Set&) = delete;
+
+  Anchor                anchor_;
+  RE_Options            options_;
+  std::vector<string>   patterns_;
+  std::vector<RE*>      res_;         // Each pattern on its own
+  RE*                   first_;       // Alternation tagged with (*MARK)
+  RE*                   all_;         // One capturing lookahead per pattern
+  std::vector<int>      groups_;      // Group of each pattern in all_
+  std::vector<int>      separate_;    // Patterns left out of first_
+  bool                  compiled_;
+};
+
+// Searches for an RE in text that arrives in pieces.  Each piece is
+// appended to what is left of the earlier ones and searched with
+// PCRE_PARTIAL_HARD, so a match that may continue into data not yet
+// seen is reported as NEED_MORE rather than cut short.  Only the bytes
+// a partial match still needs (plus any lookbehind context) are kept;
+// rejected data is dropped and never searched again.  The RE must
+// outlive the matcher.  A StreamMatcher is not safe for concurrent use.
+class PCRECPP_EXP_DEFN StreamMatcher {
+ public:
+  enum Status {
+    NO_MATCH,           // No match, and no match in progress
+    NEED_MORE,          // A match may complete with more data
+    MATCHED             // match() holds a complete match
+  };
+
+  explicit StreamMatcher(const RE& re);
+  StreamMatcher(RE&& re) = delete;      // Would outlive its RE
+
+  // Append "chunk" and search for the next match.  After MATCHED, call
+  // again (with more data or an empty piece) for the match after it.
+  Status Feed(const StringPiece& chunk);
+
+  // Signal the end of the input: a match waiting for more data is
+  // resolved as a complete match or dropped.  Like Feed(), may be
+  // called again after MATCHED for later matches.
+  Status Finish();
+
+  // Capturing group "n" of the last match (the whole match for n == 0),
+  // or an empty piece if it did not participate.  Valid until the next
+  // call to Feed(), Finish() or Reset().
+  StringPiece match(int n = 0) const;
+
+  // Offset of the last match from the start of the stream
+  size_t match_position() const { return base_ + vec_[0]; }
+
+  // Number of bytes currently held back
+  size_t buffered() const { return buffer_.size() - discard_; }
+
+  // Forget all input and start a new stream
+  void Reset();
+
+ private:
+  StreamMatcher(const StreamMatcher&) = delete;
+  StreamMatcher& operator=(const StreamMatcher&) = delete;
+
+  // Run one search from start_ with the extra pcre_exec() "options"
+  Status Search(int options);
+  // Mark the bytes not needed once searching resumes at "start"
+  void Discard(size_t start);
+  // Drop the bytes marked by Discard()
+  void Compact();
+
+  const RE&         re_;
+  size_t            context_;       // Bytes kept before the search start
+  string            buffer_;
+  size_t            base_;          // Stream offset of buffer_[0]
+  size_t            discard_;       // Bytes of buffer_ no longer needed
+  int               start_;         // Where the next search starts
+  bool              after_empty_;   // The last match was empty at start_
+  bool              matched_;
+  std::vector<int>  vec_;
+};
+
 }   // namespace pcrecpp
 
 #endif /* _PCRECPP_H */
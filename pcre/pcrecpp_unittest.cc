@@ -37,6 +37,7 @@
 #include "config.h"
 #endif
 
+#include <ctype.h>
 #include <stdio.h>
 #include <string.h>      /* for memset and strcmp */
 #include <cassert>
@@ -549,12 +550,57 @@ static void TestQuoteMetaUtf8() {
 #endif
 }
 
+// Plain-text patterns skip pcre; they must still match exactly as the
+// same text in a group (which does go through pcre) would.
+static void TestLiteralPattern(const string& pattern, const string& text) {
+  RE literal(pattern), grouped("(?:" + pattern + ")");
+  StringPiece a(text), b(text);
+  CHECK_EQ(literal.PartialMatch(text), grouped.PartialMatch(text));
+  CHECK_EQ(literal.FullMatch(text), grouped.FullMatch(text));
+  CHECK_EQ(literal.Consume(&a), grouped.Consume(&b));
+  CHECK_EQ(a.size(), b.size());
+  while (literal.FindAndConsume(&a)) {
+    CHECK(grouped.FindAndConsume(&b));
+    CHECK(a.data() == b.data());
+  }
+  CHECK(!grouped.FindAndConsume(&b));
+  string s1 = text, s2 = text;
+  CHECK_EQ(literal.GlobalReplace("<\\0>", &s1),
+           grouped.GlobalReplace("<\\0>", &s2));
+  CHECK_EQ(s1, s2);
+}
+
+static void TestQuoteMetaLiteral() {
+  CHECK_EQ(RE::QuoteMeta(""), "");
+  CHECK_EQ(RE::QuoteMeta("word_123"), "word_123");
+  CHECK_EQ(RE::QuoteMeta("1.5-2.0?"), "1\\.5\\-2\\.0\\?");
+  CHECK_EQ(RE::QuoteMeta(string("a\0b", 3)), "a\\0b");
+  CHECK_EQ(RE::QuoteMeta("\xb2 \xc3\xa1"), "\xb2\\ \xc3\xa1");
+
+  TestLiteralPattern("abc", "abc");
+  TestLiteralPattern("abc", "xxabcabcxabc");
+  TestLiteralPattern("abc", "ab");
+  TestLiteralPattern("abc", "");
+  TestLiteralPattern("aab", "aaab aab");
+  TestLiteralPattern("x", "axbxx");
+  TestLiteralPattern(RE::QuoteMeta("a.b"), "a.bxa-b");
+  TestLiteralPattern(RE::QuoteMeta("1+1=2"), "1+1=2");
+  TestLiteralPattern("]}", "a]}b");
+  TestLiteralPattern(RE::QuoteMeta(string("\0", 1)), string("a\0b\0", 4));
+
+  // Options that change what plain text matches are respected
+  CHECK(RE("abc", RE_Options().set_caseless(true)).FullMatch("ABC"));
+  CHECK(RE("a b", RE_Options().set_extended(true)).FullMatch("ab"));
+  CHECK(!RE("a b", RE_Options().set_extended(true)).FullMatch("a b"));
+}
+
 static void TestQuoteMetaAll() {
   printf("Testing QuoteMeta\n");
   TestQuotaMetaSimple();
   TestQuoteMetaSimpleNegative();
   TestQuoteMetaLatin1();
   TestQuoteMetaUtf8();
+  TestQuoteMetaLiteral();
 }
 
 //
@@ -806,6 +852,997 @@ static void TestConstructors() {
   CHECK(orig.FullMatch(str));
   CHECK(copy1.FullMatch(str));
   CHECK(copy2.FullMatch(str));
+
+  // Copies share the compiled programs instead of recompiling
+  pcrecpp::RE_CacheStats before = RE::GetCacheStats();
+  RE copy3(orig);
+  copy3 = copy1;
+  CHECK(copy3.FullMatch(str));
+  pcrecpp::RE_CacheStats after = RE::GetCacheStats();
+  CHECK_EQ(after.hits, before.hits);
+  CHECK_EQ(after.misses, before.misses);
+
+  // Moves leave the source matching nothing
+  RE moved(std::move(copy3));
+  CHECK(moved.FullMatch(str));
+  CHECK(!copy3.PartialMatch(str));
+  CHECK_EQ(copy3.NumberOfCapturingGroups(), -1);
+  copy3 = std::move(moved);
+  CHECK(copy3.FullMatch(str));
+  CHECK(!moved.PartialMatch(str));
+  copy3 = copy3;
+  CHECK(copy3.FullMatch(str));
+
+  // Errors travel with copies
+  RE bad("a(b");
+  RE bad_copy(bad);
+  CHECK_EQ(bad_copy.error(), bad.error());
+  CHECK(!bad_copy.error().empty());
+
+  // Containers copy and move REs as they grow
+  std::vector<RE> res;
+  for (int i = 0; i < 100; i++)
+    res.push_back(RE(i % 2 ? "(\\d+)" : "([a-z]+)", options));
+  int n;
+  CHECK(res[99].FullMatch("42", &n));
+  CHECK_EQ(n, 42);
+  CHECK(res[98].FullMatch("abc"));
+  CHECK(!res[98].FullMatch("42"));
+}
+
+static void TestStudyAndJit() {
+  printf("Testing study and JIT\n");
+
+  RE_Options plain;
+  RE_Options studied;
+  studied.set_study(true);
+  RE_Options jitted;
+  jitted.set_jit(true);
+  CHECK(!plain.study());
+  CHECK(studied.study());
+  CHECK(!studied.jit());
+  CHECK(jitted.study());
+  CHECK(jitted.jit());
+
+  const RE_Options* all[] = { &plain, &studied, &jitted };
+  for (int i = 0; i < 3; i++) {
+    const RE_Options& options = *all[i];
+    int n;
+    string s;
+    RE re("(\\w+):(\\d+)", options);
+    CHECK(re.error().empty());
+    CHECK(re.FullMatch("ruby:1234", &s, &n));
+    CHECK_EQ(s, "ruby");
+    CHECK_EQ(n, 1234);
+    CHECK(!re.FullMatch("ruby:1234x"));
+    CHECK(re.PartialMatch("x ruby:1234 y", &s, &n));
+    CHECK_EQ(n, 1234);
+
+    StringPiece input("a:1 b:2 c");
+    CHECK(re.Consume(&input, &s, &n));
+    CHECK_EQ(s, "a");
+    CHECK(!re.Consume(&input));     // anchored at " b:2"
+    CHECK(re.FindAndConsume(&input, &s, &n));
+    CHECK_EQ(n, 2);
+    CHECK(!re.FindAndConsume(&input));
+
+    string str("yabba dabba doo");
+    CHECK_EQ(RE("b*", options).GlobalReplace("-", &str), 14);
+    CHECK_EQ(str, "-y-a--a- -d-a--a- -d-o-o-");
+
+    // Copies keep the options
+    RE copy(re);
+    CHECK(copy.FullMatch("perl:5", &s, &n));
+    CHECK_EQ(n, 5);
+
+    // Anchored alternatives
+    RE alt("a|ab", options);
+    CHECK(alt.FullMatch("ab"));
+    CHECK(!alt.FullMatch("abc"));
+  }
+
+  // Match limits still apply when studied
+  RE_Options limited;
+  limited.set_study(true).set_match_limit(100);
+  CHECK(!RE("(a+)+b", limited).FullMatch("aaaaaaaaaaaaaaaaaaaaaaaaac"));
+}
+
+static void TestEndAnchoredPatterns() {
+  printf("Testing patterns that end in \\z\n");
+
+  RE_Options jitted;
+  jitted.set_jit(true);
+  const RE_Options all[] = { RE_Options(), jitted };
+  for (int i = 0; i < 2; i++) {
+    int n;
+    RE re("(\\d+)\\z", all[i]);
+    CHECK(re.FullMatch("123", &n));
+    CHECK_EQ(n, 123);
+    CHECK(!re.FullMatch("x123"));
+    CHECK(!re.FullMatch("123\n"));
+    CHECK(re.PartialMatch("x123", &n));
+    CHECK_EQ(n, 123);
+
+    // "\\z" is a literal backslash followed by 'z'
+    CHECK(RE("a\\\\z", all[i]).FullMatch("a\\z"));
+
+    // The \z only applies to the last alternative
+    RE alt("a|b\\z", all[i]);
+    CHECK(alt.FullMatch("a"));
+    CHECK(alt.FullMatch("b"));
+    CHECK(!alt.FullMatch("ab"));
+  }
+}
+
+static void TestCache() {
+  printf("Testing the compiled expression cache\n");
+
+  const size_t old_limit = RE::CacheLimit();
+  RE::ClearCache();
+  pcrecpp::RE_CacheStats before = RE::GetCacheStats();
+  CHECK_EQ(before.entries, 0);
+  CHECK_EQ(before.bytes, 0);
+
+  {
+    RE first("cache (\\d+) test");
+    RE second("cache (\\d+) test");
+    RE caseless("cache (\\d+) test", pcrecpp::CASELESS());
+    pcrecpp::RE_CacheStats after = RE::GetCacheStats();
+    CHECK_EQ(after.hits, before.hits + 1);
+    CHECK_EQ(after.misses, before.misses + 2);
+    CHECK_EQ(after.entries, 2);
+
+    // Cleared entries stay usable by the REs that hold them
+    RE::ClearCache();
+    int n;
+    CHECK(first.FullMatch("cache 12 test", &n));
+    CHECK_EQ(n, 12);
+    CHECK(second.PartialMatch("x cache 13 test", &n));
+    CHECK_EQ(n, 13);
+    CHECK(caseless.FullMatch("CACHE 14 TEST", &n));
+    CHECK_EQ(n, 14);
+  }
+
+  // A limit of zero disables the cache
+  RE::SetCacheLimit(0);
+  {
+    RE first("cache (\\d+) test");
+    RE second("cache (\\d+) test");
+    CHECK(second.FullMatch("cache 1 test"));
+    CHECK_EQ(RE::GetCacheStats().entries, 0);
+  }
+
+  // A small limit evicts the least recently used entries
+  RE::SetCacheLimit(64 << 10);
+  pcrecpp::RE_CacheStats start = RE::GetCacheStats();
+  for (int i = 0; i < 2000; i++) {
+    char buf[100];
+    sprintf(buf, "pat%09d(a|b|c)+x?y*z{1,3}", i);
+    RE re(buf);
+    CHECK(re.error().empty());
+  }
+  pcrecpp::RE_CacheStats full = RE::GetCacheStats();
+  CHECK(full.evictions > start.evictions);
+  CHECK(full.bytes <= (64 << 10));
+
+  RE::SetCacheLimit(old_limit);
+  RE::ClearCache();
+}
+
+static void TestVectorSizing() {
+  printf("Testing offset vector sizing\n");
+
+  // Matches without arguments still honour back references
+  CHECK(RE("(a+)b\\1").FullMatch("aabaa"));
+  CHECK(!RE("(a+)b\\1").FullMatch("aaba"));
+  CHECK(RE("(a)(b)(c)(d)(e)(f)(g)(h)(i)(j)(k)(l)(m)(n)(o)(p)(q)\\17")
+        .PartialMatch("xabcdefghijklmnopqq"));
+
+  // More groups than arguments
+  int a;
+  CHECK(RE("(\\d+)-(\\d+)-(\\d+)").FullMatch("1-2-3", &a));
+  CHECK_EQ(a, 1);
+
+  // More groups than kMaxArgs
+  CHECK(RE("((((((((((((((((((((x))))))))))))))))))))").FullMatch("x"));
+
+  // DoMatch without "consumed"
+  const RE re("(\\w+)");
+  CHECK(re.DoMatch("hello", RE::ANCHOR_START, NULL, NULL, 0));
+  CHECK(!re.DoMatch(" hello", RE::ANCHOR_START, NULL, NULL, 0));
+  CHECK(!RE("(").DoMatch("(", RE::UNANCHORED, NULL, NULL, 0));
+  CHECK(!RE("(").PartialMatch("("));
+  int consumed;
+  CHECK(re.DoMatch("hello world", RE::ANCHOR_START, &consumed, NULL, 0));
+  CHECK_EQ(consumed, 5);
+
+  // Rewrites only size the vector for the groups they refer to
+  string s = "one two three";
+  CHECK(RE("(\\w+) (\\w+) (\\w+)").Replace("\\3 \\1", &s));
+  CHECK_EQ(s, "three one");
+  s = "a";
+  CHECK(!RE("(a)|(b)").Replace("\\2", &s));
+  string out;
+  CHECK(RE("(\\w+)@(\\w+)").Extract("\\2!\\0", "mail kremenek@google x",
+                                     &out));
+  CHECK_EQ(out, "google!kremenek@google");
+}
+
+static void TestNumberParsing() {
+  printf("Testing number parsing\n");
+
+  // Runs long enough to take the eight-digit fast path
+  long l;
+  CHECK(RE("(.*)").FullMatch("12345678", &l));  CHECK_EQ(l, 12345678);
+  CHECK(RE("(.*)").FullMatch("-1234567890123", &l) || sizeof(long) < 8);
+  CHECK(!RE("(.*)").FullMatch("1234567x", &l));
+  CHECK(!RE("(.*)").FullMatch("1234567890123456789012", &l));
+  CHECK(!RE("(.*)").FullMatch("", &l));
+  CHECK(!RE("(.*)").FullMatch("-", &l));
+  CHECK(!RE("(.*)").FullMatch(" 1", &l));
+  CHECK(!RE("(.*)").FullMatch("1 ", &l));
+  CHECK(!RE("(.*)").FullMatch("--1", &l));
+  CHECK(RE("(.*)").FullMatch("+17", &l));  CHECK_EQ(l, 17);
+  CHECK(RE("(.*)").FullMatch("-0", &l));   CHECK_EQ(l, 0);
+
+  // Only the matched piece is parsed, not what follows it
+  int i;
+  CHECK(RE("(\\d+)").PartialMatch("x123456789012345678901", &i) == false);
+  CHECK(RE("(\\d{3})").PartialMatch("12345678", &i));  CHECK_EQ(i, 123);
+
+  // Radix prefixes
+  CHECK(RE("(.*)").FullMatch("0x1F", pcrecpp::Hex(&i)));  CHECK_EQ(i, 31);
+  CHECK(RE("(.*)").FullMatch("-0x10", pcrecpp::Hex(&i))); CHECK_EQ(i, -16);
+  CHECK(!RE("(.*)").FullMatch("0x", pcrecpp::Hex(&i)));
+  CHECK(!RE("(.*)").FullMatch("0xg", pcrecpp::Hex(&i)));
+  CHECK(RE("(.*)").FullMatch("017", pcrecpp::CRadix(&i)));  CHECK_EQ(i, 15);
+  CHECK(RE("(.*)").FullMatch("0x17", pcrecpp::CRadix(&i))); CHECK_EQ(i, 23);
+  CHECK(RE("(.*)").FullMatch("17", pcrecpp::CRadix(&i)));   CHECK_EQ(i, 17);
+  CHECK(!RE("(.*)").FullMatch("018", pcrecpp::CRadix(&i)));
+  CHECK(!RE("(.*)").FullMatch("8", pcrecpp::Octal(&i)));
+
+  unsigned int u;
+  CHECK(!RE("(.*)").FullMatch("-1", &u));
+  CHECK(RE("(.*)").FullMatch("ffffffff", pcrecpp::Hex(&u)));
+  CHECK_EQ(u, 0xffffffffu);
+  CHECK(!RE("(.*)").FullMatch("100000000", pcrecpp::Hex(&u)));
+
+#if defined HAVE_UNSIGNED_LONG_LONG && defined HAVE_LONG_LONG
+  long long ll;
+  unsigned long long ull;
+  CHECK(RE("(.*)").FullMatch("1234567812345678", &ll));
+  CHECK_EQ(ll, 1234567812345678LL);
+  CHECK(RE("(.*)").FullMatch("-9223372036854775808", &ll));
+  CHECK_EQ(ll, -0x7fffffffffffffffLL - 1);
+  CHECK(!RE("(.*)").FullMatch("-9223372036854775809", &ll));
+  CHECK(!RE("(.*)").FullMatch("9223372036854775808", &ll));
+  CHECK(RE("(.*)").FullMatch("18446744073709551615", &ull));
+  CHECK_EQ(ull, 0xffffffffffffffffULL);
+  CHECK(!RE("(.*)").FullMatch("18446744073709551616", &ull));
+  CHECK(!RE("(.*)").FullMatch("99999999999999999999", &ull));
+  CHECK(RE("(.*)").FullMatch("00000000000000000000000001", &ull));
+  CHECK_EQ(ull, 1);
+#endif
+
+  // Doubles must agree exactly with strtod()
+  static const char* const kDoubles[] = {
+    "0", "-0", "1", "1.", ".5", "0.1", "0.3", "3.14159", "-2.5e-3", "1e22",
+    "1e23", "9007199254740993", "123456789012345678", "1.7976931348623157e308",
+    "2.2250738585072014e-308", "0.000000000000000000000001",
+    "123.456e-5", "1E+10", "inf", "-nan", "0x1p3", "7e-23", "12345.6789",
+  };
+  for (size_t k = 0; k < sizeof(kDoubles) / sizeof(*kDoubles); k++) {
+    double d;
+    CHECK(RE("(.*)").FullMatch(kDoubles[k], &d));
+    double expected = strtod(kDoubles[k], NULL);
+    CHECK(memcmp(&d, &expected, sizeof(d)) == 0 ||
+          (d != d && expected != expected));
+  }
+  double d;
+  CHECK(!RE("(.*)").FullMatch("", &d));
+  CHECK(!RE("(.*)").FullMatch(".", &d));
+  CHECK(!RE("(.*)").FullMatch("1e", &d));
+  CHECK(!RE("(.*)").FullMatch("1e+", &d));
+  CHECK(!RE("(.*)").FullMatch("1.5x", &d));
+  CHECK(!RE("(.*)").FullMatch("1e999", &d));
+  CHECK(!RE("(.*)").FullMatch("4.9e-324", &d));   // ERANGE, as before
+  CHECK(RE("([\\d.]+)").PartialMatch("2.5e7", &d));
+  CHECK_EQ(d, 2.5);
+}
+
+static void TestTypedMatch() {
+  printf("Testing typed matching interface\n");
+
+  int i;
+  string s;
+  StringPiece sp;
+  double d;
+  const RE re("(\\w+):(\\d+)");
+  CHECK(re.Match("ruby:1234", &s, &i));
+  CHECK_EQ(s, "ruby");
+  CHECK_EQ(i, 1234);
+  CHECK(re.Match("perl:5", &sp));
+  CHECK_EQ(sp.as_string(), "perl");
+  CHECK(re.Match("ruby:1234"));
+  CHECK(!re.Match("ruby:1234x"));
+  CHECK(re.Match("x ruby:1234 y", RE::UNANCHORED, (void*)NULL, &i));
+  CHECK_EQ(i, 1234);
+  CHECK(re.Match("ruby:1234 y", RE::ANCHOR_START, &s));
+  CHECK(!re.Match("x ruby:1234", RE::ANCHOR_START, &s));
+
+  // Parse failures and too many arguments
+  CHECK(!re.Match("ruby:99999999999999", &s, &i));
+  CHECK(!re.Match("ruby:1234", &s, &i, &d));
+  CHECK(!RE("(", RE_Options()).Match("(", &s));
+
+  // Arg objects are accepted alongside plain pointers
+  CHECK(RE("(\\w+) (\\w+)").Match("ff 10", pcrecpp::Hex(&i), &d));
+  CHECK_EQ(i, 255);
+  CHECK_EQ(d, 10.0);
+
+  // Objects with a ParseFrom() method
+  struct Upper {
+    string value;
+    bool ParseFrom(const char* str, int n) {
+      value.assign(str, n);
+      for (size_t k = 0; k < value.size(); k++)
+        value[k] = toupper(value[k]);
+      return true;
+    }
+  } upper;
+  CHECK(re.Match("ruby:1", &upper));
+  CHECK_EQ(upper.value, "RUBY");
+
+  // More than 16 arguments
+  int a[20];
+  string pattern, text;
+  for (int k = 0; k < 20; k++) {
+    pattern += "(\\d)";
+    text += static_cast<char>('0' + k % 10);
+  }
+  CHECK(RE(pattern).Match(text, &a[0], &a[1], &a[2], &a[3], &a[4], &a[5],
+                          &a[6], &a[7], &a[8], &a[9], &a[10], &a[11], &a[12],
+                          &a[13], &a[14], &a[15], &a[16], &a[17], &a[18],
+                          &a[19]));
+  for (int k = 0; k < 20; k++) CHECK_EQ(a[k], k % 10);
+
+  // Tuples
+  std::tuple<string, int> t;
+  CHECK(re.MatchInto("ruby:1234", &t));
+  CHECK_EQ(std::get<0>(t), "ruby");
+  CHECK_EQ(std::get<1>(t), 1234);
+  std::tuple<StringPiece, double> t2;
+  CHECK(re.MatchInto("a:1 b:2", &t2, RE::UNANCHORED));
+  CHECK_EQ(std::get<0>(t2).as_string(), "a");
+  CHECK_EQ(std::get<1>(t2), 1.0);
+  std::tuple<int, int> t3;
+  CHECK(!re.MatchInto("ruby:1234", &t3));
+  std::tuple<string, int, int> t4;
+  CHECK(!re.MatchInto("ruby:1234", &t4));
+
+  // Groups that take no part in the match are parsed as empty
+  const RE optional("(a)?b");
+  string word = "unset";
+  StringPiece piece("unset");
+  CHECK(optional.Match("b", &word));
+  CHECK_EQ(word, "");
+  CHECK(optional.Match("b", &piece));
+  CHECK(piece.data() == NULL);
+  CHECK_EQ(piece.size(), 0);
+  CHECK(!optional.Match("b", &i));
+  std::tuple<StringPiece> t5(StringPiece("unset"));
+  CHECK(optional.MatchInto("b", &t5));
+  CHECK(std::get<0>(t5).data() == NULL);
+  CHECK(optional.MatchInto("ab", &t5));
+  CHECK_EQ(std::get<0>(t5).as_string(), "a");
+}
+
+static void TestSet() {
+  printf("Testing RE::Set\n");
+
+  RE::Set set;
+  string error;
+  CHECK_EQ(set.Add("foo", &error), 0);
+  CHECK_EQ(set.Add("b(a)r", &error), 1);
+  CHECK_EQ(set.Add("(\\d)\\1", &error), 2);      // back reference
+  CHECK_EQ(set.Add("\\Qa|b", &error), 3);        // unterminated \Q
+  CHECK_EQ(set.Add("(", &error), -1);
+  CHECK(!error.empty());
+  CHECK_EQ(set.size(), 4);
+  CHECK(set.Compile());
+  CHECK(!set.Compile());
+  CHECK_EQ(set.Add("baz", &error), -1);
+
+  std::vector<int> m;
+  CHECK_EQ(set.FirstMatch("xx bar foo"), 1);
+  CHECK_EQ(set.FirstMatch("xx foo bar"), 0);
+  CHECK_EQ(set.FirstMatch("x 122 y"), 2);
+  CHECK_EQ(set.FirstMatch("a|b"), 3);
+  CHECK_EQ(set.FirstMatch("a"), -1);
+  CHECK_EQ(set.FirstMatch(""), -1);
+  CHECK(set.Match("xx bar foo 11", &m));
+  CHECK_EQ(m.size(), 3);
+  CHECK_EQ(m[0], 0);
+  CHECK_EQ(m[1], 1);
+  CHECK_EQ(m[2], 2);
+  CHECK(set.Match("a|b bar", &m));
+  CHECK_EQ(m.size(), 2);
+  CHECK_EQ(m[0], 1);
+  CHECK_EQ(m[1], 3);
+  CHECK(!set.Match("nothing here", &m));
+  CHECK(m.empty());
+
+  // Anchored sets
+  RE::Set start(RE::ANCHOR_START);
+  start.Add("GET ", NULL);
+  start.Add("POST ", NULL);
+  start.Add("\\w+ ", NULL);
+  CHECK(start.Compile());
+  CHECK_EQ(start.FirstMatch("POST /index"), 1);
+  CHECK_EQ(start.FirstMatch("PUT /index"), 2);
+  CHECK_EQ(start.FirstMatch(" GET /"), -1);
+  CHECK(start.Match("GET /", &m));
+  CHECK_EQ(m.size(), 2);
+  CHECK_EQ(m[0], 0);
+  CHECK_EQ(m[1], 2);
+
+  RE::Set both(RE::ANCHOR_BOTH, RE_Options().set_caseless(true));
+  both.Add("a+", NULL);
+  both.Add("a+b", NULL);
+  both.Add("(a)\\1b", NULL);
+  both.Add("[ab]+  # letters", NULL);
+  CHECK(both.Compile());
+  CHECK_EQ(both.FirstMatch("AAB"), 1);
+  CHECK_EQ(both.FirstMatch("aab "), -1);
+  CHECK(both.Match("aab", &m));
+  CHECK_EQ(m.size(), 2);
+  CHECK_EQ(m[0], 1);
+  CHECK_EQ(m[1], 2);
+
+  // Extended mode comments do not swallow the joins
+  RE::Set extended(RE::UNANCHORED, RE_Options().set_extended(true));
+  extended.Add("a b  # spaced out", NULL);
+  extended.Add("c", NULL);
+  CHECK(extended.Compile());
+  CHECK_EQ(extended.FirstMatch("xcab"), 1);
+  CHECK(extended.Match("xcab", &m));
+  CHECK_EQ(m.size(), 2);
+
+  // Longest match, as a lexer would pick its token
+  StringPiece token;
+  const string program = "int x->y >= 10";
+  CHECK_EQ(start.LongestMatch("POST /index", &token), 1);   // a tie
+  CHECK_EQ(token.as_string(), "POST ");
+  RE::Set lexer(RE::ANCHOR_START);
+  lexer.Add("int", NULL);                          // 0
+  lexer.Add("[a-z]\\w*", NULL);                    // 1
+  lexer.Add("-|>|>=|->", NULL);                    // 2: first found, not longest
+  lexer.Add("(\\d)\\1", NULL);                     // 3: back reference
+  lexer.Add("\\d+", NULL);                         // 4
+  CHECK(lexer.Compile());
+  CHECK_EQ(lexer.LongestMatch(program, &token), 0);
+  CHECK_EQ(token.as_string(), "int");
+  CHECK(token.data() == program.data());
+  CHECK_EQ(lexer.LongestMatch("integer", &token), 1);
+  CHECK_EQ(token.size(), 7);
+  CHECK_EQ(lexer.LongestMatch("->", &token), 2);
+  CHECK_EQ(token.as_string(), "-");
+  CHECK_EQ(lexer.LongestMatch("11", &token), 3);
+  CHECK_EQ(lexer.LongestMatch("112", &token), 4);
+  CHECK_EQ(token.as_string(), "112");
+  CHECK_EQ(lexer.LongestMatch(" int", &token), -1);
+
+  // Unanchored, the earliest match wins before the longest
+  CHECK_EQ(set.LongestMatch("xx bar 1111 foo", &token), 1);
+  CHECK_EQ(token.as_string(), "bar");
+  CHECK_EQ(set.LongestMatch("xx 1111 foo", &token), 2);
+  CHECK_EQ(token.as_string(), "11");
+  CHECK_EQ(set.LongestMatch("nothing here", &token), -1);
+
+  // Patterns that refer to their groups by number keep their meaning
+  RE::Set numbered;
+  numbered.Add("(a)", NULL);                       // 0
+  numbered.Add("(x)(?1)", NULL);                   // 1: subroutine call
+  numbered.Add("(y)?(?(1)z|w)", NULL);             // 2: condition
+  numbered.Add("(b)\\g<-1>", NULL);                // 3: relative call
+  numbered.Add("[(?1)]c", NULL);                   // 4: only looks like one
+  CHECK(numbered.Compile());
+  CHECK(numbered.Match("xx", &m));
+  CHECK_EQ(m.size(), 1);
+  CHECK_EQ(m[0], 1);
+  CHECK_EQ(numbered.LongestMatch("xx", &token), 1);
+  CHECK_EQ(token.as_string(), "xx");
+  CHECK(numbered.Match("yz bb 1c", &m));
+  CHECK_EQ(m.size(), 3);
+  CHECK_EQ(m[0], 2);
+  CHECK_EQ(m[1], 3);
+  CHECK_EQ(m[2], 4);
+  CHECK_EQ(numbered.FirstMatch("w x xx"), 2);
+  CHECK_EQ(numbered.FirstMatch("xx"), 1);
+
+  // Group names must be unique across the set
+  RE::Set named;
+  CHECK_EQ(named.Add("(?<w>[a-z]+)", &error), 0);
+  CHECK_EQ(named.Add("(?<w>\\d+)", &error), -1);
+  CHECK(error.find("w") != string::npos);
+  CHECK_EQ(named.Add("(?<n>\\d+)", &error), 1);
+  CHECK_EQ(named.Add("(?<v>[a-z])\\k<v>", &error), 2);
+  CHECK(named.Compile());
+  CHECK(named.Match("abc 123 aa", &m));
+  CHECK_EQ(m.size(), 3);
+  CHECK_EQ(named.FirstMatch("-123 abc"), 1);
+  CHECK_EQ(named.FirstMatch("-aa"), 0);
+  CHECK_EQ(named.FirstMatch("-1 xx"), 1);
+
+  RE::Set empty;
+  CHECK(empty.Compile());
+  CHECK_EQ(empty.FirstMatch("anything"), -1);
+  CHECK(!empty.Match("anything", &m));
+  CHECK_EQ(empty.LongestMatch("anything", &token), -1);
+}
+
+static void TestStreamMatcher() {
+  printf("Testing StreamMatcher\n");
+  typedef pcrecpp::StreamMatcher SM;
+
+  // A reply split at every possible point
+  const string input = "noise OK 123\r\nmore OK 45\r\ntail";
+  const RE re("OK (\\d+)\r\n");
+  for (size_t split = 0; split <= input.size(); split++) {
+    SM m(re);
+    std::vector<string> found;
+    std::vector<size_t> positions;
+    StringPiece pieces[2] = { StringPiece(input.data(), split),
+                              StringPiece(input.data() + split,
+                                          input.size() - split) };
+    for (int p = 0; p < 2; p++) {
+      StringPiece piece = pieces[p];
+      while (m.Feed(piece) == SM::MATCHED) {
+        found.push_back(m.match(1).as_string());
+        positions.push_back(m.match_position());
+        piece.clear();
+      }
+    }
+    CHECK_EQ(m.Finish(), SM::NO_MATCH);
+    CHECK_EQ(found.size(), 2);
+    CHECK_EQ(found[0], "123");
+    CHECK_EQ(found[1], "45");
+    CHECK_EQ(positions[0], 6);
+    CHECK_EQ(positions[1], 19);
+  }
+
+  // One byte at a time, checking the status along the way
+  {
+    SM m(re);
+    CHECK_EQ(m.Feed("xx"), SM::NO_MATCH);
+    CHECK_EQ(m.buffered(), 1);           // Context only
+    CHECK_EQ(m.Feed("O"), SM::NEED_MORE);
+    CHECK_EQ(m.Feed("K 1"), SM::NEED_MORE);
+    CHECK_EQ(m.Feed("2\r"), SM::NEED_MORE);
+    CHECK(m.buffered() <= 7);
+    CHECK_EQ(m.Feed("\n"), SM::MATCHED);
+    CHECK_EQ(m.match().as_string(), "OK 12\r\n");
+    CHECK_EQ(m.match(1).as_string(), "12");
+    CHECK_EQ(m.match(2).size(), 0);
+    CHECK_EQ(m.Feed(""), SM::NO_MATCH);
+  }
+
+  // Matches that could grow wait for more data or for the end
+  {
+    const RE m_re("\\d+");
+    SM m(m_re);
+    CHECK_EQ(m.Feed("a12"), SM::NEED_MORE);
+    CHECK_EQ(m.Feed("34"), SM::NEED_MORE);
+    CHECK_EQ(m.Feed("5b"), SM::MATCHED);
+    CHECK_EQ(m.match().as_string(), "12345");
+    CHECK_EQ(m.Feed("67"), SM::NEED_MORE);
+    CHECK_EQ(m.Finish(), SM::MATCHED);
+    CHECK_EQ(m.match().as_string(), "67");
+    CHECK_EQ(m.match_position(), 7);
+    CHECK_EQ(m.Finish(), SM::NO_MATCH);
+  }
+
+  // Rejected data is not kept
+  {
+    const RE m_re("needle");
+    SM m(m_re);
+    string hay(10000, 'x');
+    for (int i = 0; i < 100; i++) {
+      CHECK_EQ(m.Feed(hay), SM::NO_MATCH);
+      CHECK(m.buffered() <= 1);
+    }
+    CHECK_EQ(m.Feed("nee"), SM::NEED_MORE);
+    CHECK_EQ(m.Feed("dle"), SM::MATCHED);
+    CHECK_EQ(m.match_position(), 1000000);
+  }
+
+  // Lookbehind and \A see the right context
+  {
+    const RE m_re("(?<=abc)d");
+    SM m(m_re);
+    CHECK_EQ(m.Feed("xxab"), SM::NO_MATCH);
+    CHECK_EQ(m.Feed("c"), SM::NEED_MORE);
+    CHECK_EQ(m.Feed("d"), SM::MATCHED);
+    CHECK_EQ(m.match_position(), 5);
+
+    const RE a_re("\\Afoo");
+    SM a(a_re);
+    CHECK_EQ(a.Feed("x"), SM::NO_MATCH);
+    CHECK_EQ(a.Feed("foo"), SM::NO_MATCH);
+    const RE b_re("^foo");
+    SM b(b_re);
+    CHECK_EQ(b.Feed("x"), SM::NO_MATCH);
+    CHECK_EQ(b.Feed("foo"), SM::NO_MATCH);
+    const RE c_re("\\bfoo");
+    SM c(c_re);
+    CHECK(c.Feed("x") != SM::MATCHED);
+    CHECK(c.Feed("foo") != SM::MATCHED);
+    CHECK_EQ(c.Finish(), SM::NO_MATCH);
+    CHECK_EQ(c.Feed(" foo"), SM::MATCHED);
+    CHECK_EQ(c.match_position(), 5);
+  }
+
+  // Empty matches advance
+  {
+    const RE m_re("x*");
+    SM m(m_re);
+    CHECK_EQ(m.Feed("ab"), SM::MATCHED);
+    CHECK_EQ(m.match_position(), 0);
+    CHECK_EQ(m.Feed(""), SM::MATCHED);
+    CHECK_EQ(m.match_position(), 1);
+    CHECK_EQ(m.Feed(""), SM::MATCHED);
+    CHECK_EQ(m.match_position(), 2);
+    CHECK_EQ(m.Feed(""), SM::NO_MATCH);
+    CHECK_EQ(m.Feed("xx"), SM::NEED_MORE);
+    CHECK_EQ(m.Finish(), SM::MATCHED);
+    CHECK_EQ(m.match().as_string(), "xx");
+    CHECK_EQ(m.match_position(), 2);
+  }
+
+#ifdef SUPPORT_UTF8
+  // UTF-8 characters split between pieces
+  {
+    const RE m_re("\\x{e9}t\\x{e9}", pcrecpp::UTF8());
+    SM m(m_re);
+    CHECK_EQ(m.Feed("l'\xc3"), SM::NEED_MORE);
+    CHECK_EQ(m.Feed("\xa9t\xc3"), SM::NEED_MORE);
+    CHECK_EQ(m.Feed("\xa9!"), SM::MATCHED);
+    CHECK_EQ(m.match().as_string(), "\xc3\xa9t\xc3\xa9");
+  }
+#endif
+
+  const RE invalid_re("(");
+  SM invalid(invalid_re);
+  CHECK_EQ(invalid.Feed("("), SM::NO_MATCH);
+  CHECK_EQ(invalid.Finish(), SM::NO_MATCH);
+}
+
+static void TestDFA() {
+  printf("Testing DFA engine\n");
+  RE_Options dfa;
+  dfa.set_engine(RE_Options::DFA);
+
+  // Leftmost longest rather than leftmost first
+  StringPiece input("abc");
+  CHECK(RE("a|ab", dfa).Consume(&input));
+  CHECK_EQ(input.as_string(), "c");
+  input = "abc";
+  CHECK(RE("a|ab").Consume(&input));
+  CHECK_EQ(input.as_string(), "bc");
+  CHECK(RE("a|ab", dfa).FullMatch("ab"));
+  CHECK(!RE("a|ab", dfa).FullMatch("abc"));
+  CHECK(RE("b+", dfa).PartialMatch("abbbc"));
+  string s = "xabbbcbb";
+  CHECK_EQ(RE("b+", dfa).GlobalReplace("<\\0>", &s), 2);
+  CHECK_EQ(s, "xa<bbb>c<bb>");
+  s = "abc";
+  CHECK_EQ(RE("x*", dfa).GlobalReplace("-", &s), 4);
+  CHECK_EQ(s, "-a-b-c-");
+
+  // Submatches come from pcre_exec()
+  int i;
+  CHECK(RE("(\\d+)", dfa).FullMatch("123", &i));
+  CHECK_EQ(i, 123);
+  CHECK(RE("(\\d+)", dfa).Match("x123", RE::UNANCHORED, &i));
+  CHECK_EQ(i, 123);
+  CHECK(RE("(\\d+)", dfa).FullMatch("123"));
+  string word;
+  CHECK(RE("(a|ab)(c?)", dfa).PartialMatch("abc", &word));
+  CHECK_EQ(word, "a");
+  s = "a1b";
+  CHECK(RE("(\\d)", dfa).Replace("[\\1]", &s));
+  CHECK_EQ(s, "a[1]b");
+  CHECK(RE("(\\d)", dfa).Replace("<\\0>", &s));
+  CHECK_EQ(s, "a[<1>]b");
+
+  // Patterns the DFA matcher cannot handle still match, every time
+  const RE backref("(a+)b\\1", dfa);
+  for (int k = 0; k < 2; k++) {
+    CHECK(backref.FullMatch("aabaa"));
+    CHECK(!backref.FullMatch("aaba"));
+  }
+
+  // Exponential for backtracking, linear here
+  string text(40, 'a');
+  CHECK(!RE("(a|aa)*c", dfa).PartialMatch(text));
+  CHECK(RE("(a|aa)*", dfa).FullMatch(text));
+
+  // Patterns with many simultaneous states outgrow the first workspace
+  string many;
+  for (int k = 0; k < 300; k++) many += "a?";
+  many += "a*b";
+  CHECK(RE(many, dfa).FullMatch(string(500, 'a') + "b"));
+  CHECK(!RE(many, dfa).FullMatch(string(500, 'a') + "c"));
+
+  // Partial matching
+  const RE digits("\\d+", dfa);
+  pcrecpp::StreamMatcher m(digits);
+  CHECK_EQ(m.Feed("x12"), pcrecpp::StreamMatcher::NEED_MORE);
+  CHECK_EQ(m.Feed("3y"), pcrecpp::StreamMatcher::MATCHED);
+  CHECK_EQ(m.match().as_string(), "123");
+}
+
+static void TestRewriter() {
+  printf("Testing Rewriter\n");
+  using pcrecpp::Rewriter;
+
+  CHECK(Rewriter("plain").ok());
+  CHECK_EQ(Rewriter("plain").max_group(), 0);
+  CHECK_EQ(Rewriter("\\2-\\1\\\\x\\9").max_group(), 9);
+  CHECK(!Rewriter("bad \\q").ok());
+  CHECK(!Rewriter("trailing \\").ok());
+
+  const RE re("(\\w+)@(\\w+)");
+  const Rewriter swap("\\2 at \\1 (\\\\\\0)");
+  string s = "mail kremenek@google and ph@cam";
+  CHECK_EQ(re.GlobalReplace(swap, &s), 2);
+  CHECK_EQ(s, "mail google at kremenek (\\kremenek@google) and "
+              "cam at ph (\\ph@cam)");
+
+  // Output into a reused string
+  string out = "stale contents";
+  CHECK_EQ(RE("b+").GlobalReplace(Rewriter("d"), "yabba dabba doo", &out),
+           2);
+  CHECK_EQ(out, "yada dada doo");
+  const size_t capacity = out.capacity();
+  CHECK_EQ(RE("b+").GlobalReplace(Rewriter("d"), "abba", &out), 1);
+  CHECK_EQ(out, "ada");
+  CHECK_EQ(out.capacity(), capacity);
+  CHECK_EQ(RE("x").GlobalReplace(Rewriter("d"), "abba", &out), 0);
+  CHECK_EQ(out, "abba");
+
+  // Invalid rewrites and groups that did not take part
+  s = "abc";
+  CHECK_EQ(RE("b").GlobalReplace(Rewriter("\\q"), &s), 0);
+  CHECK_EQ(s, "abc");
+  CHECK_EQ(RE("(a)|(b)").GlobalReplace(Rewriter("<\\1\\2\\5>"), &s), 2);
+  CHECK_EQ(s, "<a><b>c");
+
+  // Empty matches: one search per position, perl's results
+  s = "aa";
+  CHECK_EQ(RE("b*|aa").GlobalReplace(Rewriter("@"), &s), 3);
+  CHECK_EQ(s, "@@@");
+  s = "abc";
+  CHECK_EQ(RE("b*").GlobalReplace(Rewriter("-"), &s), 4);
+  CHECK_EQ(s, "-a--c-");
+  s = "";
+  CHECK_EQ(RE("x*").GlobalReplace(Rewriter("-"), &s), 1);
+  CHECK_EQ(s, "-");
+}
+
+static void TestFindAll() {
+  printf("Testing FindAll\n");
+
+  const RE re("(\\w+)=(\\d+)?");
+  const string text = "a=1, bb=, ccc=333";
+  std::vector<string> names, values;
+  std::vector<int> positions;
+  for (const pcrecpp::MatchSpans& m : re.FindAll(text)) {
+    CHECK_EQ(m.size(), 3);
+    names.push_back(m[1].as_string());
+    values.push_back(m[2].data() == NULL ? "unset" : m[2].as_string());
+    positions.push_back(m.position());
+  }
+  CHECK_EQ(names.size(), 3);
+  CHECK_EQ(names[0], "a");
+  CHECK_EQ(names[2], "ccc");
+  CHECK_EQ(values[0], "1");
+  CHECK_EQ(values[1], "unset");
+  CHECK_EQ(values[2], "333");
+  CHECK_EQ(positions[1], 5);
+
+  // Pieces point into the subject
+  RE::FindAllIterator it = re.FindAll(text).begin();
+  CHECK((*it)[0].data() == text.data());
+  CHECK(it->size() == 3);
+  CHECK((*it)[3].data() == NULL);
+  CHECK((*it)[-1].data() == NULL);
+
+  // Empty matches step on like GlobalReplace
+  string joined;
+  const RE bs("b*"), bs_or_aa("b*|aa"), xs("x*");
+  for (const pcrecpp::MatchSpans& m : bs.FindAll("abc"))
+    joined += "<" + m[0].as_string() + ">";
+  CHECK_EQ(joined, "<><b><><>");
+  int count = 0;
+  for (const pcrecpp::MatchSpans& m : bs_or_aa.FindAll("aa")) {
+    (void)m;
+    count++;
+  }
+  CHECK_EQ(count, 3);
+  count = 0;
+  for (const pcrecpp::MatchSpans& m : xs.FindAll("")) {
+    CHECK_EQ(m.position(), 0);
+    count++;
+  }
+  CHECK_EQ(count, 1);
+
+  // Nothing to find
+  const RE none("z");
+  CHECK(none.FindAll("abc").begin() == none.FindAll("abc").end());
+  const RE invalid("(");
+  CHECK(invalid.FindAll("(").begin() == invalid.FindAll("(").end());
+
+  // The same matches as a FindAndConsume loop
+  const RE word("(\\w+)");
+  StringPiece input("the quick  brown fox");
+  string w;
+  it = word.FindAll(input).begin();
+  while (word.FindAndConsume(&input, &w)) {
+    CHECK(it != RE::FindAllIterator());
+    CHECK_EQ((*it)[1].as_string(), w);
+    ++it;
+  }
+  CHECK(it == RE::FindAllIterator());
+}
+
+// Join the fields with '|' to check them in one go
+static string JoinFields(const std::vector<StringPiece>& fields) {
+  string joined;
+  for (size_t i = 0; i < fields.size(); i++) {
+    if (i > 0) joined += "|";
+    joined += fields[i].as_string();
+  }
+  return joined;
+}
+
+static void TestSplit() {
+  printf("Testing Split\n");
+
+  std::vector<StringPiece> fields;
+  const string wave = "sine, square, , triangle";
+
+  // Literal separator, found without running the matcher
+  const RE comma(", ");
+  CHECK_EQ(comma.Split(wave, &fields), 4);
+  CHECK_EQ(JoinFields(fields), "sine|square||triangle");
+  CHECK(fields[0].data() == wave.data());
+  CHECK(fields[3].data() == wave.data() + 16);
+  CHECK_EQ(comma.Split(", a, ", &fields), 3);
+  CHECK_EQ(JoinFields(fields), "|a|");
+  CHECK_EQ(comma.Split("no separator", &fields), 1);
+  CHECK_EQ(comma.Split("", &fields), 0);
+  CHECK(fields.empty());
+
+  // The vector keeps its capacity
+  fields.reserve(16);
+  const size_t capacity = fields.capacity();
+  CHECK_EQ(comma.Split(wave, &fields), 4);
+  CHECK_EQ(fields.capacity(), capacity);
+
+  // Escaped and single-character literals
+  const RE dot(RE::QuoteMeta(".")), quoted(RE::QuoteMeta("a+b"));
+  CHECK_EQ(dot.Split("1.2.3", &fields), 3);
+  CHECK_EQ(JoinFields(fields), "1|2|3");
+  CHECK_EQ(quoted.Split("xa+bya+b", &fields), 3);
+  CHECK_EQ(JoinFields(fields), "x|y|");
+  const RE nul(RE::QuoteMeta(string("\0", 1)));
+  CHECK_EQ(nul.Split(StringPiece("a\0b", 3), &fields), 2);
+  CHECK_EQ(JoinFields(fields), "a|b");
+  const RE repeated("aab");
+  CHECK_EQ(repeated.Split("xaaaabyaab", &fields), 3);
+  CHECK_EQ(JoinFields(fields), "xaa|y|");
+
+  // Separators that need the matcher, including caseless literals
+  const RE spaces("\\s*,\\s*");
+  const RE caseless("and", RE_Options().set_caseless(true));
+  CHECK_EQ(spaces.Split("a ,b,  c", &fields), 3);
+  CHECK_EQ(JoinFields(fields), "a|b|c");
+  CHECK_EQ(caseless.Split("salt AND pepper and oil", &fields), 3);
+  CHECK_EQ(JoinFields(fields), "salt | pepper | oil");
+
+  // Empty matches split between characters, but not at either end
+  const RE nothing(""), optional_comma(",?");
+  CHECK_EQ(nothing.Split("abc", &fields), 3);
+  CHECK_EQ(JoinFields(fields), "a|b|c");
+  CHECK_EQ(optional_comma.Split("a,bc,", &fields), 4);
+  CHECK_EQ(JoinFields(fields), "a|b|c|");
+
+  // Limiting the number of fields
+  CHECK_EQ(comma.Split(wave, &fields, 2), 2);
+  CHECK_EQ(JoinFields(fields), "sine|square, , triangle");
+  CHECK_EQ(comma.Split(wave, &fields, 1), 1);
+  CHECK_EQ(fields[0], wave);
+  CHECK_EQ(spaces.Split("a,b,c", &fields, 2), 2);
+  CHECK_EQ(JoinFields(fields), "a|b,c");
+
+  // An invalid pattern splits nothing
+  const RE invalid("(");
+  CHECK_EQ(invalid.Split("a(b", &fields), -1);
+
+  // Tokenize() stops when the callback says so
+  std::vector<string> seen;
+  int count = comma.Tokenize(wave, [&seen](const StringPiece& field) {
+    seen.push_back(field.as_string());
+    return field != "square";
+  });
+  CHECK_EQ(count, 2);
+  CHECK_EQ(seen.size(), 2);
+  CHECK_EQ(seen[1], "square");
+  count = spaces.Tokenize("x, y", [](const StringPiece&) { return true; });
+  CHECK_EQ(count, 2);
+}
+
+static void TestNamedGroups() {
+  printf("Testing named groups\n");
+
+  const RE re("(?<name>\\w+)=(?<temp>-?\\d+)(?<unit>[CF])?");
+  CHECK_EQ(re.NamedGroupIndex("name"), 1);
+  CHECK_EQ(re.NamedGroupIndex("temp"), 2);
+  CHECK_EQ(re.NamedGroupIndex("unit"), 3);
+  CHECK_EQ(re.NamedGroupIndex("missing"), -1);
+  CHECK_EQ(re.NamedGroupIndex(""), -1);
+  CHECK_EQ(RE("(a)(b)").NamedGroupIndex("a"), -1);
+  CHECK_EQ(RE("(?<a>").NamedGroupIndex("a"), -1);
+
+  // In any order, and not necessarily all of them
+  int t = 0;
+  string name, unit = "unset";
+  CHECK(re.MatchNamed("oven=-21C", RE::Named("temp", &t),
+                      RE::Named("name", &name), RE::Named("unit", &unit)));
+  CHECK_EQ(t, -21);
+  CHECK_EQ(name, "oven");
+  CHECK_EQ(unit, "C");
+  CHECK(re.MatchNamed("fridge=4", RE::Named("unit", &unit)));
+  CHECK_EQ(unit, "");
+  CHECK(re.MatchNamed("x=0"));
+
+  // With parsers and anchors
+  CHECK(RE("(?<n>[0-9a-f]+)").MatchNamed("ff", RE::Named("n", Hex(&t))));
+  CHECK_EQ(t, 255);
+  CHECK(re.MatchNamed("set fan=3 now", RE::UNANCHORED,
+                      RE::Named("name", &name)));
+  CHECK_EQ(name, "fan");
+  CHECK(!re.MatchNamed("set fan=3 now", RE::Named("name", &name)));
+
+  // Unknown names and failed parses
+  CHECK(!re.MatchNamed("oven=21", RE::Named("tmp", &t)));
+  char c;
+  CHECK(!re.MatchNamed("oven=21", RE::Named("temp", &c)));
+
+  // Duplicate names: the lowest number, but the group that matched
+  const RE dup("(?J)(?<v>a)|(?<v>b)");
+  CHECK_EQ(dup.NamedGroupIndex("v"), 1);
+  CHECK(dup.MatchNamed("b", RE::Named("v", &name)));
+  CHECK_EQ(name, "b");
+  CHECK(dup.MatchNamed("a", RE::Named("v", &name)));
+  CHECK_EQ(name, "a");
+  CHECK(RE("(?J)(?<n>x)?(?<n>\\d+)").MatchNamed("42", RE::Named("n", &t)));
+  CHECK_EQ(t, 42);
+  CHECK(RE("(?|(?<v>a)|(?<v>b))").MatchNamed("b", RE::Named("v", &name)));
+  CHECK_EQ(name, "b");
+
+  // Groups beyond kMaxArgs
+  string pattern;
+  for (int i = 1; i <= 20; i++) {
+    char group[32];
+    sprintf(group, "(?<g%d>%d)", i, i % 10);
+    pattern += group;
+  }
+  const RE many(pattern);
+  CHECK_EQ(many.NamedGroupIndex("g20"), 20);
+  CHECK(many.MatchNamed("12345678901234567890", RE::Named("g19", &t)));
+  CHECK_EQ(t, 9);
 }
 
 int main(int argc, char** argv) {
@@ -1285,6 +2322,27 @@ int main(int argc, char** argv) {
   // Test the constructors
   TestConstructors();
 
+  // Test studied and JIT compiled expressions
+  TestStudyAndJit();
+
+  // Test reuse of the unanchored form for full matches
+  TestEndAnchoredPatterns();
+
+  // Test sharing of compiled programs between REs
+  TestCache();
+
+  // Test matches that record few or no offsets
+  TestVectorSizing();
+  TestNumberParsing();
+  TestTypedMatch();
+  TestSet();
+  TestStreamMatcher();
+  TestDFA();
+  TestRewriter();
+  TestFindAll();
+  TestSplit();
+  TestNamedGroups();
+
   // Done
   printf("OK\n");
 
@@ -67,7 +67,10 @@ class PCRECPP_EXP_DEFN Arg {
 // Type-specific parsers
 #define PCRE_MAKE_PARSER(type,name)                             \
   Arg(type* p) : arg_(p), parser_(name) { }                     \
-  Arg(type* p, Parser parser) : arg_(p), parser_(parser) { }
+  Arg(type* p, Parser parser) : arg_(p), parser_(parser) { }    \
+  static bool ParseInto(const char* str, int n, type* p) {      \
+    return name(str, n, p);                                     \
+  }
 
 
   PCRE_MAKE_PARSER(char,               parse_char);
@@ -101,6 +104,19 @@ class PCRECPP_EXP_DEFN Arg {
   // Parse the data
   bool Parse(const char* str, int n) const;
 
+  // Parse the data into "*p" with the parser picked at compile time
+  // from the type of "p".  Used by the typed matching interface
+  // (RE::Match), which avoids building an Arg per capture.
+  template <class T> static bool ParseInto(const char* str, int n, T* p) {
+    return _RE_MatchObject<T>::Parse(str, n, p);
+  }
+  static bool ParseInto(const char* str, int n, const Arg& arg) {
+    return arg.Parse(str, n);
+  }
+  static bool ParseInto(const char* str, int n, void* p) {
+    return parse_null(str, n, p);
+  }
+
  private:
   void*         arg_;
   Parser        parser_;
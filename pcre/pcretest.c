@@ -298,6 +298,23 @@ argument, the casting might be incorrectly applied. */
 #define PCRE_JIT_STACK_FREE8(stack) \
   pcre_jit_stack_free(stack)
 
+#define PCRE_MATCH_CONTEXT_ALLOC8() \
+  pcre_match_context_alloc()
+
+#define PCRE_MATCH_CONTEXT_FREE8(context) \
+  pcre_match_context_free(context)
+
+#define PCRE_MATCH_CONTEXT_PEAK_DEPTH8(context) \
+  pcre_match_context_peak_depth(context)
+
+#define PCRE_MATCH_CONTEXT_BIND8(rc, context, re, extra) \
+  rc = pcre_match_context_bind(context, re, extra)
+
+#define PCRE_EXEC_CTX8(count, context, bptr, len, start_offset, options, \
+    offsets, size_offsets) \
+  count = pcre_exec_ctx(context, (char *)bptr, len, start_offset, options, \
+    offsets, size_offsets)
+
 #define pcre8_maketables pcre_maketables
 
 #endif /* SUPPORT_PCRE8 */
@@ -392,6 +409,24 @@ argument, the casting might be incorrectly applied. */
 #define PCRE_JIT_STACK_FREE16(stack) \
   pcre16_jit_stack_free((pcre16_jit_stack *)stack)
 
+#define PCRE_MATCH_CONTEXT_ALLOC16() \
+  (pcre_match_context *)pcre16_match_context_alloc()
+
+#define PCRE_MATCH_CONTEXT_FREE16(context) \
+  pcre16_match_context_free((pcre16_match_context *)context)
+
+#define PCRE_MATCH_CONTEXT_PEAK_DEPTH16(context) \
+  pcre16_match_context_peak_depth((pcre16_match_context *)context)
+
+#define PCRE_MATCH_CONTEXT_BIND16(rc, context, re, extra) \
+  rc = pcre16_match_context_bind((pcre16_match_context *)context, \
+    (pcre16 *)re, (pcre16_extra *)extra)
+
+#define PCRE_EXEC_CTX16(count, context, bptr, len, start_offset, options, \
+    offsets, size_offsets) \
+  count = pcre16_exec_ctx((pcre16_match_context *)context, \
+    (PCRE_SPTR16)bptr, len, start_offset, options, offsets, size_offsets)
+
 #endif /* SUPPORT_PCRE16 */
 
 /* -----------------------------------------------------------*/
@@ -484,6 +519,24 @@ argument, the casting might be incorrectly applied. */
 #define PCRE_JIT_STACK_FREE32(stack) \
   pcre32_jit_stack_free((pcre32_jit_stack *)stack)
 
+#define PCRE_MATCH_CONTEXT_ALLOC32() \
+  (pcre_match_context *)pcre32_match_context_alloc()
+
+#define PCRE_MATCH_CONTEXT_FREE32(context) \
+  pcre32_match_context_free((pcre32_match_context *)context)
+
+#define PCRE_MATCH_CONTEXT_PEAK_DEPTH32(context) \
+  pcre32_match_context_peak_depth((pcre32_match_context *)context)
+
+#define PCRE_MATCH_CONTEXT_BIND32(rc, context, re, extra) \
+  rc = pcre32_match_context_bind((pcre32_match_context *)context, \
+    (pcre32 *)re, (pcre32_extra *)extra)
+
+#define PCRE_EXEC_CTX32(count, context, bptr, len, start_offset, options, \
+    offsets, size_offsets) \
+  count = pcre32_exec_ctx((pcre32_match_context *)context, \
+    (PCRE_SPTR32)bptr, len, start_offset, options, offsets, size_offsets)
+
 #endif /* SUPPORT_PCRE32 */
 
 
@@ -689,6 +742,48 @@ cases separately. */
   else \
     PCRE_JIT_STACK_FREE8(stack)
 
+#define PCRE_MATCH_CONTEXT_ALLOC() \
+  (pcre_mode == PCRE32_MODE ? \
+     PCRE_MATCH_CONTEXT_ALLOC32() \
+    : pcre_mode == PCRE16_MODE ? \
+      PCRE_MATCH_CONTEXT_ALLOC16() \
+      : PCRE_MATCH_CONTEXT_ALLOC8())
+
+#define PCRE_MATCH_CONTEXT_FREE(context) \
+  if (pcre_mode == PCRE32_MODE) \
+    PCRE_MATCH_CONTEXT_FREE32(context); \
+  else if (pcre_mode == PCRE16_MODE) \
+    PCRE_MATCH_CONTEXT_FREE16(context); \
+  else \
+    PCRE_MATCH_CONTEXT_FREE8(context)
+
+#define PCRE_MATCH_CONTEXT_PEAK_DEPTH(context) \
+  (pcre_mode == PCRE32_MODE ? \
+     PCRE_MATCH_CONTEXT_PEAK_DEPTH32(context) \
+    : pcre_mode == PCRE16_MODE ? \
+      PCRE_MATCH_CONTEXT_PEAK_DEPTH16(context) \
+      : PCRE_MATCH_CONTEXT_PEAK_DEPTH8(context))
+
+#define PCRE_MATCH_CONTEXT_BIND(rc, context, re, extra) \
+  if (pcre_mode == PCRE32_MODE) \
+    PCRE_MATCH_CONTEXT_BIND32(rc, context, re, extra); \
+  else if (pcre_mode == PCRE16_MODE) \
+    PCRE_MATCH_CONTEXT_BIND16(rc, context, re, extra); \
+  else \
+    PCRE_MATCH_CONTEXT_BIND8(rc, context, re, extra)
+
+#define PCRE_EXEC_CTX(count, context, bptr, len, start_offset, options, \
+    offsets, size_offsets) \
+  if (pcre_mode == PCRE32_MODE) \
+    PCRE_EXEC_CTX32(count, context, bptr, len, start_offset, options, \
+      offsets, size_offsets); \
+  else if (pcre_mode == PCRE16_MODE) \
+    PCRE_EXEC_CTX16(count, context, bptr, len, start_offset, options, \
+      offsets, size_offsets); \
+  else \
+    PCRE_EXEC_CTX8(count, context, bptr, len, start_offset, options, \
+      offsets, size_offsets)
+
 #define PCRE_MAKETABLES \
   (pcre_mode == PCRE32_MODE ? pcre32_maketables() : pcre_mode == PCRE16_MODE ? pcre16_maketables() : pcre_maketables())
 
@@ -885,6 +980,37 @@ the three different cases. */
   else \
     G(PCRE_JIT_STACK_FREE,BITTWO)(stack)
 
+#define PCRE_MATCH_CONTEXT_ALLOC() \
+  (pcre_mode == G(G(PCRE,BITONE),_MODE)) ? \
+     G(PCRE_MATCH_CONTEXT_ALLOC,BITONE)() \
+    : G(PCRE_MATCH_CONTEXT_ALLOC,BITTWO)()
+
+#define PCRE_MATCH_CONTEXT_FREE(context) \
+  if (pcre_mode == G(G(PCRE,BITONE),_MODE)) \
+    G(PCRE_MATCH_CONTEXT_FREE,BITONE)(context); \
+  else \
+    G(PCRE_MATCH_CONTEXT_FREE,BITTWO)(context)
+
+#define PCRE_MATCH_CONTEXT_PEAK_DEPTH(context) \
+  ((pcre_mode == G(G(PCRE,BITONE),_MODE)) ? \
+     G(PCRE_MATCH_CONTEXT_PEAK_DEPTH,BITONE)(context) \
+    : G(PCRE_MATCH_CONTEXT_PEAK_DEPTH,BITTWO)(context))
+
+#define PCRE_MATCH_CONTEXT_BIND(rc, context, re, extra) \
+  if (pcre_mode == G(G(PCRE,BITONE),_MODE)) \
+    G(PCRE_MATCH_CONTEXT_BIND,BITONE)(rc, context, re, extra); \
+  else \
+    G(PCRE_MATCH_CONTEXT_BIND,BITTWO)(rc, context, re, extra)
+
+#define PCRE_EXEC_CTX(count, context, bptr, len, start_offset, options, \
+    offsets, size_offsets) \
+  if (pcre_mode == G(G(PCRE,BITONE),_MODE)) \
+    G(PCRE_EXEC_CTX,BITONE)(count, context, bptr, len, start_offset, \
+      options, offsets, size_offsets); \
+  else \
+    G(PCRE_EXEC_CTX,BITTWO)(count, context, bptr, len, start_offset, \
+      options, offsets, size_offsets)
+
 #define PCRE_MAKETABLES \
   (pcre_mode == G(G(PCRE,BITONE),_MODE)) ? \
     G(G(pcre,BITONE),_maketables)() : G(G(pcre,BITTWO),_maketables)()
@@ -938,6 +1064,11 @@ the three different cases. */
 #define PCRE_GET_SUBSTRING_LIST   PCRE_GET_SUBSTRING_LIST8
 #define PCRE_JIT_STACK_ALLOC      PCRE_JIT_STACK_ALLOC8
 #define PCRE_JIT_STACK_FREE       PCRE_JIT_STACK_FREE8
+#define PCRE_MATCH_CONTEXT_ALLOC  PCRE_MATCH_CONTEXT_ALLOC8
+#define PCRE_MATCH_CONTEXT_FREE   PCRE_MATCH_CONTEXT_FREE8
+#define PCRE_MATCH_CONTEXT_PEAK_DEPTH PCRE_MATCH_CONTEXT_PEAK_DEPTH8
+#define PCRE_MATCH_CONTEXT_BIND   PCRE_MATCH_CONTEXT_BIND8
+#define PCRE_EXEC_CTX             PCRE_EXEC_CTX8
 #define PCRE_MAKETABLES           pcre_maketables()
 #define PCRE_PATTERN_TO_HOST_BYTE_ORDER PCRE_PATTERN_TO_HOST_BYTE_ORDER8
 #define PCRE_PRINTINT             PCRE_PRINTINT8
@@ -969,6 +1100,11 @@ the three different cases. */
 #define PCRE_GET_SUBSTRING_LIST   PCRE_GET_SUBSTRING_LIST16
 #define PCRE_JIT_STACK_ALLOC      PCRE_JIT_STACK_ALLOC16
 #define PCRE_JIT_STACK_FREE       PCRE_JIT_STACK_FREE16
+#define PCRE_MATCH_CONTEXT_ALLOC  PCRE_MATCH_CONTEXT_ALLOC16
+#define PCRE_MATCH_CONTEXT_FREE   PCRE_MATCH_CONTEXT_FREE16
+#define PCRE_MATCH_CONTEXT_PEAK_DEPTH PCRE_MATCH_CONTEXT_PEAK_DEPTH16
+#define PCRE_MATCH_CONTEXT_BIND   PCRE_MATCH_CONTEXT_BIND16
+#define PCRE_EXEC_CTX             PCRE_EXEC_CTX16
 #define PCRE_MAKETABLES           pcre16_maketables()
 #define PCRE_PATTERN_TO_HOST_BYTE_ORDER PCRE_PATTERN_TO_HOST_BYTE_ORDER16
 #define PCRE_PRINTINT             PCRE_PRINTINT16
@@ -1000,6 +1136,11 @@ the three different cases. */
 #define PCRE_GET_SUBSTRING_LIST   PCRE_GET_SUBSTRING_LIST32
 #define PCRE_JIT_STACK_ALLOC      PCRE_JIT_STACK_ALLOC32
 #define PCRE_JIT_STACK_FREE       PCRE_JIT_STACK_FREE32
+#define PCRE_MATCH_CONTEXT_ALLOC  PCRE_MATCH_CONTEXT_ALLOC32
+#define PCRE_MATCH_CONTEXT_FREE   PCRE_MATCH_CONTEXT_FREE32
+#define PCRE_MATCH_CONTEXT_PEAK_DEPTH PCRE_MATCH_CONTEXT_PEAK_DEPTH32
+#define PCRE_MATCH_CONTEXT_BIND   PCRE_MATCH_CONTEXT_BIND32
+#define PCRE_EXEC_CTX             PCRE_EXEC_CTX32
 #define PCRE_MAKETABLES           pcre32_maketables()
 #define PCRE_PATTERN_TO_HOST_BYTE_ORDER PCRE_PATTERN_TO_HOST_BYTE_ORDER32
 #define PCRE_PRINTINT             PCRE_PRINTINT32
@@ -2533,6 +2674,12 @@ re->ref_count = swap_uint16(re->ref_count);
 if (extra != NULL && (extra->flags & PCRE_EXTRA_STUDY_DATA) != 0)
   {
   pcre_study_data *rsd = (pcre_study_data *)(extra->study_data);
+  if ((rsd->flags & PCRE_STUDY_REQSTR) != 0)
+    {
+    rsd->req_min_offset = swap_uint32(rsd->req_min_offset);
+    rsd->req_max_offset = swap_uint32(rsd->req_max_offset);
+    rsd->req_length = swap_uint32(rsd->req_length);
+    }
   rsd->size = swap_uint32(rsd->size);
   rsd->flags = swap_uint32(rsd->flags);
   rsd->minlength = swap_uint32(rsd->minlength);
@@ -3024,6 +3171,7 @@ int *dfa_workspace = NULL;
 #endif
 
 pcre_jit_stack *jit_stack = NULL;
+pcre_match_context *match_context = NULL;
 
 /* These vectors store, end-to-end, a list of zero-terminated captured
 substring names, each list itself being terminated by an empty name. Assume
@@ -4501,6 +4649,7 @@ while (!done)
     int start_offset_sign = 1;
     int g_notempty = 0;
     int use_dfa = 0;
+    int use_match_context = 0;
 
     *copynames = 0;
     *getnames = 0;
@@ -4899,6 +5048,10 @@ while (!done)
         show_malloc = 1;
         continue;
 
+        case 'X':
+        use_match_context = 1;
+        continue;
+
         case 'Y':
         options |= PCRE_NO_START_OPTIMIZE;
         continue;
@@ -5119,6 +5272,31 @@ while (!done)
     if (verify_jit && jit_stack == NULL && extra != NULL)
        { PCRE_ASSIGN_JIT_STACK(extra, jit_callback, jit_stack); }
 
+    /* If \X is present, bind the pattern's match context to it. The context
+    is kept for the rest of this pattern's data lines, but it is bound afresh
+    each time because the extra data may have changed. The context is used only
+    by the interpretive matcher, so the bound copy of the extra data does not
+    use JIT. */
+
+    if (use_match_context)
+      {
+      int rc;
+      unsigned long int jit_flag = 0;
+      if (match_context == NULL) match_context = PCRE_MATCH_CONTEXT_ALLOC();
+      if (extra != NULL)
+        {
+        jit_flag = extra->flags & PCRE_EXTRA_EXECUTABLE_JIT;
+        extra->flags &= ~PCRE_EXTRA_EXECUTABLE_JIT;
+        }
+      PCRE_MATCH_CONTEXT_BIND(rc, match_context, re, extra);
+      if (extra != NULL) extra->flags |= jit_flag;
+      if (rc < 0)
+        {
+        fprintf(outfile, "Error %d binding the match context\n", rc);
+        goto NEXT_DATA;
+        }
+      }
+
     for (;; gmatched++)    /* Loop for /g or /G */
       {
       markptr = NULL;
@@ -5222,10 +5400,21 @@ while (!done)
         }
 #endif
 
+      /* Otherwise match once, through the bound match context if \X is
+      present. */
+
       else
         {
-        PCRE_EXEC(count, re, extra, bptr, len, start_offset,
-          options | g_notempty, use_offsets, use_size_offsets);
+        if (use_match_context)
+          {
+          PCRE_EXEC_CTX(count, match_context, bptr, len, start_offset,
+            options | g_notempty, use_offsets, use_size_offsets);
+          }
+        else
+          {
+          PCRE_EXEC(count, re, extra, bptr, len, start_offset,
+            options | g_notempty, use_offsets, use_size_offsets);
+          }
         if (count == 0)
           {
           fprintf(outfile, "Matched, but too many substrings\n");
@@ -5694,6 +5883,10 @@ while (!done)
         }
       }  /* End of loop for /g and /G */
 
+    if (use_match_context)
+      fprintf(outfile, "Peak match() depth = %lu\n",
+        PCRE_MATCH_CONTEXT_PEAK_DEPTH(match_context));
+
     NEXT_DATA: continue;
     }    /* End of loop for data lines */
 
@@ -5719,6 +5912,11 @@ while (!done)
     PCRE_JIT_STACK_FREE(jit_stack);
     jit_stack = NULL;
     }
+  if (match_context != NULL)
+    {
+    PCRE_MATCH_CONTEXT_FREE(match_context);
+    match_context = NULL;
+    }
   }
 
 if (infile == stdin) fprintf(outfile, "\n");